@@ -1,50 +1,1232 @@
 #include "buffer/buffer_manager.h"
 
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+
+#include "common/error.h"
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
 
 /*
-This is only a dummy implementation of a buffer manager. It does not do any
-disk I/O or locking. It also does not respect the page_count and creates a new
-buffer for every fixed page and does so without using any latches so it is not
-thread-safe.
+The buffer manager keeps at most `page_count` pages in memory and replaces
+them with the `ReplacementPolicy` that it was constructed with, 2Q by default:
+a page that is fixed for the first time enters the FIFO list, a page that is
+fixed again while it is resident moves to the end of the LRU list. Victims are
+taken from the front of the FIFO list first and from the front of the LRU list
+only when every FIFO page is fixed. The policy names the victims in order, and
+the buffer manager takes the first one that is not fixed. Dirty victims are
+written back to the file of their segment before the frame is reused.
+
+All page memory is one arena that is allocated at construction, the page
+table and the state of the policies are flat, so fixing a page never
+allocates.
+
+Latching: the page table is split into partitions with one latch each, which
+also protects the fix count and dirty bit of the frames mapped in it. The
+replacement policy and the free list share one latch that is only held for
+their updates; hits under CLOCK only set a bit and skip it. Page contents are
+protected by a reader/writer latch per frame that is held from `fix_page()` to
+`unfix_page()`. No pool latch is held while waiting for a frame latch or doing
+I/O; a page that is being loaded is exclusively latched by the loading thread,
+so other fixes of it wait there.
+
+Write back: a dirty victim is pinned and latched shared while it is written,
+so it stays resident and readable but cannot change, and it is clean
+afterwards. The optional cleaner thread does the same for the next victims
+ahead of time, in batches that are sorted by page id, so fixes mostly find
+clean victims and write nothing themselves.
+
+Prefetching: a background thread loads the pages that `prefetch()` asks for
+through an `IOQueue`, so many reads are in flight at once. Like a fix, it maps
+each page to a frame that stays exclusively latched until the page is read,
+so fixes of a page in flight wait on the frame latch. Prefetched pages count
+as not accessed yet.
+
+Optimistic readers use `peek_page()`, which reads the page table without its
+latch, and validate against the frame version. Every exclusive latch of a
+frame, including the one taken to evict a page and load another, changes the
+version, so a reader notices both modifications and replacements.
+
+Logging: with a log, every exclusive fix copies the page into a shadow frame,
+and the unfix of a dirty page logs the byte ranges that differ from the copy.
+Redo just writes these bytes again, which is correct no matter which version
+of the page is on disk, so pages need no LSN of their own. Records are
+appended while the page is still latched, so the log has the changes of each
+page in order, and a page is written back only after its last record is
+durable.
+
+Mapped segments: the pages of a read-only segment can be served from a
+mapping of its file instead. Each page gets a frame of its own that points
+into the mapping and is never latched or replaced, so a fix of such a page is
+a lookup in `mapped_segments` and nothing else.
+
+Statistics: every thread counts events in a slot of counters of its own, with
+relaxed atomic loads and stores, so counting adds no latch, no read-modify-write
+and no shared cache line to a fix. `get_stats()` sums up the slots. Latch waits
+are sampled: one in `kLatchSampleInterval` acquisitions of a thread tries the
+latch first and, if another thread holds it, times the wait.
 */
 
 
 namespace buzzdb {
 
+namespace {
+
+/// A changed byte range of a page in a log record, followed by the bytes.
+struct PageChange {
+    uint64_t page_id;
+    uint32_t offset;
+    uint32_t size;
+};
+
+/// One in this many latch acquisitions of a thread is checked for a wait.
+constexpr uint32_t kLatchSampleInterval = 16;
+
+/// Should the calling thread check its next latch acquisition for a wait?
+bool is_latch_sampled() {
+    thread_local uint32_t countdown = 0;
+    if (countdown != 0) {
+        --countdown;
+        return false;
+    }
+    countdown = kLatchSampleInterval - 1;
+    return true;
+}
+
+}  // namespace
+
+
+thread_local BufferManager::AtomicChange* BufferManager::AtomicChange::current = nullptr;
+
+
 char* BufferFrame::get_data() {
-    return data.data();
+    return data;
+}
+
+
+size_t PageTable::Table::slot_of(uint64_t page_id) const {
+    // Fibonacci hashing spreads the consecutive page ids of a segment (and
+    // the segment id in the upper bits) over the whole table.
+    return (page_id * 0x9E3779B97F4A7C15ull) >> shift;
+}
+
+
+PageTable::PageTable(size_t capacity) {
+    // Start at a load factor of at most 50% so that probe sequences stay short.
+    size_t slot_count = 16;
+    unsigned shift = 60;
+    while (slot_count < 2 * capacity) {
+        slot_count *= 2;
+        --shift;
+    }
+    tables.push_back(std::make_unique<Table>(slot_count, shift));
+    table = tables.back().get();
+}
+
+
+void PageTable::grow() {
+    const Table& old_table = *tables.back();
+    tables.push_back(std::make_unique<Table>((old_table.mask + 1) * 2, old_table.shift - 1));
+    Table& new_table = *tables.back();
+    for (size_t i = 0; i <= old_table.mask; ++i) {
+        uint64_t page_id = old_table.slots[i].page_id.load(std::memory_order_relaxed);
+        if (page_id != INVALID_PAGE_ID) {
+            size_t slot = new_table.slot_of(page_id);
+            while (new_table.slots[slot].page_id.load(std::memory_order_relaxed) != INVALID_PAGE_ID) {
+                slot = (slot + 1) & new_table.mask;
+            }
+            new_table.slots[slot].frame_id.store(old_table.slots[i].frame_id.load(std::memory_order_relaxed),
+                                                 std::memory_order_relaxed);
+            new_table.slots[slot].page_id.store(page_id, std::memory_order_relaxed);
+        }
+    }
+    table.store(&new_table, std::memory_order_release);
+}
+
+
+uint64_t PageTable::find(uint64_t page_id) const {
+    const Table& t = *table.load(std::memory_order_acquire);
+    // The bound only matters for unsynchronized callers, which could
+    // otherwise chase entries that are moved concurrently.
+    for (size_t slot = t.slot_of(page_id), probes = 0; probes <= t.mask;
+         slot = (slot + 1) & t.mask, ++probes) {
+        uint64_t slot_page_id = t.slots[slot].page_id.load(std::memory_order_acquire);
+        if (slot_page_id == page_id) {
+            return t.slots[slot].frame_id.load(std::memory_order_acquire);
+        }
+        if (slot_page_id == INVALID_PAGE_ID) {
+            break;
+        }
+    }
+    return INVALID_FRAME_ID;
+}
+
+
+void PageTable::insert(uint64_t page_id, uint64_t frame_id) {
+    // Only grows when the page ids are spread very unevenly over partitions.
+    if ((size + 1) * 4 > (tables.back()->mask + 1) * 3) {
+        grow();
+    }
+    ++size;
+    Table& t = *tables.back();
+    size_t slot = t.slot_of(page_id);
+    while (t.slots[slot].page_id.load(std::memory_order_relaxed) != INVALID_PAGE_ID) {
+        slot = (slot + 1) & t.mask;
+    }
+    t.slots[slot].frame_id.store(frame_id, std::memory_order_release);
+    t.slots[slot].page_id.store(page_id, std::memory_order_release);
+}
+
+
+void PageTable::erase(uint64_t page_id) {
+    Table& t = *tables.back();
+    size_t slot = t.slot_of(page_id);
+    while (t.slots[slot].page_id.load(std::memory_order_relaxed) != page_id) {
+        if (t.slots[slot].page_id.load(std::memory_order_relaxed) == INVALID_PAGE_ID) {
+            return;
+        }
+        slot = (slot + 1) & t.mask;
+    }
+    --size;
+
+    // Backward shift deletion: move later entries of the probe sequence into
+    // the hole as long as that does not put them before their home slot, so
+    // the table never needs tombstones.
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & t.mask;; next = (next + 1) & t.mask) {
+        uint64_t next_page_id = t.slots[next].page_id.load(std::memory_order_relaxed);
+        if (next_page_id == INVALID_PAGE_ID) {
+            break;
+        }
+        size_t home = t.slot_of(next_page_id);
+        if (((next - home) & t.mask) >= ((next - hole) & t.mask)) {
+            t.slots[hole].frame_id.store(t.slots[next].frame_id.load(std::memory_order_relaxed),
+                                         std::memory_order_release);
+            t.slots[hole].page_id.store(next_page_id, std::memory_order_release);
+            hole = next;
+        }
+    }
+    t.slots[hole].page_id.store(INVALID_PAGE_ID, std::memory_order_release);
+    t.slots[hole].frame_id.store(INVALID_FRAME_ID, std::memory_order_release);
+}
+
+
+void BufferManager::ArenaDeleter::operator()(char* arena) const {
+    std::free(arena);
+}
+
+
+BufferManager::BufferManager(size_t page_size, size_t page_count, File::Durability durability,
+                             ReplacementPolicy::Kind policy_kind)
+    : page_size(page_size), page_count(page_count), frames(page_count),
+      policy(ReplacementPolicy::create(policy_kind, page_count)), durability(durability) {
+    assert(durability != File::DIRECT || page_size % File::kDirectAlignment == 0);
+    // Frames are aligned for direct I/O, too.
+    size_t alignment = std::max(static_cast<size_t>(::sysconf(_SC_PAGESIZE)), File::kDirectAlignment);
+    size_t arena_size = page_size * page_count;
+    // aligned_alloc() requires the size to be a multiple of the alignment.
+    arena_size = (arena_size + alignment - 1) / alignment * alignment;
+    arena.reset(static_cast<char*>(std::aligned_alloc(alignment, arena_size)));
+    if (!arena) {
+        throw std::bad_alloc{};
+    }
+
+    partitions.reserve(kPartitionCount);
+    for (size_t i = 0; i < kPartitionCount; ++i) {
+        partitions.push_back(std::make_unique<Partition>(page_count / kPartitionCount + 1));
+    }
+
+    free_frames.reserve(page_count);
+    for (size_t i = page_count; i > 0; --i) {
+        frames[i - 1].data = arena.get() + (i - 1) * page_size;
+        free_frames.push_back(&frames[i - 1]);
+    }
+}
+
+
+BufferManager::~BufferManager() {
+    stop_prefetcher();
+    stop_cleaner();
+    try {
+        checkpoint();
+    } catch (...) {
+        // A destructor must not throw. Pages that were not written are
+        // redone from the log, which is only reset after all were written.
+    }
+}
+
+
+BufferManager::AtomicChange::AtomicChange(BufferManager& buffer_manager)
+    : buffer_manager(buffer_manager), is_logged(buffer_manager.log != nullptr),
+      uncaught_exceptions(std::uncaught_exceptions()) {
+    if (is_logged) {
+        outer = current;
+        current = this;
+    }
+}
+
+
+BufferManager::AtomicChange::~AtomicChange() {
+    if (!is_logged) {
+        return;
+    }
+    current = outer;
+    if (std::uncaught_exceptions() > uncaught_exceptions) {
+        // Logging a part of the change would let recovery redo it, so the
+        // pages are rolled back to their shadows. Their dirty flags stay as
+        // they were before the change.
+        for (auto* frame : frames) {
+            std::memcpy(frame->data, buffer_manager.get_shadow(*frame), buffer_manager.page_size);
+            buffer_manager.release(*frame, false);
+        }
+        return;
+    }
+    if (!record.empty()) {
+        uint64_t lsn = buffer_manager.log->append(record.data(), record.size());
+        for (auto* frame : frames) {
+            frame->lsn = lsn;
+        }
+    }
+    for (auto* frame : frames) {
+        buffer_manager.release(*frame, true);
+    }
+}
+
+
+void BufferManager::enable_logging(LogManager& log) {
+    assert(!this->log && page_size % sizeof(uint64_t) == 0);
+    log.replay([this](const char* record, size_t size) { redo(record, size); });
+    shadows = std::make_unique<char[]>(page_size * page_count);
+    this->log = &log;
+}
+
+
+void BufferManager::commit() {
+    if (log) {
+        log->flush(log->get_end_lsn());
+    }
+}
+
+
+void BufferManager::checkpoint() {
+    if (log) {
+        log->flush(log->get_end_lsn());
+    }
+    flush_all();
+    if (log) {
+        log->reset();
+    }
+}
+
+
+void BufferManager::append_changes(const BufferFrame& frame, std::vector<char>& record) {
+    // Ranges are compared in words and joined across gaps that are smaller
+    // than the header of a range.
+    constexpr size_t kMaxGap = sizeof(PageChange) / sizeof(uint64_t);
+    auto* words = reinterpret_cast<const uint64_t*>(frame.data);
+    auto* old_words = reinterpret_cast<const uint64_t*>(get_shadow(frame));
+    size_t word_count = page_size / sizeof(uint64_t);
+    for (size_t begin = 0; begin < word_count;) {
+        if (words[begin] == old_words[begin]) {
+            ++begin;
+            continue;
+        }
+        size_t end = begin + 1;
+        for (size_t i = end; i < word_count && i - end <= kMaxGap; ++i) {
+            if (words[i] != old_words[i]) {
+                end = i + 1;
+            }
+        }
+        PageChange change{frame.page_id, static_cast<uint32_t>(begin * sizeof(uint64_t)),
+                          static_cast<uint32_t>((end - begin) * sizeof(uint64_t))};
+        record.insert(record.end(), reinterpret_cast<const char*>(&change),
+                      reinterpret_cast<const char*>(&change) + sizeof(change));
+        record.insert(record.end(), frame.data + change.offset, frame.data + change.offset + change.size);
+        begin = end;
+    }
+}
+
+
+void BufferManager::redo(const char* record, size_t size) {
+    for (size_t offset = 0; offset < size;) {
+        PageChange change;
+        std::memcpy(&change, record + offset, sizeof(change));
+        offset += sizeof(change);
+        assert(change.offset + change.size <= page_size);
+        auto& frame = fix_page(change.page_id, true);
+        std::memcpy(frame.data + change.offset, record + offset, change.size);
+        unfix_page(frame, true);
+        offset += change.size;
+    }
+}
+
+
+void BufferManager::map_segment(uint16_t segment_id, MmapFile::Access access) {
+    MappedSegment segment;
+    segment.file = MmapFile::map_file(std::to_string(segment_id).c_str(), access);
+    segment.page_count = segment.file->size() / page_size;
+    segment.frames.reset(new BufferFrame[segment.page_count]);
+    for (uint64_t i = 0; i < segment.page_count; ++i) {
+        auto& frame = segment.frames[i];
+        frame.page_id = get_overall_page_id(segment_id, i);
+        frame.data = const_cast<char*>(segment.file->get_data()) + i * page_size;
+    }
+    mapped_segments[segment_id] = std::move(segment);
+}
+
+
+BufferFrame* BufferManager::get_mapped_frame(uint64_t page_id) {
+    auto it = mapped_segments.find(get_segment_id(page_id));
+    if (it == mapped_segments.end()) {
+        return nullptr;
+    }
+    uint64_t segment_page_id = get_segment_page_id(page_id);
+    if (segment_page_id >= it->second.page_count) {
+        throw Exception("page " + std::to_string(segment_page_id) + " is past the end of mapped segment " +
+                        std::to_string(it->first));
+    }
+    return &it->second.frames[segment_page_id];
+}
+
+
+void BufferManager::set_segment_file(uint16_t segment_id, std::unique_ptr<File> file) {
+    std::unique_lock lock{file_latch};
+    segment_files[segment_id] = std::move(file);
+}
+
+
+File& BufferManager::get_segment_file(uint16_t segment_id) {
+    std::unique_lock lock{file_latch};
+    auto& file = segment_files[segment_id];
+    if (!file) {
+        file = File::open_file(std::to_string(segment_id).c_str(), File::WRITE, durability);
+    }
+    return *file;
+}
+
+
+BufferFrame& BufferManager::acquire_frame() {
+    while (true) {
+        std::unique_lock lock{replacement_latch};
+        if (!free_frames.empty()) {
+            auto* frame = free_frames.back();
+            free_frames.pop_back();
+            // Free frames are not latched by anyone.
+            [[maybe_unused]] bool latched = frame->latch.try_lock();
+            assert(latched);
+            frame->begin_write();
+            return *frame;
+        }
+
+        BufferFrame* victim = nullptr;
+        BufferFrame* dirty_victim = nullptr;
+        // Was a skipped frame possibly pinned for a write back? Checked under
+        // its partition latch, since a write back unpins the frame before it
+        // is no longer counted.
+        bool is_writing_back = false;
+        policy->visit_victims(true, [&](uint64_t frame_id) {
+            auto& frame = frames[frame_id];
+            auto& partition = get_partition(frame.page_id);
+            std::unique_lock partition_lock{partition.latch};
+            if (frame.fix_count != 0) {
+                is_writing_back = is_writing_back || write_back_count.load() > 0;
+                return false;
+            }
+            if (frame.is_dirty) {
+                // Write the page back, then look for a victim again.
+                pin_for_write_back(frame);
+                dirty_victim = &frame;
+                return true;
+            }
+            // Unfixed frames are not latched by anyone.
+            [[maybe_unused]] bool latched = frame.latch.try_lock();
+            assert(latched);
+            frame.begin_write();
+            partition.page_table.erase(frame.page_id);
+            frame.page_id = INVALID_PAGE_ID;
+            victim = &frame;
+            return true;
+        });
+        if (victim) {
+            policy->remove(get_frame_id(*victim));
+            counters.add(EVICTIONS);
+            return *victim;
+        }
+        if (!dirty_victim) {
+            if (is_writing_back) {
+                // Pages that are being written back become victims soon.
+                lock.unlock();
+                std::this_thread::yield();
+                continue;
+            }
+            throw buffer_full_error{};
+        }
+        lock.unlock();
+
+        // If there is a cleaner, it fell behind.
+        cleaner_wakeup.notify_one();
+        std::vector<BufferFrame*> victims{dirty_victim};
+        write_back(victims);
+    }
+}
+
+
+void BufferManager::pin_for_write_back(BufferFrame& frame) {
+    // The shared latch is taken while nobody can hold it exclusively, so a
+    // caller that holds other frame latches never waits for a writer here.
+    [[maybe_unused]] bool latched = frame.latch.try_lock_shared();
+    assert(latched);
+    ++frame.fix_count;
+    frame.is_dirty = false;
+    ++write_back_count;
+}
+
+
+void BufferManager::write_back(std::vector<BufferFrame*>& pinned_frames) {
+    std::exception_ptr error;
+    try {
+        write_frames(pinned_frames);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    for (auto* frame : pinned_frames) {
+        uint64_t page_id = frame->page_id;
+        frame->latch.unlock_shared();
+        unfix_page_id(*frame, page_id, error != nullptr);
+        --write_back_count;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+
+void BufferManager::start_cleaner(double clean_share) {
+    assert(!cleaner.joinable() && clean_share > 0 && clean_share <= 1);
+    clean_target = std::max<size_t>(1, static_cast<size_t>(clean_share * page_count));
+    cleaner_stopping = false;
+    cleaner = std::thread([this] { run_cleaner(); });
+}
+
+
+void BufferManager::stop_cleaner() {
+    if (!cleaner.joinable()) {
+        return;
+    }
+    {
+        std::unique_lock lock{cleaner_latch};
+        cleaner_stopping = true;
+    }
+    cleaner_wakeup.notify_one();
+    cleaner.join();
+}
+
+
+void BufferManager::run_cleaner() {
+    std::unique_lock lock{cleaner_latch};
+    while (!cleaner_stopping) {
+        lock.unlock();
+        size_t cleaned = 0;
+        try {
+            cleaned = clean_victims();
+        } catch (...) {
+            // The pages stay dirty, and whoever evicts them sees the error.
+        }
+        lock.lock();
+        if (cleaned == 0 && !cleaner_stopping) {
+            cleaner_wakeup.wait_for(lock, kCleanerInterval);
+        }
+    }
+}
+
+
+size_t BufferManager::clean_victims() {
+    std::vector<BufferFrame*> dirty_frames;
+    {
+        std::unique_lock lock{replacement_latch};
+        size_t victims = free_frames.size();
+        if (victims >= clean_target) {
+            return 0;
+        }
+        policy->visit_victims(false, [&](uint64_t frame_id) {
+            auto& frame = frames[frame_id];
+            auto& partition = get_partition(frame.page_id);
+            std::unique_lock partition_lock{partition.latch};
+            if (frame.fix_count != 0) {
+                return false;
+            }
+            if (frame.is_dirty) {
+                pin_for_write_back(frame);
+                dirty_frames.push_back(&frame);
+            }
+            return ++victims >= clean_target;
+        });
+    }
+    if (!dirty_frames.empty()) {
+        write_back(dirty_frames);
+    }
+    return dirty_frames.size();
+}
+
+
+void BufferManager::flush_all() {
+    std::vector<BufferFrame*> latched_frames;
+    std::vector<std::pair<BufferFrame*, uint64_t>> busy_frames;
+    for (auto& frame : frames) {
+        uint64_t page_id = frame.page_id;
+        if (page_id == INVALID_PAGE_ID) {
+            continue;
+        }
+        auto& partition = get_partition(page_id);
+        std::unique_lock partition_lock{partition.latch};
+        if (frame.page_id != page_id || !frame.is_dirty) {
+            continue;
+        }
+        if (frame.fix_count == 0) {
+            pin_for_write_back(frame);
+            latched_frames.push_back(&frame);
+        } else {
+            // Pin the page and wait for its latch later, one page at a time,
+            // since the holder may wait for a page that is latched here.
+            ++frame.fix_count;
+            busy_frames.emplace_back(&frame, page_id);
+        }
+    }
+    std::exception_ptr error;
+    try {
+        write_back(latched_frames);
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    for (auto [frame, page_id] : busy_frames) {
+        if (error) {
+            unfix_page_id(*frame, page_id, false);
+            continue;
+        }
+        frame->latch.lock_shared();
+        std::unique_lock partition_lock{get_partition(page_id).latch};
+        // The page may have failed to load, or may have been written back
+        // in the meantime.
+        bool needs_write = frame->page_id == page_id && frame->is_dirty;
+        frame->is_dirty = false;
+        partition_lock.unlock();
+        if (needs_write) {
+            ++write_back_count;
+            std::vector<BufferFrame*> pinned_frames{frame};
+            try {
+                write_back(pinned_frames);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        } else {
+            frame->latch.unlock_shared();
+            unfix_page_id(*frame, page_id, false);
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    std::unique_lock lock{file_latch};
+    for (auto& [segment_id, file] : segment_files) {
+        file->sync();
+    }
+}
+
+
+template <typename LatchT>
+void BufferManager::lock_latch(LatchT& latch) {
+    if (!is_latch_sampled()) {
+        latch.lock();
+    } else if (!latch.try_lock()) {
+        wait_for_latch([&] { latch.lock(); });
+    }
+}
+
+
+void BufferManager::lock_latch_shared(std::shared_mutex& latch) {
+    if (!is_latch_sampled()) {
+        latch.lock_shared();
+    } else if (!latch.try_lock_shared()) {
+        wait_for_latch([&] { latch.lock_shared(); });
+    }
+}
+
+
+void BufferManager::wait_for_latch(FunctionRef<void()> lock) {
+    auto start = std::chrono::steady_clock::now();
+    lock();
+    auto wait = std::chrono::steady_clock::now() - start;
+    counters.add(LATCH_WAIT_NS,
+                 std::chrono::duration_cast<std::chrono::nanoseconds>(wait).count() * kLatchSampleInterval);
+}
+
+
+void BufferManager::record_hit(BufferFrame& frame) {
+    counters.add(HITS);
+    if (policy->has_latch_free_access()) {
+        policy->access(get_frame_id(frame));
+        return;
+    }
+    std::unique_lock lock{replacement_latch, std::defer_lock};
+    lock_latch(lock);
+    policy->access(get_frame_id(frame));
+}
+
+
+void BufferManager::unfix_page_id(BufferFrame& frame, uint64_t page_id, bool is_dirty) {
+    auto& partition = get_partition(page_id);
+    std::unique_lock partition_lock{partition.latch};
+    frame.is_dirty = frame.is_dirty || is_dirty;
+    bool orphaned = --frame.fix_count == 0 && frame.page_id != page_id;
+    partition_lock.unlock();
+    if (orphaned) {
+        std::unique_lock lock{replacement_latch};
+        free_frames.push_back(&frame);
+    }
+}
+
+
+void BufferManager::read_frame(BufferFrame& frame) {
+    auto& file = get_segment_file(get_segment_id(frame.page_id));
+    size_t offset = get_segment_page_id(frame.page_id) * page_size;
+    bool exists;
+    {
+        std::unique_lock lock{file_latch};
+        exists = offset + page_size <= file.size();
+    }
+    if (exists) {
+        file.read_block(offset, page_size, frame.data);
+        counters.add(READ_BYTES, page_size);
+    } else {
+        // The page was never written, so it is all zeroes.
+        std::memset(frame.data, 0, page_size);
+    }
+}
+
+
+void BufferManager::write_frame(BufferFrame& frame) {
+    if (log) {
+        log->flush(frame.lsn);
+    }
+    auto& file = get_segment_file(get_segment_id(frame.page_id));
+    size_t offset = get_segment_page_id(frame.page_id) * page_size;
+    {
+        std::unique_lock lock{file_latch};
+        if (file.size() < offset + page_size) {
+            file.resize(offset + page_size);
+        }
+    }
+    file.write_block(frame.data, offset, page_size);
+    counters.add(WRITE_BACKS);
+    counters.add(WRITTEN_BYTES, page_size);
 }
 
 
-BufferManager::BufferManager(size_t page_size, size_t /*page_count*/) : page_size(page_size) {
+void BufferManager::write_frames(std::vector<BufferFrame*>& dirty_frames) {
+    std::sort(dirty_frames.begin(), dirty_frames.end(),
+              [](const BufferFrame* a, const BufferFrame* b) { return a->page_id < b->page_id; });
+    if (log) {
+        uint64_t lsn = 0;
+        for (auto* frame : dirty_frames) {
+            lsn = std::max(lsn, frame->lsn);
+        }
+        log->flush(lsn);
+    }
+    std::vector<File::Block> blocks;
+    for (size_t begin = 0; begin < dirty_frames.size();) {
+        uint16_t segment_id = get_segment_id(dirty_frames[begin]->page_id);
+        blocks.clear();
+        size_t end = begin;
+        for (; end < dirty_frames.size() && get_segment_id(dirty_frames[end]->page_id) == segment_id; ++end) {
+            blocks.push_back({get_segment_page_id(dirty_frames[end]->page_id) * page_size, page_size,
+                              dirty_frames[end]->data});
+        }
+        auto& file = get_segment_file(segment_id);
+        {
+            std::unique_lock lock{file_latch};
+            if (file.size() < blocks.back().offset + page_size) {
+                file.resize(blocks.back().offset + page_size);
+            }
+        }
+        file.write_blocks(blocks.data(), blocks.size());
+        begin = end;
+    }
+    counters.add(WRITE_BACKS, dirty_frames.size());
+    counters.add(WRITTEN_BYTES, dirty_frames.size() * page_size);
 }
 
 
-BufferManager::~BufferManager() = default;
+void BufferManager::reserve_pages(uint16_t segment_id, uint64_t page_count) {
+    auto& file = get_segment_file(segment_id);
+    std::unique_lock lock{file_latch};
+    if (file.size() < page_count * page_size) {
+        file.resize(page_count * page_size);
+    }
+}
 
 
-BufferFrame& BufferManager::fix_page(uint64_t page_id, bool /*exclusive*/) {
-    auto result = pages.emplace(page_id, BufferFrame{});
-    auto& page = result.first->second;
-    bool is_new = result.second;
-    if (is_new) {
-        page.data.resize(page_size, 0);
+void BufferManager::truncate_pages(uint16_t segment_id, uint64_t page_count) {
+    for (auto& frame : frames) {
+        uint64_t page_id = frame.page_id;
+        if (page_id == INVALID_PAGE_ID || get_segment_id(page_id) != segment_id ||
+            get_segment_page_id(page_id) < page_count) {
+            continue;
+        }
+        std::unique_lock partition_lock{get_partition(page_id).latch};
+        // Fixed frames, also those pinned for a write back, may still grow
+        // the file, which is only wasted space.
+        if (frame.page_id == page_id && frame.fix_count == 0) {
+            frame.is_dirty = false;
+        }
+    }
+    auto& file = get_segment_file(segment_id);
+    std::unique_lock lock{file_latch};
+    if (file.size() > page_count * page_size) {
+        file.resize(page_count * page_size);
     }
-    return page;
 }
 
 
-void BufferManager::unfix_page(BufferFrame& /*page*/, bool /*is_dirty*/) {
+BufferFrame& BufferManager::fix_page(uint64_t page_id, bool exclusive) {
+    if (!mapped_segments.empty()) {
+        if (auto* frame = get_mapped_frame(page_id)) {
+            if (exclusive) {
+                throw Exception("segment " + std::to_string(get_segment_id(page_id)) + " is mapped read-only");
+            }
+            counters.add(HITS);
+            return *frame;
+        }
+    }
+    auto& partition = get_partition(page_id);
+    while (true) {
+        std::unique_lock partition_lock{partition.latch, std::defer_lock};
+        lock_latch(partition_lock);
+        BufferFrame* frame = nullptr;
+        if (uint64_t frame_id = partition.page_table.find(page_id); frame_id != INVALID_FRAME_ID) {
+            frame = &frames[frame_id];
+            ++frame->fix_count;
+            partition_lock.unlock();
+            record_hit(*frame);
+        } else {
+            partition_lock.unlock();
+            auto& free_frame = acquire_frame();
+            partition_lock.lock();
+            if (uint64_t frame_id = partition.page_table.find(page_id); frame_id != INVALID_FRAME_ID) {
+                // Another thread loaded the page in the meantime.
+                frame = &frames[frame_id];
+                ++frame->fix_count;
+                partition_lock.unlock();
+                release_free_frame(free_frame);
+                record_hit(*frame);
+            } else {
+                counters.add(MISSES);
+                auto& loaded_frame = load_page(free_frame, page_id, exclusive, partition_lock);
+                if (exclusive && log) {
+                    std::memcpy(get_shadow(loaded_frame), loaded_frame.data, page_size);
+                }
+                return loaded_frame;
+            }
+        }
+
+        if (exclusive) {
+            lock_latch(frame->latch);
+            frame->begin_write();
+        } else {
+            lock_latch_shared(frame->latch);
+        }
+        if (frame->page_id == page_id) {
+            if (exclusive && log) {
+                std::memcpy(get_shadow(*frame), frame->data, page_size);
+            }
+            return *frame;
+        }
+        // Loading the page failed, try again.
+        if (exclusive) {
+            frame->unlock_exclusive();
+        } else {
+            frame->latch.unlock_shared();
+        }
+        unfix_page_id(*frame, page_id, false);
+    }
+}
+
+
+BufferFrame* BufferManager::peek_page(uint64_t page_id, uint64_t& version) {
+    if (!mapped_segments.empty()) {
+        if (auto* frame = get_mapped_frame(page_id)) {
+            version = frame->get_version();
+            return frame;
+        }
+    }
+    uint64_t frame_id = get_partition(page_id).page_table.find(page_id);
+    if (frame_id == INVALID_FRAME_ID) {
+        return nullptr;
+    }
+    auto& frame = frames[frame_id];
+    version = frame.get_version();
+    if ((version & 1) || frame.page_id.load(std::memory_order_relaxed) != page_id ||
+        !frame.validate(version)) {
+        return nullptr;
+    }
+    return &frame;
+}
+
+
+BufferFrame& BufferManager::load_page(BufferFrame& frame, uint64_t page_id, bool exclusive,
+                                      std::unique_lock<std::mutex>& partition_lock) {
+    // The frame is exclusively latched by `acquire_frame()`, so other fixes
+    // of the page wait on the latch until the page is loaded.
+    map_frame(frame, page_id);
+    partition_lock.unlock();
+
+    try {
+        read_frame(frame);
+    } catch (...) {
+        abort_load(frame, page_id);
+        throw;
+    }
+
+    finish_load(frame, false);
+    if (!exclusive) {
+        frame.unlock_exclusive();
+        frame.latch.lock_shared();
+    }
+    return frame;
+}
+
+
+void BufferManager::map_frame(BufferFrame& frame, uint64_t page_id) {
+    frame.page_id = page_id;
+    frame.fix_count = 1;
+    frame.is_dirty = false;
+    frame.lsn = 0;
+    get_partition(page_id).page_table.insert(page_id, get_frame_id(frame));
+}
+
+
+void BufferManager::finish_load(BufferFrame& frame, bool is_prefetched) {
+    std::unique_lock lock{replacement_latch};
+    policy->insert(get_frame_id(frame), frame.page_id, is_prefetched);
+}
+
+
+void BufferManager::abort_load(BufferFrame& frame, uint64_t page_id) {
+    auto& partition = get_partition(page_id);
+    {
+        std::unique_lock partition_lock{partition.latch};
+        partition.page_table.erase(page_id);
+        frame.page_id = INVALID_PAGE_ID;
+    }
+    frame.unlock_exclusive();
+    unfix_page_id(frame, page_id, false);
+}
+
+
+void BufferManager::release_free_frame(BufferFrame& frame) {
+    frame.unlock_exclusive();
+    std::unique_lock lock{replacement_latch};
+    free_frames.push_back(&frame);
+}
+
+
+void BufferManager::prefetch(const uint64_t* page_ids, size_t count) {
+    std::unique_lock lock{prefetch_latch};
+    if (prefetcher_stopping) {
+        return;
+    }
+    if (!prefetcher.joinable()) {
+        prefetcher = std::thread([this] { run_prefetcher(); });
+    }
+    prefetch_queue.insert(prefetch_queue.end(), page_ids, page_ids + count);
+    prefetch_wakeup.notify_one();
+}
+
+
+void BufferManager::stop_prefetcher() {
+    {
+        std::unique_lock lock{prefetch_latch};
+        prefetcher_stopping = true;
+    }
+    prefetch_wakeup.notify_one();
+    if (prefetcher.joinable()) {
+        prefetcher.join();
+    }
+}
+
+
+void BufferManager::run_prefetcher() {
+    std::unique_ptr<IOQueue> io_queue;
+    // Frames that are being loaded cannot be evicted, so most of a small
+    // pool is left to fixes.
+    size_t depth = std::clamp<size_t>(page_count / 4, 1, kPrefetchDepth);
+    std::vector<uint64_t> page_ids;
+    std::unique_lock lock{prefetch_latch};
+    while (true) {
+        while (prefetch_queue.empty() && !prefetcher_stopping) {
+            prefetch_wakeup.wait(lock);
+        }
+        if (prefetcher_stopping) {
+            return;
+        }
+        page_ids.clear();
+        std::swap(page_ids, prefetch_queue);
+        lock.unlock();
+        if (!io_queue) {
+            try {
+                io_queue = IOQueue::create(kPrefetchDepth);
+            } catch (...) {
+                // The pages are read synchronously until a queue can be
+                // created.
+            }
+        }
+        for (size_t begin = 0; begin < page_ids.size(); begin += depth) {
+            size_t end = std::min(page_ids.size(), begin + depth);
+            if (!load_pages(io_queue, page_ids.data() + begin, end - begin)) {
+                // The pool is full of fixed pages, which will not change soon.
+                break;
+            }
+        }
+        lock.lock();
+    }
+}
+
+
+bool BufferManager::load_pages(std::unique_ptr<IOQueue>& io_queue, const uint64_t* page_ids, size_t count) {
+    // The frames that were mapped and are not loaded yet.
+    std::pair<BufferFrame*, uint64_t> loading[kPrefetchDepth];
+    size_t loading_count = 0;
+    bool is_full = false;
+    try {
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t page_id = page_ids[i];
+            if (!mapped_segments.empty() && mapped_segments.count(get_segment_id(page_id))) {
+                continue;
+            }
+            auto& partition = get_partition(page_id);
+            std::unique_lock partition_lock{partition.latch};
+            if (partition.page_table.find(page_id) != INVALID_FRAME_ID) {
+                continue;
+            }
+            partition_lock.unlock();
+            BufferFrame* frame;
+            try {
+                frame = &acquire_frame();
+            } catch (const buffer_full_error&) {
+                is_full = true;
+                break;
+            }
+            partition_lock.lock();
+            if (partition.page_table.find(page_id) != INVALID_FRAME_ID) {
+                // Another thread loaded the page in the meantime.
+                partition_lock.unlock();
+                release_free_frame(*frame);
+                continue;
+            }
+            // Fixes of the page wait on the frame latch until it is loaded.
+            map_frame(*frame, page_id);
+            loading[loading_count++] = {frame, page_id};
+        }
+
+        size_t pending = 0;
+        for (size_t i = 0; i < loading_count; ++i) {
+            auto [frame, page_id] = loading[i];
+            size_t offset = get_segment_page_id(page_id) * page_size;
+            File* file = nullptr;
+            bool exists = false;
+            try {
+                file = &get_segment_file(get_segment_id(page_id));
+                std::unique_lock lock{file_latch};
+                exists = offset + page_size <= file->size();
+                lock.unlock();
+                if (exists && !io_queue) {
+                    file->read_block(offset, page_size, frame->data);
+                    counters.add(READ_BYTES, page_size);
+                }
+            } catch (...) {
+                // Fixes of the page will report the error.
+                abort_load(*frame, page_id);
+                loading[i].first = nullptr;
+                continue;
+            }
+            if (exists && io_queue) {
+                io_queue->read(*file, offset, page_size, frame->data, i);
+                ++pending;
+                continue;
+            }
+            if (!exists) {
+                std::memset(frame->data, 0, page_size);
+            }
+            counters.add(PREFETCHES);
+            finish_load(*frame, true);
+            frame->unlock_exclusive();
+            unfix_page_id(*frame, page_id, false);
+            loading[i].first = nullptr;
+        }
+        if (pending > 0) {
+            io_queue->submit();
+        }
+
+        IOQueue::Completion completions[kPrefetchDepth];
+        while (pending > 0) {
+            size_t reaped = io_queue->reap(completions, kPrefetchDepth, 1);
+            for (size_t i = 0; i < reaped; ++i) {
+                auto [frame, page_id] = loading[completions[i].tag];
+                loading[completions[i].tag].first = nullptr;
+                if (completions[i].error != 0) {
+                    abort_load(*frame, page_id);
+                    continue;
+                }
+                counters.add(PREFETCHES);
+                counters.add(READ_BYTES, page_size);
+                finish_load(*frame, true);
+                frame->unlock_exclusive();
+                unfix_page_id(*frame, page_id, false);
+            }
+            pending -= reaped;
+        }
+    } catch (...) {
+        // E.g. the write back of a dirty victim or the queue failed. The
+        // queue waits for the reads in flight when it is destroyed, so their
+        // frames can be given up then. The next batch creates a new queue.
+        io_queue.reset();
+        for (size_t i = 0; i < loading_count; ++i) {
+            if (loading[i].first) {
+                abort_load(*loading[i].first, loading[i].second);
+            }
+        }
+    }
+    return !is_full;
+}
+
+
+void BufferManager::unfix_page(BufferFrame& page, bool is_dirty) {
+    if (!is_pool_frame(page)) {
+        // A page of a mapped segment.
+        assert(!is_dirty);
+        return;
+    }
+    if (log && is_dirty) {
+        assert(page.is_latched_exclusively() && "only exclusively fixed pages may be dirty");
+        auto* change = AtomicChange::current;
+        if (change && &change->buffer_manager == this) {
+            append_changes(page, change->record);
+            change->frames.push_back(&page);
+            return;
+        }
+        thread_local std::vector<char> record;
+        record.clear();
+        append_changes(page, record);
+        if (!record.empty()) {
+            page.lsn = log->append(record.data(), record.size());
+        }
+    }
+    release(page, is_dirty);
+}
+
+
+void BufferManager::release(BufferFrame& page, bool is_dirty) {
+    uint64_t page_id = page.page_id;
+    if (page.is_latched_exclusively()) {
+        page.unlock_exclusive();
+    } else {
+        page.latch.unlock_shared();
+    }
+    unfix_page_id(page, page_id, is_dirty);
+}
+
+
+double BufferManager::Stats::get_hit_ratio() const {
+    uint64_t fixes = hits + misses;
+    return fixes == 0 ? 0 : static_cast<double>(hits) / fixes;
+}
+
+
+std::string BufferManager::Stats::to_json() const {
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer{buffer};
+    writer.StartObject();
+    writer.Key("hits");
+    writer.Uint64(hits);
+    writer.Key("misses");
+    writer.Uint64(misses);
+    writer.Key("hit_ratio");
+    writer.Double(get_hit_ratio());
+    writer.Key("prefetches");
+    writer.Uint64(prefetches);
+    writer.Key("evictions");
+    writer.Uint64(evictions);
+    writer.Key("write_backs");
+    writer.Uint64(write_backs);
+    writer.Key("read_bytes");
+    writer.Uint64(read_bytes);
+    writer.Key("written_bytes");
+    writer.Uint64(written_bytes);
+    writer.Key("latch_wait_ns");
+    writer.Uint64(latch_wait_ns);
+    writer.Key("resident_pages");
+    writer.Uint64(resident_pages);
+    writer.Key("dirty_pages");
+    writer.Uint64(dirty_pages);
+    writer.EndObject();
+    return buffer.GetString();
+}
+
+
+BufferManager::Stats BufferManager::get_stats() const {
+    Stats stats;
+    stats.hits = counters.get(HITS);
+    stats.misses = counters.get(MISSES);
+    stats.prefetches = counters.get(PREFETCHES);
+    stats.evictions = counters.get(EVICTIONS);
+    stats.write_backs = counters.get(WRITE_BACKS);
+    stats.read_bytes = counters.get(READ_BYTES);
+    stats.written_bytes = counters.get(WRITTEN_BYTES);
+    stats.latch_wait_ns = counters.get(LATCH_WAIT_NS);
+    for (const auto& frame : frames) {
+        uint64_t page_id = frame.page_id;
+        if (page_id == INVALID_PAGE_ID) {
+            continue;
+        }
+        std::unique_lock partition_lock{get_partition(page_id).latch};
+        if (frame.page_id == page_id) {
+            ++stats.resident_pages;
+            stats.dirty_pages += frame.is_dirty;
+        }
+    }
+    return stats;
 }
 
 
 std::vector<uint64_t> BufferManager::get_fifo_list() const {
-    return {};
+    std::unique_lock lock{replacement_latch};
+    auto queues = policy->get_queues();
+    std::vector<uint64_t> page_ids;
+    for (uint64_t frame_id : queues[0]) {
+        page_ids.push_back(frames[frame_id].page_id);
+    }
+    return page_ids;
 }
 
 
 std::vector<uint64_t> BufferManager::get_lru_list() const {
-    return {};
+    std::unique_lock lock{replacement_latch};
+    auto queues = policy->get_queues();
+    std::vector<uint64_t> page_ids;
+    if (queues.size() > 1) {
+        for (uint64_t frame_id : queues[1]) {
+            page_ids.push_back(frames[frame_id].page_id);
+        }
+    }
+    return page_ids;
 }
 
 }  // namespace buzzdb
@@ -0,0 +1,368 @@
+#include "buffer/replacement_policy.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+#include "buffer/buffer_manager.h"
+
+
+namespace buzzdb {
+
+namespace {
+
+/// Doubly linked lists of ids below a bound, with the links in arrays, so
+/// moving an id between lists never allocates. Each id is in at most one
+/// list.
+class IdLists {
+public:
+    /// A list of ids.
+    struct List {
+        uint64_t head = INVALID_FRAME_ID;
+        uint64_t tail = INVALID_FRAME_ID;
+        size_t size = 0;
+    };
+
+    explicit IdLists(size_t id_count) : prev(id_count, INVALID_FRAME_ID), next(id_count, INVALID_FRAME_ID) {}
+
+    void push_back(List& list, uint64_t id) {
+        prev[id] = list.tail;
+        next[id] = INVALID_FRAME_ID;
+        (list.tail != INVALID_FRAME_ID ? next[list.tail] : list.head) = id;
+        list.tail = id;
+        ++list.size;
+    }
+
+    void remove(List& list, uint64_t id) {
+        (prev[id] != INVALID_FRAME_ID ? next[prev[id]] : list.head) = next[id];
+        (next[id] != INVALID_FRAME_ID ? prev[next[id]] : list.tail) = prev[id];
+        prev[id] = INVALID_FRAME_ID;
+        next[id] = INVALID_FRAME_ID;
+        --list.size;
+    }
+
+    /// Calls `visit` for the ids of `list` from the head until it returns
+    /// true. The visited id may be removed by `visit`.
+    /// @return             Did `visit` return true?
+    bool visit(const List& list, FunctionRef<bool(uint64_t)> visit) const {
+        for (uint64_t id = list.head; id != INVALID_FRAME_ID;) {
+            uint64_t next_id = next[id];
+            if (visit(id)) {
+                return true;
+            }
+            id = next_id;
+        }
+        return false;
+    }
+
+    std::vector<uint64_t> to_vector(const List& list) const {
+        std::vector<uint64_t> ids;
+        for (uint64_t id = list.head; id != INVALID_FRAME_ID; id = next[id]) {
+            ids.push_back(id);
+        }
+        return ids;
+    }
+
+private:
+    std::vector<uint64_t> prev;
+    std::vector<uint64_t> next;
+};
+
+
+class TwoQPolicy : public ReplacementPolicy {
+public:
+    explicit TwoQPolicy(size_t frame_count)
+        : ReplacementPolicy(false), lists(frame_count), queues(frame_count, Queue::NONE),
+          prefetched(frame_count, false) {}
+
+    Kind get_kind() const override { return TWO_Q; }
+
+    void insert(uint64_t frame_id, uint64_t, bool is_prefetched) override {
+        assert(queues[frame_id] == Queue::NONE);
+        lists.push_back(fifo_list, frame_id);
+        queues[frame_id] = Queue::FIFO;
+        prefetched[frame_id] = is_prefetched;
+    }
+
+    void access(uint64_t frame_id) override {
+        if (queues[frame_id] == Queue::NONE) {
+            return;
+        }
+        if (prefetched[frame_id]) {
+            prefetched[frame_id] = false;
+            return;
+        }
+        // A second access promotes a FIFO page to the LRU list, an access to
+        // an LRU page makes it the most recently used one.
+        lists.remove(get_list(frame_id), frame_id);
+        lists.push_back(lru_list, frame_id);
+        queues[frame_id] = Queue::LRU;
+    }
+
+    void remove(uint64_t frame_id) override {
+        lists.remove(get_list(frame_id), frame_id);
+        queues[frame_id] = Queue::NONE;
+    }
+
+    void visit_victims(bool, FunctionRef<bool(uint64_t)> visit) override {
+        lists.visit(fifo_list, visit) || lists.visit(lru_list, visit);
+    }
+
+    std::vector<std::vector<uint64_t>> get_queues() const override {
+        return {lists.to_vector(fifo_list), lists.to_vector(lru_list)};
+    }
+
+private:
+    enum class Queue : uint8_t { NONE, FIFO, LRU };
+
+    IdLists::List& get_list(uint64_t frame_id) {
+        return queues[frame_id] == Queue::FIFO ? fifo_list : lru_list;
+    }
+
+    IdLists lists;
+    /// Pages that were fixed once since they were loaded (2Q "A1" queue).
+    IdLists::List fifo_list;
+    /// Pages that were fixed repeatedly, least recently used first (2Q "Am").
+    IdLists::List lru_list;
+    /// The queue of each frame.
+    std::vector<Queue> queues;
+    /// Was the page of a frame prefetched and not accessed since?
+    std::vector<bool> prefetched;
+};
+
+
+class ClockPolicy : public ReplacementPolicy {
+public:
+    explicit ClockPolicy(size_t frame_count)
+        : ReplacementPolicy(true), frame_count(frame_count), referenced(new std::atomic<bool>[frame_count]),
+          tracked(frame_count, false) {
+        for (size_t i = 0; i < frame_count; ++i) {
+            referenced[i].store(false, std::memory_order_relaxed);
+        }
+    }
+
+    Kind get_kind() const override { return CLOCK; }
+
+    void insert(uint64_t frame_id, uint64_t, bool) override {
+        // A page earns its second chance with its next fix, so pages that
+        // are used once go first.
+        referenced[frame_id].store(false, std::memory_order_relaxed);
+        tracked[frame_id] = true;
+    }
+
+    void access(uint64_t frame_id) override {
+        // Untracked frames get the bit as well, which `insert()` clears.
+        if (!referenced[frame_id].load(std::memory_order_relaxed)) {
+            referenced[frame_id].store(true, std::memory_order_relaxed);
+        }
+    }
+
+    void remove(uint64_t frame_id) override { tracked[frame_id] = false; }
+
+    void visit_victims(bool is_evicting, FunctionRef<bool(uint64_t)> visit) override {
+        if (!is_evicting) {
+            // Frames with a clear bit go before those whose bit the hand
+            // still has to clear.
+            for (bool pass_referenced : {false, true}) {
+                for (size_t i = 0; i < frame_count; ++i) {
+                    uint64_t frame_id = (hand + i) % frame_count;
+                    if (tracked[frame_id] &&
+                        referenced[frame_id].load(std::memory_order_relaxed) == pass_referenced &&
+                        visit(frame_id)) {
+                        return;
+                    }
+                }
+            }
+            return;
+        }
+        // Two rotations clear all bits, unless fixes set them again, so the
+        // third one ignores them.
+        for (size_t step = 0; step < 3 * frame_count; ++step) {
+            uint64_t frame_id = hand;
+            hand = (hand + 1) % frame_count;
+            if (!tracked[frame_id]) {
+                continue;
+            }
+            if (step < 2 * frame_count && referenced[frame_id].load(std::memory_order_relaxed)) {
+                referenced[frame_id].store(false, std::memory_order_relaxed);
+                continue;
+            }
+            if (visit(frame_id)) {
+                return;
+            }
+        }
+    }
+
+    std::vector<std::vector<uint64_t>> get_queues() const override {
+        std::vector<uint64_t> frame_ids;
+        for (size_t i = 0; i < frame_count; ++i) {
+            if (tracked[(hand + i) % frame_count]) {
+                frame_ids.push_back((hand + i) % frame_count);
+            }
+        }
+        return {frame_ids};
+    }
+
+private:
+    size_t frame_count;
+    /// The reference bit of each frame, set by fixes without the latch.
+    std::unique_ptr<std::atomic<bool>[]> referenced;
+    /// Does a frame hold a page?
+    std::vector<bool> tracked;
+    /// The frame that the hand points to.
+    uint64_t hand = 0;
+};
+
+
+class ArcPolicy : public ReplacementPolicy {
+public:
+    explicit ArcPolicy(size_t frame_count)
+        : ReplacementPolicy(false), frame_count(frame_count), lists(frame_count), queues(frame_count, Queue::NONE),
+          page_ids(frame_count), prefetched(frame_count, false), ghost_lists(frame_count),
+          ghost_page_ids(frame_count), ghost_queues(frame_count, Queue::NONE), ghost_table(frame_count) {
+        for (size_t i = frame_count; i > 0; --i) {
+            free_ghosts.push_back(i - 1);
+        }
+    }
+
+    Kind get_kind() const override { return ARC; }
+
+    void insert(uint64_t frame_id, uint64_t page_id, bool is_prefetched) override {
+        assert(queues[frame_id] == Queue::NONE);
+        page_ids[frame_id] = page_id;
+        prefetched[frame_id] = is_prefetched;
+        uint64_t ghost = ghost_table.find(page_id);
+        if (ghost == INVALID_FRAME_ID || is_prefetched) {
+            // A new page, or one that is not used yet. The recent list and
+            // its ghosts hold at most `frame_count` pages.
+            if (ghost != INVALID_FRAME_ID) {
+                drop_ghost(ghost);
+            }
+            lists.push_back(recent_list, frame_id);
+            queues[frame_id] = Queue::RECENT;
+            if (recent_list.size + recent_ghosts.size > frame_count && recent_ghosts.size > 0) {
+                drop_ghost(recent_ghosts.head);
+            }
+            return;
+        }
+        // The page was evicted too early: grow the target of the list that
+        // it was evicted from, more so the smaller that list's ghosts are.
+        if (ghost_queues[ghost] == Queue::RECENT) {
+            size_t delta = std::max<size_t>(1, frequent_ghosts.size / recent_ghosts.size);
+            recent_target = std::min(frame_count, recent_target + delta);
+        } else {
+            size_t delta = std::max<size_t>(1, recent_ghosts.size / frequent_ghosts.size);
+            recent_target -= std::min(recent_target, delta);
+        }
+        drop_ghost(ghost);
+        lists.push_back(frequent_list, frame_id);
+        queues[frame_id] = Queue::FREQUENT;
+    }
+
+    void access(uint64_t frame_id) override {
+        if (queues[frame_id] == Queue::NONE) {
+            return;
+        }
+        if (prefetched[frame_id]) {
+            prefetched[frame_id] = false;
+            return;
+        }
+        lists.remove(get_list(frame_id), frame_id);
+        lists.push_back(frequent_list, frame_id);
+        queues[frame_id] = Queue::FREQUENT;
+    }
+
+    void remove(uint64_t frame_id) override {
+        Queue queue = queues[frame_id];
+        lists.remove(get_list(frame_id), frame_id);
+        queues[frame_id] = Queue::NONE;
+
+        // Remember the page as a ghost of its list. There are at most
+        // `frame_count` ghosts, the oldest frequent ones go first.
+        auto& ghosts = queue == Queue::RECENT ? recent_ghosts : frequent_ghosts;
+        if (free_ghosts.empty()) {
+            drop_ghost(frequent_ghosts.size > 0 ? frequent_ghosts.head : recent_ghosts.head);
+        }
+        uint64_t ghost = free_ghosts.back();
+        free_ghosts.pop_back();
+        ghost_page_ids[ghost] = page_ids[frame_id];
+        ghost_queues[ghost] = queue;
+        ghost_lists.push_back(ghosts, ghost);
+        ghost_table.insert(page_ids[frame_id], ghost);
+    }
+
+    void visit_victims(bool, FunctionRef<bool(uint64_t)> visit) override {
+        // The list that exceeds its target goes first.
+        if (recent_list.size > 0 && recent_list.size >= std::max<size_t>(1, recent_target)) {
+            lists.visit(recent_list, visit) || lists.visit(frequent_list, visit);
+        } else {
+            lists.visit(frequent_list, visit) || lists.visit(recent_list, visit);
+        }
+    }
+
+    std::vector<std::vector<uint64_t>> get_queues() const override {
+        return {lists.to_vector(recent_list), lists.to_vector(frequent_list)};
+    }
+
+private:
+    enum class Queue : uint8_t { NONE, RECENT, FREQUENT };
+
+    IdLists::List& get_list(uint64_t frame_id) {
+        return queues[frame_id] == Queue::RECENT ? recent_list : frequent_list;
+    }
+
+    void drop_ghost(uint64_t ghost) {
+        ghost_lists.remove(ghost_queues[ghost] == Queue::RECENT ? recent_ghosts : frequent_ghosts, ghost);
+        ghost_table.erase(ghost_page_ids[ghost]);
+        ghost_queues[ghost] = Queue::NONE;
+        free_ghosts.push_back(ghost);
+    }
+
+    size_t frame_count;
+
+    IdLists lists;
+    /// Pages that were fixed once since they were loaded (ARC "T1").
+    IdLists::List recent_list;
+    /// Pages that were fixed repeatedly, least recently used first ("T2").
+    IdLists::List frequent_list;
+    /// The list of each frame.
+    std::vector<Queue> queues;
+    /// The page of each frame.
+    std::vector<uint64_t> page_ids;
+    /// Was the page of a frame prefetched and not accessed since?
+    std::vector<bool> prefetched;
+    /// The size that `recent_list` should have ("p").
+    size_t recent_target = 0;
+
+    /// Ghosts are the page ids of evicted pages, in slots of their own.
+    IdLists ghost_lists;
+    /// Pages evicted from `recent_list`, least recently evicted first ("B1").
+    IdLists::List recent_ghosts;
+    /// Pages evicted from `frequent_list` ("B2").
+    IdLists::List frequent_ghosts;
+    /// The page id of each ghost.
+    std::vector<uint64_t> ghost_page_ids;
+    /// The list that each ghost was evicted from.
+    std::vector<Queue> ghost_queues;
+    /// The ghost slots that are not in use.
+    std::vector<uint64_t> free_ghosts;
+    /// Maps the page ids of ghosts to their slots.
+    PageTable ghost_table;
+};
+
+}  // namespace
+
+
+std::unique_ptr<ReplacementPolicy> ReplacementPolicy::create(Kind kind, size_t frame_count) {
+    switch (kind) {
+        case TWO_Q:
+            return std::make_unique<TwoQPolicy>(frame_count);
+        case CLOCK:
+            return std::make_unique<ClockPolicy>(frame_count);
+        case ARC:
+            return std::make_unique<ArcPolicy>(frame_count);
+    }
+    return nullptr;
+}
+
+}  // namespace buzzdb
@@ -0,0 +1,46 @@
+#include "common/thread_counters.h"
+
+#include <mutex>
+#include <vector>
+
+
+namespace buzzdb {
+
+namespace {
+
+/// Holds an index from the moment a thread asks for it until the thread
+/// exits, and returns it for reuse then.
+class ThreadIndex {
+public:
+    ThreadIndex() {
+        std::unique_lock lock{latch};
+        if (free_indices.empty()) {
+            index = next_index++;
+        } else {
+            index = free_indices.back();
+            free_indices.pop_back();
+        }
+    }
+
+    ~ThreadIndex() {
+        std::unique_lock lock{latch};
+        free_indices.push_back(index);
+    }
+
+    size_t index;
+
+private:
+    static inline std::mutex latch;
+    static inline std::vector<size_t> free_indices;
+    static inline size_t next_index = 0;
+};
+
+}  // namespace
+
+
+size_t acquire_thread_index() {
+    thread_local ThreadIndex thread_index;
+    return thread_index.index;
+}
+
+}  // namespace buzzdb
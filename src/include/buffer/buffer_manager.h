@@ -1,11 +1,29 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
+#include "buffer/replacement_policy.h"
+#include "common/function_ref.h"
+#include "common/macros.h"
+#include "common/thread_counters.h"
+#include "log/log_manager.h"
+#include "storage/file.h"
+#include "storage/io_queue.h"
+#include "storage/mmap_file.h"
+
 
 namespace buzzdb {
 
@@ -13,11 +31,133 @@ class BufferFrame {
 private:
     friend class BufferManager;
 
-    std::vector<char> data;
+    /// Id of the page that is currently loaded into this frame. Only changes
+    /// while the frame is exclusively latched.
+    std::atomic<uint64_t> page_id = INVALID_PAGE_ID;
+
+    /// The page data, a slice of the buffer manager's arena.
+    char* data = nullptr;
+
+    /// Number of outstanding `fix_page()` calls on this frame. Protected by
+    /// the latch of the page table partition of `page_id`.
+    size_t fix_count = 0;
+
+    /// Was the page modified since it was loaded? Protected like `fix_count`.
+    bool is_dirty = false;
+
+    /// The LSN of the last log record that changed the page. The log must be
+    /// durable up to it before the page is written back. Protected by
+    /// `latch`.
+    uint64_t lsn = 0;
+
+    /// Reader/writer latch on the page content, held between `fix_page()`
+    /// and `unfix_page()`.
+    std::shared_mutex latch;
+
+    /// Version of the frame content for optimistic readers. Odd while `latch`
+    /// is held exclusively, incremented when the exclusive latch is acquired
+    /// and when it is released.
+    std::atomic<uint64_t> version = 0;
+
+    /// Acquires `latch` exclusively and marks the content as changing.
+    void lock_exclusive() {
+        latch.lock();
+        begin_write();
+    }
+
+    /// Marks the content as changing. `latch` must be held exclusively.
+    void begin_write() {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    /// Publishes a new version and releases the exclusive `latch`.
+    void unlock_exclusive() {
+        version.store(version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        latch.unlock();
+    }
+
+    /// Is `latch` held exclusively? Only meaningful for a holder of `latch`.
+    bool is_latched_exclusively() const {
+        return version.load(std::memory_order_relaxed) & 1;
+    }
 
 public:
+    BufferFrame() = default;
+    BufferFrame(const BufferFrame&) = delete;
+    BufferFrame& operator=(const BufferFrame&) = delete;
+
     /// Returns a pointer to this page's data.
     char* get_data();
+
+    /// Returns the current version of the frame. It changes whenever the
+    /// frame is exclusively latched or gets a different page, and is odd
+    /// while it is exclusively latched.
+    uint64_t get_version() const {
+        return version.load(std::memory_order_acquire);
+    }
+
+    /// Returns whether the frame did not change since `version` was read.
+    /// Optimistic readers call this after reading the page to confirm that
+    /// what they read is consistent.
+    bool validate(uint64_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return this->version.load(std::memory_order_relaxed) == version;
+    }
+};
+
+
+/// Maps page ids to frame ids. Uses open addressing with linear probing in a
+/// flat slot array that is sized at construction, so lookups touch a single
+/// cache line in the common case and neither inserts nor erases allocate.
+/// Modifications require external synchronization. `find()` may run
+/// concurrently with them, but may then miss entries or return a frame that
+/// no longer holds the page, so such callers have to check the frame.
+class PageTable {
+private:
+    struct Slot {
+        std::atomic<uint64_t> page_id = INVALID_PAGE_ID;
+        std::atomic<uint64_t> frame_id = INVALID_FRAME_ID;
+    };
+
+    struct Table {
+        uint64_t mask;
+        unsigned shift;
+        std::unique_ptr<Slot[]> slots;
+
+        Table(uint64_t slot_count, unsigned shift)
+            : mask(slot_count - 1), shift(shift), slots(new Slot[slot_count]) {}
+
+        /// Returns the home slot of `page_id`.
+        size_t slot_of(uint64_t page_id) const;
+    };
+
+    /// The current table.
+    std::atomic<Table*> table;
+
+    /// All tables ever used, the current one last. Replaced tables are kept
+    /// for concurrent `find()` calls that may still read them.
+    std::vector<std::unique_ptr<Table>> tables;
+
+    size_t size = 0;
+
+    /// Doubles the number of slots and rehashes all entries.
+    void grow();
+
+public:
+    /// Constructor.
+    /// @param[in] capacity Number of entries the table is sized for. It grows
+    ///                     when more entries are inserted.
+    explicit PageTable(size_t capacity);
+
+    /// Returns the frame id of `page_id` or `INVALID_FRAME_ID`.
+    uint64_t find(uint64_t page_id) const;
+
+    /// Adds a mapping. `page_id` must not be contained yet.
+    void insert(uint64_t page_id, uint64_t frame_id);
+
+    /// Removes the mapping of `page_id` if there is one.
+    void erase(uint64_t page_id);
 };
 
 
@@ -32,19 +172,400 @@ public:
 
 class BufferManager {
 private:
+    /// Releases the arena.
+    struct ArenaDeleter {
+        void operator()(char* arena) const;
+    };
+
+    /// A latched part of the page table. Page ids are assigned to partitions
+    /// by their low bits, so fixes of different pages rarely contend.
+    struct alignas(64) Partition {
+        std::mutex latch;
+        PageTable page_table;
+
+        explicit Partition(size_t capacity) : page_table(capacity) {}
+    };
+
+    /// Number of page table partitions, a power of two.
+    static constexpr size_t kPartitionCount = 64;
+
     size_t page_size;
-    std::unordered_map<uint64_t, BufferFrame> pages;
+    size_t page_count;
+
+    /// The memory of all frames, `page_size * page_count` bytes, aligned to
+    /// the OS page size and allocated once at construction.
+    std::unique_ptr<char, ArenaDeleter> arena;
+
+    /// All frames of the pool. Frame `i` owns the `i`-th page of the arena.
+    std::vector<BufferFrame> frames;
+
+    /// Maps page ids to the frames they are loaded into.
+    std::vector<std::unique_ptr<Partition>> partitions;
+
+    /// Protects `free_frames` and `policy`. May be acquired before, but
+    /// never while holding, a partition latch.
+    mutable std::mutex replacement_latch;
+
+    /// Frames that do not hold a page.
+    std::vector<BufferFrame*> free_frames;
+
+    /// Decides which pages are evicted. Tracks the frames that hold a page,
+    /// except those that are being loaded.
+    std::unique_ptr<ReplacementPolicy> policy;
+
+    /// Protects `segment_files` and the file sizes.
+    std::mutex file_latch;
+
+    /// One file per segment, opened on first access.
+    std::unordered_map<uint16_t, std::unique_ptr<File>> segment_files;
+
+    /// The durability the segment files are opened with.
+    File::Durability durability;
+
+    /// A segment whose pages are served from a mapping of its file.
+    struct MappedSegment {
+        std::unique_ptr<MmapFile> file;
+        /// One frame per page of the file, pointing into the mapping. They
+        /// are never latched, as nobody writes them.
+        std::unique_ptr<BufferFrame[]> frames;
+        uint64_t page_count = 0;
+    };
+
+    /// The mapped segments. Only changes before the pages are fixed.
+    std::unordered_map<uint16_t, MappedSegment> mapped_segments;
+
+    /// Returns the frame of `page_id` in a mapped segment, or null if the
+    /// segment is not mapped. Throws if the page is past the end of the
+    /// mapped file.
+    BufferFrame* get_mapped_frame(uint64_t page_id);
+
+    /// Is `frame` one of `frames` rather than a page of a mapped segment?
+    bool is_pool_frame(const BufferFrame& frame) const {
+        return &frame >= frames.data() && &frame < frames.data() + frames.size();
+    }
+
+    /// Returns the partition that `page_id` belongs to.
+    Partition& get_partition(uint64_t page_id) const {
+        return *partitions[page_id & (kPartitionCount - 1)];
+    }
+
+    /// Returns the file of the segment `segment_id`, opening it if necessary.
+    File& get_segment_file(uint16_t segment_id);
+
+    /// Returns the id of `frame`, i.e. its index in `frames`.
+    uint64_t get_frame_id(const BufferFrame& frame) const {
+        return static_cast<uint64_t>(&frame - frames.data());
+    }
+
+    /// Picks a frame for a new page: a free one, or else the first unfixed
+    /// victim of the replacement policy. Dirty victims are written back
+    /// first. Throws `buffer_full_error` when every frame is fixed.
+    BufferFrame& acquire_frame();
+
+    /// Records an access of a resident page with the replacement policy.
+    void record_hit(BufferFrame& frame);
+
+    /// Maps `page_id` to the unused `frame` and reads the page while the
+    /// frame is exclusively latched. `partition_lock` holds the latch of the
+    /// page's partition and is released before the read.
+    BufferFrame& load_page(BufferFrame& frame, uint64_t page_id, bool exclusive,
+                           std::unique_lock<std::mutex>& partition_lock);
+
+    /// Maps `page_id` to the unused, exclusively latched `frame` with one
+    /// fix. The caller holds the latch of the page's partition.
+    void map_frame(BufferFrame& frame, uint64_t page_id);
+
+    /// Hands a frame whose page was read to the replacement policy.
+    void finish_load(BufferFrame& frame, bool is_prefetched);
+
+    /// Unmaps a frame whose page could not be read, and releases its latch
+    /// and its fix.
+    void abort_load(BufferFrame& frame, uint64_t page_id);
+
+    /// Returns an exclusively latched frame from `acquire_frame()` unused.
+    void release_free_frame(BufferFrame& frame);
+
+    /// The number of reads the prefetcher keeps in flight, or a quarter of
+    /// the frames in smaller pools.
+    static constexpr size_t kPrefetchDepth = 32;
+
+    /// The prefetcher thread, started by the first `prefetch()`.
+    std::thread prefetcher;
+    /// Protects the members below.
+    std::mutex prefetch_latch;
+    /// Wakes up the prefetcher.
+    std::condition_variable prefetch_wakeup;
+    /// The pages that should be prefetched.
+    std::vector<uint64_t> prefetch_queue;
+    /// Should the prefetcher stop?
+    bool prefetcher_stopping = false;
+
+    /// The loop of the prefetcher thread.
+    void run_prefetcher();
+
+    /// Stops the prefetcher. Pages that are still queued are not loaded.
+    void stop_prefetcher();
+
+    /// Loads those of at most `kPrefetchDepth` pages that are not resident,
+    /// with all reads in flight at once, or one after the other if
+    /// `io_queue` is null. Errors only leave pages unloaded: the pages that
+    /// were not loaded yet are unmapped, and if the queue failed, it is
+    /// destroyed.
+    /// @return             False if the pool is full of fixed pages.
+    bool load_pages(std::unique_ptr<IOQueue>& io_queue, const uint64_t* page_ids, size_t count);
+
+    /// Drops one fix of `frame`, which was fixed for `page_id`, and returns the
+    /// frame to the free list when loading it failed and this was the last
+    /// fix. Does not touch the frame latch.
+    void unfix_page_id(BufferFrame& frame, uint64_t page_id, bool is_dirty);
+
+    /// Reads the page `frame.page_id` from its segment file into `frame`.
+    void read_frame(BufferFrame& frame);
+
+    /// Writes `frame` back to its segment file, after the log records that
+    /// changed it. The caller clears the dirty bit.
+    void write_frame(BufferFrame& frame);
+
+    /// Pins the unfixed, dirty `frame` and latches it shared for a write
+    /// back, which makes it clean. The caller holds the latch of its
+    /// partition.
+    void pin_for_write_back(BufferFrame& frame);
+
+    /// Writes back frames that were pinned with `pin_for_write_back()` and
+    /// unpins them. They are dirty again if the write fails.
+    void write_back(std::vector<BufferFrame*>& pinned_frames);
+
+    /// The number of frames that are pinned for a write back. Fixes wait for
+    /// them instead of failing when all other frames are fixed.
+    std::atomic<size_t> write_back_count = 0;
+
+    /// The time the cleaner sleeps when all victims are clean.
+    static constexpr std::chrono::milliseconds kCleanerInterval{10};
+
+    /// The background page cleaner, if started.
+    std::thread cleaner;
+    /// Protects `cleaner_stopping`.
+    std::mutex cleaner_latch;
+    /// Wakes up the cleaner early.
+    std::condition_variable cleaner_wakeup;
+    /// Should the cleaner stop?
+    bool cleaner_stopping = false;
+    /// The number of next victims that the cleaner keeps clean.
+    size_t clean_target = 0;
+
+    /// The loop of the cleaner thread.
+    void run_cleaner();
+
+    /// Writes back the dirty pages among the next `clean_target` victims.
+    /// @return             The number of pages that were written.
+    size_t clean_victims();
+
+    /// Writes several frames back like `write_frame()`. They are sorted by
+    /// page id, so the neighbouring pages of a segment are written with one
+    /// call.
+    void write_frames(std::vector<BufferFrame*>& dirty_frames);
+
+    /// The log of all page changes, null if they are not logged.
+    LogManager* log = nullptr;
+
+    /// A copy of every frame, `page_size * page_count` bytes, that is taken
+    /// when the frame is fixed exclusively, so the changes can be logged at
+    /// unfix. Only allocated with a log.
+    std::unique_ptr<char[]> shadows;
+
+    /// Returns the copy of `frame` in `shadows`.
+    char* get_shadow(const BufferFrame& frame) {
+        return shadows.get() + get_frame_id(frame) * page_size;
+    }
+
+    /// Appends the byte ranges of `frame` that changed since it was fixed
+    /// exclusively to the log record `record`.
+    void append_changes(const BufferFrame& frame, std::vector<char>& record);
+
+    /// Applies the changes of a log record to the pages.
+    void redo(const char* record, size_t size);
+
+    /// Releases the latch on `frame` and drops the fix.
+    void release(BufferFrame& frame, bool is_dirty);
+
+    /// The events that are counted, see `Stats`.
+    enum Counter {
+        HITS,
+        MISSES,
+        PREFETCHES,
+        EVICTIONS,
+        WRITE_BACKS,
+        READ_BYTES,
+        WRITTEN_BYTES,
+        LATCH_WAIT_NS,
+        COUNTER_COUNT
+    };
+
+    /// The event counters, summed up by `get_stats()`.
+    ThreadCounters<COUNTER_COUNT> counters;
+
+    /// Acquires `latch`, a mutex or a lock. A sample of the acquisitions
+    /// checks whether the latch is held by another thread and counts the
+    /// time spent waiting for it, scaled to all acquisitions, as latch wait
+    /// time. Checking every acquisition would cost a `try_lock()`, which is
+    /// slower than `lock()`.
+    template <typename LatchT>
+    void lock_latch(LatchT& latch);
+
+    /// Acquires `latch` shared like `lock_latch()`.
+    void lock_latch_shared(std::shared_mutex& latch);
+
+    /// Calls `lock` and counts the time it takes as the latch wait time of
+    /// a sampled acquisition.
+    void wait_for_latch(FunctionRef<void()> lock);
 
 public:
+    /// A snapshot of the statistics of a buffer manager. The counters count
+    /// from its construction.
+    struct Stats {
+        /// Fixes that found their page resident, or loaded by another fix.
+        uint64_t hits = 0;
+        /// Fixes that loaded their page.
+        uint64_t misses = 0;
+        /// Pages that were loaded by `prefetch()`.
+        uint64_t prefetches = 0;
+        /// Pages that were evicted to make room for another page.
+        uint64_t evictions = 0;
+        /// Pages that were written back, by evictions, the cleaner or
+        /// checkpoints.
+        uint64_t write_backs = 0;
+        /// Bytes read from and written to the segment files.
+        uint64_t read_bytes = 0;
+        uint64_t written_bytes = 0;
+        /// Nanoseconds that fixes waited for latches that other threads held,
+        /// estimated from a sample of the latch acquisitions.
+        uint64_t latch_wait_ns = 0;
+        /// Pages in the pool at the time of the snapshot, and how many of
+        /// them were dirty.
+        uint64_t resident_pages = 0;
+        uint64_t dirty_pages = 0;
+
+        /// Returns the share of fixes that were hits, 0 without fixes.
+        double get_hit_ratio() const;
+
+        /// Returns the statistics as a JSON object with the member names as
+        /// keys and the hit ratio as `hit_ratio`.
+        std::string to_json() const;
+    };
+
+    /// Makes the page changes of one structure modification, such as a node
+    /// split, a single log record, so recovery redoes all of them or none.
+    /// Pages that are unfixed dirty while it exists stay latched until it
+    /// ends; their changes are then logged and they are unfixed. A change
+    /// that ends by an exception is aborted instead: nothing is logged and
+    /// these pages get their content from before the change back. A change
+    /// that is created inside another one forms a record of its own, and must
+    /// not fix pages that the outer one holds. Without a log, it does nothing.
+    class AtomicChange {
+    public:
+        /// Starts a change on the calling thread.
+        explicit AtomicChange(BufferManager& buffer_manager);
+
+        /// Logs the change, or aborts it during stack unwinding, and unfixes
+        /// its pages.
+        ~AtomicChange();
+
+        AtomicChange(const AtomicChange&) = delete;
+        AtomicChange& operator=(const AtomicChange&) = delete;
+
+    private:
+        friend class BufferManager;
+
+        /// The innermost change of the calling thread.
+        static thread_local AtomicChange* current;
+
+        BufferManager& buffer_manager;
+        /// The change this one was created in.
+        AtomicChange* outer = nullptr;
+        /// Is the buffer manager logging?
+        bool is_logged;
+        /// The number of uncaught exceptions at construction. More at the end
+        /// mean that the change ends by an exception.
+        int uncaught_exceptions;
+        /// The pages that were unfixed, still latched.
+        std::vector<BufferFrame*> frames;
+        /// Their changes.
+        std::vector<char> record;
+    };
+
     /// Constructor.
     /// @param[in] page_size  Size in bytes that all pages will have.
     /// @param[in] page_count Maximum number of pages that should reside in
     //                        memory at the same time.
-    BufferManager(size_t page_size, size_t page_count);
+    /// @param[in] durability Durability of the segment files. Writes back are
+    ///                       not durable before `checkpoint()` unless it is
+    ///                       `DSYNC`. With `DIRECT`, `page_size` must be a
+    ///                       multiple of `File::kDirectAlignment`.
+    /// @param[in] policy_kind The replacement policy.
+    BufferManager(size_t page_size, size_t page_count,
+                  File::Durability durability = File::BUFFERED,
+                  ReplacementPolicy::Kind policy_kind = ReplacementPolicy::TWO_Q);
 
-    /// Destructor. Writes all dirty pages to disk.
+    /// Destructor. Writes all dirty pages to disk like `checkpoint()`, but
+    /// ignores errors; call `checkpoint()` first to see them.
     ~BufferManager();
 
+    /// Redoes the changes in `log`, then logs all further page changes in it.
+    /// A page is only written back after the records that changed it are
+    /// durable, so after a crash the pages are restored from their last
+    /// version on disk and the log. Must be called before any page is fixed.
+    /// `log` must outlive the buffer manager.
+    /// @param[in] log          The log.
+    void enable_logging(LogManager& log);
+
+    /// Waits until all page changes so far are durable in the log. Threads
+    /// that commit at the same time share one log write.
+    /// Is thread-safe.
+    void commit();
+
+    /// Writes all dirty pages back, syncs the segment files and empties the
+    /// log, which is then no longer needed for recovery.
+    /// Is not thread-safe.
+    void checkpoint();
+
+    /// Writes all pages that are dirty back and syncs the segment files.
+    /// Pages are written in page id order per segment, neighbours with a
+    /// single call. Pages that are fixed exclusively are waited for, so the
+    /// caller must not hold any frame latch.
+    /// Is thread-safe.
+    void flush_all();
+
+    /// Starts a background thread that writes back dirty pages before they
+    /// are evicted, so fixes rarely have to wait for a write. It keeps the
+    /// next `clean_share * page_count` victims of the replacement policy
+    /// clean, writing their dirty pages in page id order per segment and
+    /// neighbours with a single call. Stopped by `stop_cleaner()` or the
+    /// destructor.
+    /// @param[in] clean_share  The share of clean frames, in (0, 1].
+    void start_cleaner(double clean_share);
+
+    /// Stops the cleaner, if started. Dirty pages stay dirty.
+    void stop_cleaner();
+
+    /// Maps the file of segment `segment_id` read-only and serves all fixes
+    /// of its pages straight from the mapping: they take no frame of the
+    /// pool, copy nothing and never latch. The segment must have been
+    /// checkpointed, must not change while it is mapped, and must not be
+    /// fixed exclusively; such fixes throw. Its pages must lie within its
+    /// file. Must be called before any page of the segment is fixed.
+    /// Is not thread-safe.
+    /// @param[in] segment_id   Id of the segment.
+    /// @param[in] access       The expected access to the segment, e.g.
+    ///                         `RANDOM` for point lookups or `WILL_NEED` to
+    ///                         load a small, hot segment right away.
+    void map_segment(uint16_t segment_id, MmapFile::Access access = MmapFile::RANDOM);
+
+    /// Uses `file` as the file of segment `segment_id` instead of the file
+    /// that is named after it, e.g. a `TestFile`. Must be called before any
+    /// page of the segment is fixed.
+    /// Is thread-safe.
+    void set_segment_file(uint16_t segment_id, std::unique_ptr<File> file);
+
     /// Returns size of a page
     size_t get_page_size() { return page_size; }
 
@@ -61,18 +582,66 @@ public:
     ///                      non-exclusively (shared).
     BufferFrame& fix_page(uint64_t page_id, bool exclusive);
 
+    /// Starts loading pages in the background, without fixing them. A later
+    /// `fix_page()` of one of them finds it resident, or waits until its
+    /// read completed. Resident pages are skipped. Pages of mapped segments
+    /// are ignored. Prefetched pages count as not accessed yet, so with 2Q
+    /// they stay in the FIFO list and are evicted first if they are never
+    /// fixed.
+    /// Should be used for fewer pages than the pool holds.
+    /// Is thread-safe.
+    /// @param[in] page_ids The page ids, best in the order of their use.
+    /// @param[in] count    The number of pages.
+    void prefetch(const uint64_t* page_ids, size_t count);
+
+    /// Returns the frame of a resident page for an optimistic read without
+    /// fixing or latching it and without writing to shared memory. Returns
+    /// null when the page is not resident or exclusively latched; fix it
+    /// to load it or to wait for the writer. Otherwise `version` receives
+    /// the frame version, and everything read from the frame must be
+    /// confirmed with `BufferFrame::validate(version)` before it is used.
+    /// The frame memory stays valid, but may get a different page at any
+    /// time.
+    /// Is thread-safe.
+    BufferFrame* peek_page(uint64_t page_id, uint64_t& version);
+
     /// Takes a `BufferFrame` reference that was returned by an earlier call to
     /// `fix_page()` and unfixes it. When `is_dirty` is / true, the page is
-    /// written back to disk eventually.
+    /// written back to disk eventually. With a log, the changes of a dirty
+    /// page are logged first; only exclusively fixed pages may be dirty.
     void unfix_page(BufferFrame& page, bool is_dirty);
 
+    /// Makes sure that the file of segment `segment_id` holds at least
+    /// `page_count` pages, appending zeroed pages otherwise. Segments reserve
+    /// space in extents with this, so their files grow in few large steps
+    /// instead of one page per eviction.
+    /// Is thread-safe.
+    void reserve_pages(uint16_t segment_id, uint64_t page_count);
+
+    /// Shrinks the file of segment `segment_id` to `page_count` pages. The
+    /// pages behind must be unused: their unfixed frames are marked clean,
+    /// so they do not grow the file again, and read as zeroes once evicted.
+    /// Is thread-safe.
+    void truncate_pages(uint16_t segment_id, uint64_t page_count);
+
+    /// Returns the current statistics. The counters of concurrent fixes may
+    /// or may not be included. Visits every frame to count the resident and
+    /// dirty pages, so it is meant to be called periodically, not per fix.
+    /// Is thread-safe.
+    Stats get_stats() const;
+
+    /// Returns the replacement policy.
+    ReplacementPolicy::Kind get_policy() const { return policy->get_kind(); }
+
     /// Returns the page ids of all pages (fixed and unfixed) that are in the
-    /// FIFO list in FIFO order.
+    /// FIFO list in FIFO order. With ARC these are the pages that were fixed
+    /// once, with CLOCK all pages in the order of the hand.
     /// Is not thread-safe.
     std::vector<uint64_t> get_fifo_list() const;
 
     /// Returns the page ids of all pages (fixed and unfixed) that are in the
-    /// LRU list in LRU order.
+    /// LRU list in LRU order. With ARC these are the pages that were fixed
+    /// repeatedly, with CLOCK none.
     /// Is not thread-safe.
     std::vector<uint64_t> get_lru_list() const;
 
@@ -97,4 +666,35 @@ public:
 };
 
 
+/// Unfixes a page when it goes out of scope, unless it was unfixed before.
+/// Fixing and allocating pages throws, e.g. `buffer_full_error`, so
+/// operations that change several pages fix all of them and allocate the
+/// pages they need before they change the first one. An exception then
+/// leaves the pages unchanged, and the guards release them, unfixed as
+/// clean. A page that was allocated before the exception stays allocated.
+class FixGuard {
+public:
+    FixGuard(BufferManager& buffer_manager, BufferFrame& frame) : buffer_manager(buffer_manager), frame(&frame) {}
+
+    ~FixGuard() {
+        if (frame) {
+            buffer_manager.unfix_page(*frame, false);
+        }
+    }
+
+    FixGuard(const FixGuard&) = delete;
+    FixGuard& operator=(const FixGuard&) = delete;
+
+    BufferFrame& operator*() const { return *frame; }
+    BufferFrame* operator->() const { return frame; }
+
+    /// Unfixes the page now.
+    void unfix(bool is_dirty) { buffer_manager.unfix_page(*std::exchange(frame, nullptr), is_dirty); }
+
+private:
+    BufferManager& buffer_manager;
+    BufferFrame* frame;
+};
+
+
 }  // namespace buzzdb
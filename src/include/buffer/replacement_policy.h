@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "common/function_ref.h"
+
+namespace buzzdb {
+
+/// Decides which pages the buffer manager evicts. A policy tracks the frames
+/// that hold a page by their frame id, from `insert()` until `remove()`.
+/// The buffer manager calls it with its replacement latch held, except for
+/// `access()` of policies with `has_latch_free_access()`, so policies need
+/// no synchronization of their own. They must not allocate after
+/// construction.
+class ReplacementPolicy {
+public:
+    /// The available policies.
+    enum Kind {
+        /// A page enters a FIFO queue when it is loaded and moves to an LRU
+        /// queue when it is fixed again. Victims come from the FIFO queue
+        /// first, so pages that are used once, like those of a scan, do not
+        /// push out pages that are used repeatedly.
+        TWO_Q,
+        /// A reference bit per frame that a fix sets, and a hand that sweeps
+        /// the frames, clearing set bits and evicting frames whose bit is
+        /// clear. Fixes only set a bit and take no latch.
+        CLOCK,
+        /// Adaptive Replacement Cache: like 2Q, a queue of pages that were
+        /// fixed once and one of pages that were fixed repeatedly, but it
+        /// also remembers the pages recently evicted from each, and adapts
+        /// the target size of the first queue to where such pages return.
+        ARC
+    };
+
+    /// Creates a policy for `frame_count` frames.
+    static std::unique_ptr<ReplacementPolicy> create(Kind kind, size_t frame_count);
+
+    virtual ~ReplacementPolicy() = default;
+
+    /// Returns the kind of the policy.
+    virtual Kind get_kind() const = 0;
+
+    /// May `access()` be called concurrently with each other and with the
+    /// other functions?
+    bool has_latch_free_access() const { return latch_free_access; }
+
+    /// Starts tracking frame `frame_id`, into which `page_id` was loaded.
+    /// @param[in] is_prefetched Was the page loaded ahead of its use? Then
+    ///                          the next access counts as the first one.
+    virtual void insert(uint64_t frame_id, uint64_t page_id, bool is_prefetched) = 0;
+
+    /// Records a fix of the page in frame `frame_id`. Frames that are not
+    /// tracked, because their page is still being loaded, are ignored.
+    virtual void access(uint64_t frame_id) = 0;
+
+    /// Stops tracking frame `frame_id`, whose page was evicted.
+    virtual void remove(uint64_t frame_id) = 0;
+
+    /// Calls `visit` for the tracked frames in the order in which they
+    /// should be evicted, until it returns true. A visited frame that
+    /// cannot be evicted right now, e.g. because it is fixed, is skipped by
+    /// returning false.
+    /// @param[in] is_evicting  Is a victim taken? Then the policy may update
+    ///                         its state on the way, like the reference bits
+    ///                         of `CLOCK`. Otherwise it only looks ahead.
+    /// @param[in] visit        Called with the frame ids.
+    virtual void visit_victims(bool is_evicting, FunctionRef<bool(uint64_t)> visit) = 0;
+
+    /// Returns the frame ids of the tracked frames per queue of the policy,
+    /// each in eviction order. For tests.
+    virtual std::vector<std::vector<uint64_t>> get_queues() const = 0;
+
+protected:
+    explicit ReplacementPolicy(bool latch_free_access) : latch_free_access(latch_free_access) {}
+
+private:
+    bool latch_free_access;
+};
+
+}  // namespace buzzdb
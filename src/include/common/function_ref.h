@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace buzzdb {
+
+/// A reference to a callable that is passed down a call, such as a visitor.
+/// Unlike `std::function` it never allocates, so it can be used where
+/// nothing may allocate. The callable must outlive the reference.
+template <typename Signature>
+class FunctionRef;
+
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)> {
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionRef>>>
+    FunctionRef(F&& callable)  // NOLINT(google-explicit-constructor)
+        : object(const_cast<void*>(static_cast<const void*>(std::addressof(callable)))),
+          invoke([](void* object, Args... args) -> R {
+              return (*static_cast<std::remove_reference_t<F>*>(object))(std::forward<Args>(args)...);
+          }) {}
+
+    R operator()(Args... args) const { return invoke(object, std::forward<Args>(args)...); }
+
+private:
+    void* object;
+    R (*invoke)(void*, Args...);
+};
+
+}  // namespace buzzdb
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
 namespace buzzdb {
 
 #define UNUSED_ATTRIBUTE __attribute__((unused))
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+
+namespace buzzdb {
+
+/// Assigns an index to the calling thread, see `get_thread_index()`.
+size_t acquire_thread_index();
+
+/// Returns the index of the calling thread, which is unique among the
+/// running threads. The indices of exited threads are reused, so they stay
+/// small.
+inline size_t get_thread_index() {
+    // Constant initialized, so reading it needs no initialization guard.
+    thread_local size_t index = std::numeric_limits<size_t>::max();
+    if (index == std::numeric_limits<size_t>::max()) {
+        index = acquire_thread_index();
+    }
+    return index;
+}
+
+/// Event counters that many threads bump. Each thread counts in a slot of
+/// its own, with cache lines of its own, so a thread only writes lines that
+/// no other thread writes, and needs no atomic read-modify-write to count.
+/// Threads beyond the first `kSlotCount` ones that run at the same time
+/// share a last slot.
+/// @tparam CounterCount    The number of counters, usually the size of an
+///                         enum that names them.
+template <size_t CounterCount>
+class ThreadCounters {
+public:
+    /// Number of slots that threads have to themselves.
+    static constexpr size_t kSlotCount = 64;
+
+    /// Constructor. All counters start at 0.
+    ThreadCounters() : slots(std::make_unique<Slot[]>(kSlotCount + 1)) { slots[kSlotCount].is_shared = true; }
+
+    /// Adds `value` to a counter of the calling thread.
+    void add(size_t counter, uint64_t value = 1) {
+        Slot &slot = slots[std::min(get_thread_index(), kSlotCount)];
+        std::atomic<uint64_t> &target = slot.values[counter];
+        if (slot.is_shared) {
+            target.fetch_add(value, std::memory_order_relaxed);
+        } else {
+            target.store(target.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    }
+
+    /// Returns the sum of a counter over all threads. Counts that are added
+    /// meanwhile may or may not be included.
+    uint64_t get(size_t counter) const {
+        uint64_t sum = 0;
+        for (size_t i = 0; i <= kSlotCount; ++i) {
+            sum += slots[i].values[counter].load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> values[CounterCount] = {};
+        /// Is this the slot that threads share?
+        bool is_shared = false;
+    };
+
+    /// `kSlotCount` slots and the shared one.
+    std::unique_ptr<Slot[]> slots;
+};
+
+}  // namespace buzzdb
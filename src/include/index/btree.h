@@ -1,14 +1,26 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cmath>
 #include <cstddef>
 #include <cstring>
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <optional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 #include "buffer/buffer_manager.h"
 #include "common/defer.h"
 #include "common/macros.h"
+#include "common/thread_counters.h"
+#include "index/key_search.h"
 #include "storage/segment.h"
 
 #define UNUSED(p)  ((void)(p))
@@ -17,9 +29,28 @@ namespace buzzdb {
 
 template<typename KeyT, typename ValueT, typename ComparatorT, size_t PageSize>
 struct BTree : public Segment {
+    /// The header of every node. The 64 bit member comes first and the small
+    /// ones last, so the header has no padding inside.
     struct Node {
-        // member to hold the parent node 
-        Node *parent; //added 
+        /// Bits of `flags`.
+        static constexpr uint16_t kHasLowKey = 1;
+        static constexpr uint16_t kDeleted = 2;
+        /// Set in every node, so a page of zeroes is not taken for an empty
+        /// leaf.
+        static constexpr uint16_t kFormatted = 4;
+
+        /// The page id of the next node on the same level, 0 if there is
+        /// none. Keys greater than `high_key` moved there in a split.
+        uint64_t right_sibling;
+
+        /// The largest key that may be stored in this node or its subtree.
+        /// Only meaningful if there is a right sibling.
+        KeyT high_key;
+
+        /// All keys in this node or its subtree are greater than `low_key`,
+        /// the high key of the left sibling. Only meaningful if `flags` has
+        /// `kHasLowKey`.
+        KeyT low_key;
 
         /// The level in the tree.
         uint16_t level;
@@ -27,86 +58,193 @@ struct BTree : public Segment {
         /// The number of children.
         uint16_t count;
 
+        /// `kHasLowKey`, `kDeleted` and `kFormatted`.
+        uint16_t flags;
+
         // Constructor
         Node(uint16_t level, uint16_t count)
-            : level(level), count(count) {}
+            : right_sibling(0), high_key(), low_key(), level(level), count(count), flags(kFormatted) {}
 
         /// Is the node a leaf node?
         bool is_leaf() const { return level == 0; }
+
+        /// Was the node merged into its left sibling? Its page may be reused
+        /// for another node at any time, or read back as zeroes once the
+        /// segment file shrank below it.
+        bool is_deleted() const { return (flags & (kDeleted | kFormatted)) != kFormatted; }
+
+        /// Does the key range of this node include `key`? If not, `key` is
+        /// found by following the right sibling links.
+        bool covers(const KeyT &key) const {
+            return right_sibling == 0 || !ComparatorT()(high_key, key);
+        }
+
+        /// Does the key range of this node start above `key`, or was the node
+        /// deleted? Pages that are reached through a stale page id may hold
+        /// such nodes; `key` is then searched from the root again.
+        bool follows(const KeyT &key) const {
+            return is_deleted() || ((flags & kHasLowKey) && !ComparatorT()(low_key, key));
+        }
+
+        /// Sets the low key.
+        void set_low_key(const KeyT &key) {
+            low_key = key;
+            flags |= kHasLowKey;
+        }
+
+        /// Links this node to its new right sibling after a split. The
+        /// sibling takes over the old key range above `split_key`.
+        void link(Node &right, uint64_t right_page_id, const KeyT &split_key) {
+            right.high_key = high_key;
+            right.right_sibling = right_sibling;
+            right.set_low_key(split_key);
+            high_key = split_key;
+            right_sibling = right_page_id;
+        }
+
+        /// Takes over the key range of the right sibling after its entries
+        /// were merged into this node, and marks the sibling deleted.
+        void unlink(Node &right) {
+            high_key = right.high_key;
+            right_sibling = right.right_sibling;
+            right.flags |= kDeleted;
+        }
+
+        /// Moves the boundary to the right sibling to `split_key` after
+        /// entries moved between both.
+        void relink(Node &right, const KeyT &split_key) {
+            high_key = split_key;
+            right.low_key = split_key;
+        }
     };
 
     struct InnerNode: public Node {
-        /// The capacity of a node.
-        static constexpr uint32_t kCapacity = (PageSize - sizeof(Node)) / (sizeof(KeyT) + sizeof(ValueT));
+        /// The capacity of a node, i.e. the maximum number of children. A
+        /// node with n children stores n - 1 separators.
+        static constexpr uint32_t kCapacity =
+            (PageSize - sizeof(Node) + sizeof(KeyT)) / (sizeof(uint64_t) + sizeof(KeyT));
 
-        /// The keys.
-        KeyT keys[kCapacity];
+        /// Nodes with fewer children are merged with or refilled from a
+        /// sibling.
+        static constexpr uint32_t kMinCount = kCapacity / 4;
 
-        /// The children.
+        /// The children. They come first as the header ends 8 byte aligned,
+        /// so neither array needs padding.
         uint64_t children[kCapacity];
 
+        /// The keys.
+        KeyT keys[kCapacity - 1];
+
         /// Constructor.
-        InnerNode() : Node(0, 0) {}
+        /// @param[in] level        The level of the node, 1 for parents of leaves.
+        explicit InnerNode(uint16_t level = 1) : Node(level, 0) {}
 
         /// Get the index of the first key that is not less than than a provided key.
+        /// The index is also the index of the child that covers `key`; the
+        /// flag is false when `key` is greater than all separators.
+        /// Stays within the node when the count is torn by a concurrent writer.
         /// @param[in] key          The key that should be searched.
         std::pair<uint32_t, bool> lower_bound(const KeyT &key) {
-	        for (uint32_t i = 0; i < this->count; ++i) {
-                if (keys[i] >= key) {
-                    return std::make_pair(i, true);  // Found one!
-                }
-            }
-            // Provided key is greater than all keys in the node.
-            return std::make_pair(this->count, false);
+            uint32_t key_count = std::clamp<uint32_t>(this->count, 1, kCapacity) - 1;
+            uint32_t index = KeySearch<KeyT, ComparatorT>::lower_bound(keys, key_count, key);
+            return std::make_pair(index, index < key_count);
         }
 
         /// Insert a key.
         /// @param[in] key          The separator that should be inserted.
         /// @param[in] split_page   The id of the split page that should be inserted.
-        void insert(const KeyT &key, uint64_t split_page) {  // *MarcAdd*
- 	    // Find the correct position to insert the new key
-	    int index = 0;
-	    while (index < count && keys[index] < key) {
-	        index++;
-	    }
-	
-	    // Shift keys and children to the right to make space for the new key and child
-	    for (int i = count; i > index; i--) {
-	        keys[i] = keys[i - 1];
-	        children[i + 1] = children[i];
-	    }
-	
-	    // Insert the new key and child
-	    keys[index] = key;
-	    children[index + 1] = child;
-	
-	    // Increase the count of keys in the node
-	    count++;
-           
+        void insert(const KeyT &key, uint64_t split_page) {
+            uint32_t index = lower_bound(key).first;
+
+            // Shift keys and children to the right to make space for the new
+            // separator and its right child.
+            for (uint32_t i = this->count - 1; i > index; --i) {
+                keys[i] = keys[i - 1];
+                children[i + 1] = children[i];
+            }
+            keys[index] = key;
+            children[index + 1] = split_page;
+            this->count++;
+        }
+
+        /// Erase the separator `index` and the child to its right, after that
+        /// child was merged into its left sibling.
+        void erase(uint32_t index) {
+            for (uint32_t i = index; i + 2 < this->count; ++i) {
+                keys[i] = keys[i + 1];
+                children[i + 1] = children[i + 2];
+            }
+            this->count--;
+        }
+
+        /// Appends the children of the right sibling and unlinks it.
+        /// @param[in] right        The right sibling.
+        /// @param[in] separator    The separator between both in the parent.
+        void merge(InnerNode &right, const KeyT &separator) {
+            keys[this->count - 1] = separator;
+            std::copy(right.children, right.children + right.count, children + this->count);
+            std::copy(right.keys, right.keys + right.count - 1, keys + this->count);
+            this->count += right.count;
+            this->unlink(right);
+        }
+
+        /// Moves children between this node and its right sibling so that
+        /// both have about the same number.
+        /// @param[in] right        The right sibling.
+        /// @param[in] separator    The separator between both in the parent.
+        /// @return                 The new separator.
+        KeyT balance(InnerNode &right, const KeyT &separator) {
+            uint32_t target = (this->count + right.count) / 2;
+            KeyT split_key;
+            if (this->count < target) {
+                // The old separator moves down, the last moved one moves up.
+                uint32_t n = target - this->count;
+                keys[this->count - 1] = separator;
+                std::copy(right.children, right.children + n, children + this->count);
+                std::copy(right.keys, right.keys + n - 1, keys + this->count);
+                split_key = right.keys[n - 1];
+                std::copy(right.children + n, right.children + right.count, right.children);
+                std::copy(right.keys + n, right.keys + right.count - 1, right.keys);
+                this->count += n;
+                right.count -= n;
+            } else {
+                uint32_t n = this->count - target;
+                std::copy_backward(right.children, right.children + right.count,
+                                   right.children + right.count + n);
+                std::copy_backward(right.keys, right.keys + right.count - 1, right.keys + right.count - 1 + n);
+                right.keys[n - 1] = separator;
+                std::copy(children + target, children + this->count, right.children);
+                std::copy(keys + target, keys + this->count - 1, right.keys);
+                split_key = keys[target - 1];
+                this->count = target;
+                right.count += n;
+            }
+            this->relink(right, split_key);
+            return split_key;
         }
 
         /// Split the node.
         /// @param[in] buffer       The buffer for the new page.
+        /// @param[in] buffer_page  The page id of the new page.
         /// @return                 The separator key.
-        KeyT split(std::byte* buffer) {
-            // Create a new inner node
-            auto *right_inner_node = new (buffer) InnerNode();
+        KeyT split(std::byte* buffer, uint64_t buffer_page) {
+            auto *right_inner_node = new (buffer) InnerNode(this->level);
 
-            // Create a new key
-	        uint32_t split_point = this->count / 2;
+            // The left node keeps the first half of the children, the
+            // separator between both halves moves up to the parent.
+            uint32_t split_point = this->count / 2;
             KeyT split_key = keys[split_point - 1];
 
-            right_inner_node->children[0] = children[split_point];
-            right_inner_node->count++;
-            
-            for (int i = split_point; i < this->count; i++){
+            for (uint32_t i = split_point; i < this->count; ++i) {
+                right_inner_node->children[i - split_point] = children[i];
+            }
+            for (uint32_t i = split_point; i + 1 < this->count; ++i) {
                 right_inner_node->keys[i - split_point] = keys[i];
-                right_inner_node->children[i - split_point + 1] = children[i + 1];  //*MarcAdd*
             }
 
-            // update the counts  of each node 
             right_inner_node->count = this->count - split_point;
             this->count = split_point;
+            this->link(*right_inner_node, buffer_page, split_key);
 
             return split_key;
         }
@@ -114,20 +252,31 @@ struct BTree : public Segment {
         /// Returns the keys.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<KeyT> get_key_vector() {
-            return keys;
+            return std::vector<KeyT>(keys, keys + this->count - 1);
         }
 
         /// Returns the child page ids.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<uint64_t> get_child_vector() {
-            return children;
+            return std::vector<uint64_t>(children, children + this->count);
         }
     };
 
+    static_assert(sizeof(InnerNode) <= PageSize, "inner nodes must fit into a page");
+
     struct LeafNode: public Node {
         /// The capacity of a node.
-        /// TODO think about the capacity that the nodes have.
-        static constexpr uint32_t kCapacity = (PageSize - sizeof(Node)) / (sizeof(KeyT) + sizeof(ValueT));
+        static constexpr uint32_t kCapacity =
+            (PageSize - sizeof(Node) - sizeof(uint64_t)) / (sizeof(KeyT) + sizeof(ValueT));
+
+        /// Nodes with fewer entries are merged with or refilled from a
+        /// sibling.
+        static constexpr uint32_t kMinCount = kCapacity / 4;
+
+        /// The page id of the previous leaf, 0 if there is none. Only a hint
+        /// for backward scans, which check that the leaf on that page ends
+        /// at the low key of this one.
+        uint64_t left_sibling;
 
         /// The keys.
         KeyT keys[kCapacity];
@@ -136,259 +285,1592 @@ struct BTree : public Segment {
         ValueT values[kCapacity];
 
         /// Constructor.
-        LeafNode() : Node(0, 0) {}
+        LeafNode() : Node(0, 0), left_sibling(0) {}
 
-        /// Insert a key.
+        /// Get the index of the first key that is not less than than a provided key.
+        /// The flag is true when the key at that index equals `key`.
+        /// Stays within the node when the count is torn by a concurrent writer.
+        /// @param[in] key          The key that should be searched.
+        std::pair<uint32_t, bool> lower_bound(const KeyT &key) {
+            uint32_t key_count = std::min<uint32_t>(this->count, kCapacity);
+            uint32_t index = KeySearch<KeyT, ComparatorT>::lower_bound(keys, key_count, key);
+            bool found = index < key_count && !ComparatorT()(key, keys[index]);
+            return std::make_pair(index, found);
+        }
+
+        /// Insert a key. An existing key gets its value overwritten.
         /// @param[in] key          The key that should be inserted.
         /// @param[in] value        The value that should be inserted.
-        void insert(const KeyT &key, const ValueT &value) {  //  *MarcAdd*
-            // Find the correct position to insert the new key
-	    uint32_t index = 0;
-	    while (index < count && keys[index] < key) {
-	        index++;
-	    }
-	
-	    // Shift keys and values to the right to make space for the new key and value
-	    for (uint32_t i = count; i > index; --i) {
-	        keys[i] = keys[i - 1];
-	        values[i] = values[i - 1];
-	    }
-	
-	    // Insert the new key and value
-	    keys[index] = key;
-	    values[index] = value;
-	
-	    // Increase the count of keys and values in the node
-	    count++;
+        void insert(const KeyT &key, const ValueT &value) {
+            auto [index, found] = lower_bound(key);
+            if (found) {
+                values[index] = value;
+                return;
+            }
+
+            // Shift keys and values to the right to make space for the new key and value
+            for (uint32_t i = this->count; i > index; --i) {
+                keys[i] = keys[i - 1];
+                values[i] = values[i - 1];
+            }
+            keys[index] = key;
+            values[index] = value;
+            this->count++;
         }
 
         /// Erase a key.
         void erase(const KeyT &key) {
-            // find the key in the leaf's key array 
-            uint16_t index = static_cast<uint16_t>(-1);;
-            for (uint16_t i = 0; i < this->count; ++i) {
-                if (this->keys[i] == key) {
-                    index = i;
-                    break;  // Key found
+            auto [index, found] = lower_bound(key);
+            if (!found) {
+                return;
+            }
+            for (uint32_t i = index; i + 1 < this->count; ++i) {
+                keys[i] = keys[i + 1];
+                values[i] = values[i + 1];
+            }
+            this->count--;
+        }
+
+        /// Returns the number of keys of the sorted entries [begin, end) that
+        /// are not in the node yet. Repeated keys are counted once.
+        template <typename RandomIt>
+        uint32_t count_new(RandomIt begin, RandomIt end) const {
+            uint32_t added = 0;
+            uint32_t i = 0;
+            for (RandomIt it = begin; it != end; ++it) {
+                if (it + 1 != end && !ComparatorT()(it->first, (it + 1)->first)) {
+                    continue;
+                }
+                while (i < this->count && ComparatorT()(keys[i], it->first)) {
+                    ++i;
                 }
+                added += i == this->count || ComparatorT()(it->first, keys[i]);
             }
-            if (index != static_cast<uint16_t>(-1)) {
-                // Key found; remove it
-                for (uint16_t i = index; i < this->count - 1; ++i) {
-                    keys[i] = keys[i + 1];
-                    values[i] = values[i + 1];
+            return added;
+        }
+
+        /// Merges the sorted entries [begin, end) with the node in one pass
+        /// from the back. Entries overwrite the values of existing keys, and
+        /// the last of repeated keys wins, like a sequence of `insert()`s.
+        /// The node is unchanged unless the output is its own arrays, which
+        /// is safe as every entry is written behind the ones still to read.
+        /// @param[in] total        The number of merged entries, `count` plus
+        ///                         `count_new(begin, end)`.
+        /// @param[out] out_keys    Receives the merged keys.
+        /// @param[out] out_values  Receives the merged values.
+        template <typename RandomIt>
+        void merge(RandomIt begin, RandomIt end, uint32_t total, KeyT *out_keys, ValueT *out_values) const {
+            uint32_t i = this->count;
+            uint32_t out = total;
+            RandomIt it = end;
+            while (it != begin) {
+                if (i > 0 && ComparatorT()((it - 1)->first, keys[i - 1])) {
+                    --i;
+                    --out;
+                    out_keys[out] = keys[i];
+                    out_values[out] = values[i];
+                    continue;
                 }
-                this->count--;
-            } 
-            return;
+                --it;
+                KeyT key = it->first;
+                if (i > 0 && !ComparatorT()(keys[i - 1], key)) {
+                    --i;
+                }
+                --out;
+                out_keys[out] = key;
+                out_values[out] = it->second;
+                while (it != begin && !ComparatorT()((it - 1)->first, key)) {
+                    --it;
+                }
+            }
+            assert(out == i);
+            if (out_keys != keys) {
+                std::copy(keys, keys + i, out_keys);
+                std::copy(values, values + i, out_values);
+            }
+        }
+
+        /// Appends the entries of the right sibling and unlinks it.
+        /// @param[in] right        The right sibling.
+        void merge(LeafNode &right) {
+            std::copy(right.keys, right.keys + right.count, keys + this->count);
+            std::copy(right.values, right.values + right.count, values + this->count);
+            this->count += right.count;
+            this->unlink(right);
+        }
+
+        /// Moves entries between this node and its right sibling so that
+        /// both have about the same number.
+        /// @param[in] right        The right sibling.
+        /// @return                 The new separator.
+        KeyT balance(LeafNode &right) {
+            uint32_t target = (this->count + right.count) / 2;
+            if (this->count < target) {
+                uint32_t n = target - this->count;
+                std::copy(right.keys, right.keys + n, keys + this->count);
+                std::copy(right.values, right.values + n, values + this->count);
+                std::copy(right.keys + n, right.keys + right.count, right.keys);
+                std::copy(right.values + n, right.values + right.count, right.values);
+                this->count += n;
+                right.count -= n;
+            } else {
+                uint32_t n = this->count - target;
+                std::copy_backward(right.keys, right.keys + right.count, right.keys + right.count + n);
+                std::copy_backward(right.values, right.values + right.count, right.values + right.count + n);
+                std::copy(keys + target, keys + this->count, right.keys);
+                std::copy(values + target, values + this->count, right.values);
+                this->count = target;
+                right.count += n;
+            }
+            this->relink(right, keys[this->count - 1]);
+            return keys[this->count - 1];
         }
 
         /// Split the node.
         /// @param[in] buffer       The buffer for the new page.
+        /// @param[in] buffer_page  The page id of the new page.
         /// @return                 The separator key.
-        KeyT split(std::byte* buffer) {
-            // Create a new inner node
+        KeyT split(std::byte* buffer, uint64_t buffer_page) {
             auto *right_leaf_node = new (buffer) LeafNode();
 
-            // Create a new key
-	        uint32_t split_point = this->count / 2;
-
-            
-            for (int i = split_point; i < this->count; i++){
+            // The left node keeps the first half, its largest key becomes the
+            // separator.
+            uint32_t split_point = this->count / 2;
+            for (uint32_t i = split_point; i < this->count; ++i) {
                 right_leaf_node->keys[i - split_point] = keys[i];
                 right_leaf_node->values[i - split_point] = values[i];
             }
 
-            // update the counts  of each node 
             right_leaf_node->count = this->count - split_point;
             this->count = split_point;
+            this->link(*right_leaf_node, buffer_page, keys[split_point - 1]);
 
-            return right_leaf_node->keys[0];
+            return keys[split_point - 1];
         }
 
         /// Returns the keys.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<KeyT> get_key_vector() {
-            return keys; 
+            return std::vector<KeyT>(keys, keys + this->count);
         }
 
         /// Returns the values.
         /// Can be implemented inefficiently as it's only used in the tests.
         std::vector<ValueT> get_value_vector() {
-            return values;
+            return std::vector<ValueT>(values, values + this->count);
+        }
+    };
+
+    static_assert(sizeof(LeafNode) <= PageSize, "leaf nodes must fit into a page");
+
+    /// A node that is read optimistically, i.e. without fixing or latching
+    /// its page. Everything read from it has to be validated before use.
+    struct OptimisticRead {
+        /// The page of the node, 0 if there is none.
+        uint64_t page_id = 0;
+
+        /// The frame holding the page.
+        BufferFrame *frame = nullptr;
+
+        /// The frame version when the read started.
+        uint64_t version = 0;
+
+        /// Returns the node.
+        Node *node() const { return reinterpret_cast<Node *>(frame->get_data()); }
+
+        /// Is the node unchanged since the read started?
+        bool validate() const { return frame->validate(version); }
+    };
+
+    /// A cursor over the entries of a key range [lo, hi) that moves in both
+    /// directions. It keeps the current leaf fixed (shared), and the next one
+    /// too while it moves right, so the owning thread must not modify the
+    /// tree while it holds a valid cursor. Entries that are inserted or
+    /// erased concurrently may or may not be seen.
+    class Cursor {
+    public:
+        Cursor(Cursor &&other) noexcept
+            : tree(other.tree), lo(other.lo), hi(other.hi), page_id(other.page_id),
+              frame(std::exchange(other.frame, nullptr)), index(other.index),
+              prefetch_boundary(other.prefetch_boundary) {}
+        Cursor &operator=(Cursor &&other) = delete;
+
+        /// Destructor. Unfixes the current leaf.
+        ~Cursor() { release(); }
+
+        /// Does the cursor point to an entry? Cursors become invalid when
+        /// they move past either end of the range.
+        bool is_valid() const { return frame != nullptr; }
+
+        /// Returns the key of the current entry.
+        const KeyT &key() const { return leaf()->keys[index]; }
+
+        /// Returns the value of the current entry.
+        const ValueT &value() const { return leaf()->values[index]; }
+
+        /// Moves to the next entry in key order.
+        void next() {
+            ++index;
+            settle_forward();
+        }
+
+        /// Moves to the previous entry in key order.
+        void prev() {
+            while (index == 0) {
+                if (!(leaf()->flags & Node::kHasLowKey)) {
+                    release();
+                    return;
+                }
+                // The previous leaf ends at the low key of this one. It is
+                // usually the left sibling, unless that was split or merged
+                // since its id was read.
+                KeyT low_key = leaf()->low_key;
+                uint64_t left_page_id = leaf()->left_sibling;
+                release();
+                seek(low_key, left_page_id);
+                auto [upper, found] = leaf()->lower_bound(low_key);
+                index = upper + found;
+            }
+            --index;
+            if (ComparatorT()(key(), lo)) {
+                release();
+            }
+        }
+
+    private:
+        friend struct BTree;
+
+        BTree &tree;
+
+        /// The range.
+        KeyT lo;
+        KeyT hi;
+
+        /// The current leaf.
+        uint64_t page_id = 0;
+        BufferFrame *frame = nullptr;
+
+        /// The index of the current entry in the leaf.
+        uint32_t index = 0;
+
+        /// Forward scans read the next leaves ahead again when they reach a
+        /// leaf above this key, see `prefetch_leaves()`. Unset when all
+        /// leaves of the range were read ahead.
+        std::optional<KeyT> prefetch_boundary;
+
+        Cursor(BTree &tree, const KeyT &lo, const KeyT &hi) : tree(tree), lo(lo), hi(hi) {}
+
+        LeafNode *leaf() const { return reinterpret_cast<LeafNode *>(frame->get_data()); }
+
+        /// Replaces the current leaf with `new_page_id`. The current leaf is
+        /// unfixed first, as latches must not be coupled to the left.
+        void fix(uint64_t new_page_id) {
+            release();
+            frame = &tree.buffer_manager.fix_page(new_page_id, false);
+            page_id = new_page_id;
+        }
+
+        /// Moves to the right sibling of the current leaf. The sibling is
+        /// fixed before the current leaf is released, so it cannot be merged
+        /// into the current leaf in between.
+        void move_right() {
+            uint64_t right_page_id = leaf()->right_sibling;
+            BufferFrame &right_frame = tree.buffer_manager.fix_page(right_page_id, false);
+            release();
+            frame = &right_frame;
+            page_id = right_page_id;
+            if (prefetch_boundary && (leaf()->flags & Node::kHasLowKey) &&
+                !ComparatorT()(leaf()->low_key, *prefetch_boundary)) {
+                prefetch_boundary = tree.prefetch_leaves(leaf()->low_key, hi);
+            }
+        }
+
+        /// Unfixes the current leaf and invalidates the cursor.
+        void release() {
+            if (frame) {
+                tree.buffer_manager.unfix_page(*std::exchange(frame, nullptr), false);
+            }
+        }
+
+        /// Fixes the leaf that covers `key`.
+        /// @param[in] key          The key that should be covered.
+        /// @param[in] hint_page_id A leaf to start at, which may be stale,
+        ///                         or 0 to search from the root.
+        /// @return                 False for an empty tree.
+        bool seek(const KeyT &key, uint64_t hint_page_id = 0) {
+            uint64_t leaf_page_id = hint_page_id;
+            while (true) {
+                if (leaf_page_id == 0 && (leaf_page_id = tree.find_leaf_node(key)) == 0) {
+                    return false;
+                }
+                fix(leaf_page_id);
+                while (leaf()->is_leaf() && !leaf()->follows(key) && !leaf()->covers(key)) {
+                    move_right();
+                }
+                if (leaf()->is_leaf() && !leaf()->follows(key)) {
+                    return true;
+                }
+                // The page was deleted or reused since its id was read.
+                release();
+                leaf_page_id = 0;
+            }
+        }
+
+        /// Moves forward from `index` to the first existing entry, skipping
+        /// to the following leaves when needed, and checks the upper bound.
+        void settle_forward() {
+            while (index >= leaf()->count) {
+                if (leaf()->right_sibling == 0) {
+                    release();
+                    return;
+                }
+                move_right();
+                index = 0;
+            }
+            if (!ComparatorT()(key(), hi)) {
+                release();
+            }
         }
     };
 
-    /// The root.
+    /// The root. It is created by the first insert and keeps its page id from
+    /// then on; a root split moves the root entries into two new children.
     std::optional<uint64_t> root;
 
-    /// Next page id.
-    /// You don't need to worry about about the page allocation.
-    /// Just increment the next_page_id whenever you need a new page.
-    uint64_t next_page_id;
+    /// The metadata of the tree in the segment header.
+    struct Metadata {
+        /// The page id of the root, 0 for an empty tree.
+        uint64_t root_page_id;
+        /// The number of levels, 0 for an empty tree.
+        uint16_t height;
+    };
 
-    /// Constructor.
+    /// Constructor. Attaches to the tree that is stored in the segment, if
+    /// any, which only reads the segment header.
     BTree(uint16_t segment_id, BufferManager &buffer_manager)
         : Segment(segment_id, buffer_manager) {
-        // TODO
-        next_page_id = 1;
+        Metadata metadata = get_metadata();
+        if (metadata.root_page_id != 0) {
+            root = metadata.root_page_id;
+            has_root.store(true, std::memory_order_release);
+        }
     }
 
-    uint64_t find_leaf_node(const KeyT &key){
-        //  start with the root node 
-        uint64_t current_page_id = root.value_or(0);
+    /// Returns the page id of the root, 0 for an empty tree.
+    uint64_t get_root() const {
+        return has_root.load(std::memory_order_acquire) ? *root : 0;
+    }
 
-        while ( current_page_id != 0 ) {
-            BufferFrame &frame = buffer_manager.fix_page(current_page_id, false);
-            Node *current_node = (Node *) frame.get_data();
+    /// Returns the stored metadata of the tree.
+    Metadata get_metadata() {
+        Metadata metadata;
+        read_metadata(&metadata, sizeof(metadata));
+        return metadata;
+    }
 
-            // we've extracted a node, now we need to determine if it's a leaf or not 
-            if (current_node->is_leaf() ) {
-                // found a leaf!  Now we gotta do binary search to find the key 
-                buffer_manager.unfix_page(frame, false);
-                break; 
-            } else {
-                InnerNode *inner_node = (InnerNode *) current_node;
-                auto [index, found] = inner_node->lower_bound(key); 
-                if (found)
-                    current_page_id = inner_node->children[index];
-                else
-                    current_page_id = (index > 0) ? inner_node->children[index-1] : 0 ;
+    /// The shape of the tree and counters of the operations on it since it
+    /// was opened, see `get_stats()`.
+    struct Stats {
+        /// The number of buckets of a fill histogram. Bucket i counts the
+        /// nodes that use [i, i + 1) tenths of their capacity, the last one
+        /// also the full nodes.
+        static constexpr size_t kFillBucketCount = 10;
+
+        /// Are the node counts and the fill estimated from a sample?
+        bool is_sampled = false;
+        /// The number of levels, 0 for an empty tree.
+        uint16_t height = 0;
+        /// The number of nodes per level, leaves first.
+        std::vector<uint64_t> level_node_counts;
+        /// The fill histograms of the leaves and of the inner nodes.
+        std::array<uint64_t, kFillBucketCount> leaf_fill = {};
+        std::array<uint64_t, kFillBucketCount> inner_fill = {};
+        /// The average share of their capacity that the leaves and the inner
+        /// nodes use, in [0, 1].
+        double leaf_fill_factor = 0;
+        double inner_fill_factor = 0;
+
+        /// Splits of leaves and of inner nodes, including those of the root.
+        uint64_t leaf_splits = 0;
+        uint64_t inner_splits = 0;
+        /// Leaves and inner nodes that were merged into their left sibling.
+        uint64_t leaf_merges = 0;
+        uint64_t inner_merges = 0;
+        /// Descents from the root to a leaf.
+        uint64_t traversals = 0;
+        /// Descents that started over as a node changed under them.
+        uint64_t traversal_restarts = 0;
+    };
+
+    /// How `get_stats()` finds the nodes that it describes.
+    enum StatsMode {
+        /// Follows `kStatsSampleCount` random paths from the root to a leaf,
+        /// reading the nodes optimistically, and estimates the node counts
+        /// and the fill from the nodes on them. Cheap enough for a tree in
+        /// use.
+        SAMPLED,
+        /// Visits every node, level by level along the sibling links. Exact
+        /// if the tree does not change meanwhile.
+        FULL
+    };
+
+    /// The number of paths that `SAMPLED` statistics follow.
+    static constexpr size_t kStatsSampleCount = 64;
+
+    /// Returns the statistics of the tree.
+    /// @param[in] mode     How the nodes are found.
+    Stats get_stats(StatsMode mode = SAMPLED) {
+        Stats stats;
+        stats.is_sampled = mode == SAMPLED;
+        stats.leaf_splits = counters.get(LEAF_SPLITS);
+        stats.inner_splits = counters.get(INNER_SPLITS);
+        stats.leaf_merges = counters.get(LEAF_MERGES);
+        stats.inner_merges = counters.get(INNER_MERGES);
+        stats.traversals = counters.get(TRAVERSALS);
+        stats.traversal_restarts = counters.get(TRAVERSAL_RESTARTS);
+        uint64_t root_page_id = get_root();
+        if (root_page_id == 0) {
+            return stats;
+        }
+
+        StatsBuilder builder;
+        if (mode == SAMPLED) {
+            sample_nodes(root_page_id, builder);
+        } else {
+            walk_nodes(root_page_id, builder);
+        }
+        builder.finish(stats);
+        return stats;
+    }
+
+    /// Starts an optimistic read of a page. Pages that are not resident are
+    /// loaded first, pages that are exclusively latched are waited for.
+    OptimisticRead read_optimistic(uint64_t page_id) {
+        OptimisticRead read;
+        read.page_id = page_id;
+        while (!(read.frame = buffer_manager.peek_page(page_id, read.version))) {
+            BufferFrame &frame = buffer_manager.fix_page(page_id, false);
+            buffer_manager.unfix_page(frame, false);
+        }
+        return read;
+    }
+
+    /// Prefetches the header and the middle of the key array of a node that
+    /// is read optimistically, which are the first cache lines a search
+    /// touches. The node type is not known yet, so both layouts are covered.
+    static void prefetch_node(const OptimisticRead &read) {
+        const char *data = read.frame->get_data();
+        __builtin_prefetch(data);
+        __builtin_prefetch(&reinterpret_cast<const InnerNode *>(data)->keys[InnerNode::kCapacity / 2]);
+        __builtin_prefetch(&reinterpret_cast<const LeafNode *>(data)->keys[LeafNode::kCapacity / 2]);
+    }
+
+    /// Descends optimistically from the root to the leaf that covers `key`.
+    /// Nothing is fixed or latched on the way. A child pointer is only
+    /// followed once its node was validated; a child that was split after
+    /// that is handled by following its right sibling links, so concurrent
+    /// splits do not force a restart.
+    /// @param[in]  key     The key that should be searched.
+    /// @param[out] leaf    The leaf, not validated yet. Its page id is 0 for
+    ///                     an empty tree.
+    /// @param[out] path    If given, receives the page ids of the inner nodes
+    ///                     that were passed, indexed by level.
+    /// @param[in]  may_fix If false, nodes that are not resident end the
+    ///                     descent instead of being loaded, so it never waits
+    ///                     for a latch and may run while latches are held.
+    /// @return             False if a concurrent change forces a restart, or
+    ///                     a node was not resident.
+    bool descend(const KeyT &key, OptimisticRead &leaf, std::vector<uint64_t> *path = nullptr,
+                 bool may_fix = true) {
+        OptimisticRead node;
+        uint64_t root_page_id = get_root();
+        if (root_page_id == 0) {
+            leaf = node;
+            return true;
+        }
+        counters.add(TRAVERSALS);
+        auto restart = [&] {
+            counters.add(TRAVERSAL_RESTARTS);
+            return false;
+        };
+
+        auto read = [&](uint64_t page_id) {
+            if (may_fix) {
+                node = read_optimistic(page_id);
+                return true;
+            }
+            node.page_id = page_id;
+            node.frame = buffer_manager.peek_page(page_id, node.version);
+            return node.frame != nullptr;
+        };
+        if (!read(root_page_id)) {
+            return false;
+        }
+        while (true) {
+            Node *current = node.node();
+            if (current->follows(key)) {
+                return restart();
+            }
+            if (!current->covers(key)) {
+                uint64_t right_page_id = current->right_sibling;
+                if (!node.validate()) {
+                    return restart();
+                }
+                if (!read(right_page_id)) {
+                    return false;
+                }
+                continue;
+            }
+            if (current->is_leaf()) {
+                break;
+            }
+
+            auto *inner_node = static_cast<InnerNode *>(current);
+            uint16_t level = inner_node->level;
+            uint64_t child_page_id = inner_node->children[inner_node->lower_bound(key).first];
+            if (!node.validate()) {
+                return restart();
+            }
+            if (path) {
+                if (path->size() <= level) {
+                    path->resize(level + 1);
+                }
+                (*path)[level] = node.page_id;
+            }
+            if (!read(child_page_id)) {
+                return false;
             }
         }
+        leaf = node;
+        return true;
+    }
 
-        return current_page_id;
+    /// Returns the page id of the leaf that covers `key`, 0 for an empty tree.
+    /// @param[in] key      The key that should be searched.
+    uint64_t find_leaf_node(const KeyT &key) {
+        while (true) {
+            OptimisticRead leaf;
+            if (descend(key, leaf) && (leaf.page_id == 0 || leaf.validate())) {
+                return leaf.page_id;
+            }
+        }
     }
 
     /// Lookup an entry in the tree.
+    /// Does not write to shared memory unless a page has to be loaded.
     /// @param[in] key      The key that should be searched.
     std::optional<ValueT> lookup(const KeyT &key) {
-  
-        uint64_t current_page_id = find_leaf_node(key);
-
-        // here leaf should either be found or id is invalid 
-        if (current_page_id != 0){
-            BufferFrame &frame = buffer_manager.fix_page(current_page_id, false) ; 
-            LeafNode *leaf_node = (LeafNode *) frame.get_data() ; 
-
-            // Binary search 
-            int low = 0, high = leaf_node->count - 1;
-            while (low <= high ) {
-                int mid = low + (high - low)/ 2; 
-                if (leaf_node->keys[mid] == key) {
-                    buffer_manager.unfix_page(frame, false);
-                    return leaf_node->values[mid];  
+        while (true) {
+            OptimisticRead leaf;
+            if (!descend(key, leaf)) {
+                continue;
+            }
+            if (leaf.page_id == 0) {
+                return std::nullopt;
+            }
+
+            auto *leaf_node = static_cast<LeafNode *>(leaf.node());
+            auto [index, found] = leaf_node->lower_bound(key);
+            std::optional<ValueT> result;
+            if (found) {
+                result = leaf_node->values[index];
+            }
+            if (leaf.validate()) {
+                return result;
+            }
+        }
+    }
+
+    /// The number of lookups that `lookup_many()` interleaves.
+    static constexpr size_t kLookupGroupSize = 16;
+
+    /// Looks up many keys at once. Instead of one descent after another, a
+    /// group of lookups advances through the tree in lockstep, one node per
+    /// lookup and round. Each round prefetches the next nodes of all lookups,
+    /// from disk if they are not resident and into the cache, so the misses
+    /// of the group overlap instead of stalling one at a time.
+    /// @param[in] keys     The keys that should be searched.
+    /// @param[in] count    The number of keys.
+    /// @param[out] results Receives the result of each key, like `lookup()`.
+    void lookup_many(const KeyT *keys, size_t count, std::optional<ValueT> *results) {
+        uint64_t root_page_id = get_root();
+        if (root_page_id == 0) {
+            std::fill(results, results + count, std::nullopt);
+            return;
+        }
+
+        struct Probe {
+            /// The node to visit next.
+            OptimisticRead node;
+
+            /// The page id of the node after `node`.
+            uint64_t next_page_id;
+
+            /// Has the lookup finished?
+            bool done;
+        };
+        Probe probes[kLookupGroupSize];
+        for (size_t group = 0; group < count; group += kLookupGroupSize) {
+            size_t group_size = std::min(kLookupGroupSize, count - group);
+            for (size_t i = 0; i < group_size; ++i) {
+                probes[i].node = read_optimistic(root_page_id);
+                probes[i].done = false;
+            }
+            counters.add(TRAVERSALS, group_size);
+
+            size_t active = group_size;
+            while (active > 0) {
+                for (size_t i = 0; i < group_size; ++i) {
+                    Probe &probe = probes[i];
+                    if (probe.done) {
+                        continue;
+                    }
+                    std::optional<uint64_t> next_page_id;
+                    const KeyT &key = keys[group + i];
+                    Node *current = probe.node.node();
+                    if (current->follows(key)) {
+                        // Reached through a stale page id, restart below.
+                    } else if (!current->covers(key)) {
+                        next_page_id = current->right_sibling;
+                    } else if (current->is_leaf()) {
+                        auto *leaf_node = static_cast<LeafNode *>(current);
+                        auto [index, found] = leaf_node->lower_bound(key);
+                        std::optional<ValueT> result;
+                        if (found) {
+                            result = leaf_node->values[index];
+                        }
+                        if (probe.node.validate()) {
+                            results[group + i] = result;
+                            probe.done = true;
+                            --active;
+                            continue;
+                        }
+                    } else {
+                        auto *inner_node = static_cast<InnerNode *>(current);
+                        next_page_id = inner_node->children[inner_node->lower_bound(key).first];
+                    }
+
+                    // The node changed under the probe or is not on its path:
+                    // restart it at the root.
+                    if (!next_page_id || !probe.node.validate()) {
+                        next_page_id = root_page_id;
+                        counters.add(TRAVERSAL_RESTARTS);
+                    }
+                    probe.next_page_id = *next_page_id;
                 }
-                else if (leaf_node->keys[mid] < key){
-                    low = mid + 1;
+
+                // Nodes that are not resident are loaded together, so their
+                // reads overlap like the cache misses.
+                uint64_t missing_page_ids[kLookupGroupSize];
+                size_t missing_count = 0;
+                for (size_t i = 0; i < group_size; ++i) {
+                    Probe &probe = probes[i];
+                    if (probe.done) {
+                        continue;
+                    }
+                    probe.node.page_id = probe.next_page_id;
+                    probe.node.frame = buffer_manager.peek_page(probe.next_page_id, probe.node.version);
+                    if (probe.node.frame) {
+                        prefetch_node(probe.node);
+                    } else {
+                        missing_page_ids[missing_count++] = probe.next_page_id;
+                    }
                 }
-                else {
-                    high = mid - 1;
+                if (missing_count > 0) {
+                    buffer_manager.prefetch(missing_page_ids, missing_count);
+                    for (size_t i = 0; i < group_size; ++i) {
+                        if (!probes[i].done && !probes[i].node.frame) {
+                            probes[i].node = read_optimistic(probes[i].next_page_id);
+                        }
+                    }
                 }
             }
-            buffer_manager.unfix_page(frame, false);
         }
+    }
 
-        // means that the key wasn't found!!!  
-        return std::optional<ValueT>();
+    /// The number of leaves that forward scans read ahead.
+    static constexpr uint32_t kScanPrefetchCount = 16;
+
+    /// Starts loading the leaves that follow the one that covers `key`, up
+    /// to `kScanPrefetchCount` of them and up to the one that covers `hi`.
+    /// Their page ids are taken from the parent of the leaf, which is read
+    /// optimistically. Scans call this while they hold a leaf, so only
+    /// resident nodes are read, and nothing is loaded if one is missing or
+    /// changes.
+    /// @return             The largest key of the middle one of the leaves,
+    ///                     at which the next leaves should be read ahead;
+    ///                     `key` to try again at the next leaf if nothing
+    ///                     was loaded; or nothing if no leaf after them
+    ///                     covers keys below `hi`.
+    std::optional<KeyT> prefetch_leaves(const KeyT &key, const KeyT &hi) {
+        std::vector<uint64_t> path;
+        OptimisticRead leaf;
+        if (!descend(key, leaf, &path, false)) {
+            return key;
+        }
+        if (path.size() < 2) {
+            // A tree with a single leaf.
+            return std::nullopt;
+        }
+        OptimisticRead parent;
+        parent.page_id = path[1];
+        if (!(parent.frame = buffer_manager.peek_page(parent.page_id, parent.version))) {
+            return key;
+        }
+        auto *parent_node = static_cast<InnerNode *>(parent.node());
+        if (parent_node->level != 1 || parent_node->follows(key) || !parent_node->covers(key)) {
+            // The parent changed since it was passed.
+            return key;
+        }
+        uint32_t count = std::clamp<uint32_t>(parent_node->count, 1, InnerNode::kCapacity);
+        uint32_t begin = parent_node->lower_bound(key).first + 1;
+        uint32_t last = parent_node->lower_bound(hi).first;
+        uint32_t end = std::min({count, begin + kScanPrefetchCount, last + 1});
+        uint64_t page_ids[kScanPrefetchCount];
+        uint32_t page_count = 0;
+        for (uint32_t i = begin; i < end; ++i) {
+            page_ids[page_count++] = parent_node->children[i];
+        }
+        // More leaves follow if the range goes on behind the last one, in
+        // this node or in its right sibling.
+        bool has_more = end <= last || (end == count && !parent_node->covers(hi));
+        std::optional<KeyT> boundary;
+        if (has_more) {
+            uint32_t middle = begin < end ? begin + (end - begin - 1) / 2 : begin - 1;
+            boundary = middle + 1 < count ? parent_node->keys[middle] : parent_node->high_key;
+        }
+        if (!parent.validate()) {
+            return key;
+        }
+        buffer_manager.prefetch(page_ids, page_count);
+        return boundary;
+    }
 
+    /// Returns a cursor on the smallest entry of the range [lo, hi). The
+    /// cursor descends once and then walks the leaves along their links,
+    /// reading the next leaves ahead.
+    /// @param[in] lo       The inclusive lower bound.
+    /// @param[in] hi       The exclusive upper bound.
+    Cursor scan(const KeyT &lo, const KeyT &hi) {
+        Cursor cursor{*this, lo, hi};
+        if (cursor.seek(lo)) {
+            cursor.prefetch_boundary = prefetch_leaves(lo, hi);
+            cursor.index = cursor.leaf()->lower_bound(lo).first;
+            cursor.settle_forward();
+        }
+        return cursor;
+    }
+
+    /// Returns a cursor on the largest entry of the range [lo, hi), for
+    /// scanning it backwards with `Cursor::prev()`.
+    /// @param[in] lo       The inclusive lower bound.
+    /// @param[in] hi       The exclusive upper bound.
+    Cursor scan_reverse(const KeyT &lo, const KeyT &hi) {
+        Cursor cursor{*this, lo, hi};
+        if (cursor.seek(hi)) {
+            cursor.index = cursor.leaf()->lower_bound(hi).first;
+            cursor.prev();
+        }
+        return cursor;
     }
 
     /// Erase an entry in the tree.
+    /// A leaf that falls below `LeafNode::kMinCount` entries is merged with
+    /// or refilled from a sibling afterwards, see `rebalance()`.
     /// @param[in] key      The key that should be searched.
     void erase(const KeyT &key) {
-        // first we gotta find the leaf node 
-        uint64_t leaf_page_id = find_leaf_node(key);
+        std::vector<uint64_t> path;
+        OptimisticRead leaf;
+        while (!descend(key, leaf, &path)) {
+        }
+        if (leaf.page_id == 0) {
+            return;
+        }
 
-        BufferFrame &frame = buffer_manager.fix_page(leaf_page_id, false) ; 
-        LeafNode *leaf_node = (LeafNode *) frame.get_data(); 
-        leaf_node->erase(key);
+        uint64_t page_id = leaf.page_id;
+        BufferFrame &frame = fix_covering(page_id, key, 0);
+        auto *leaf_node = reinterpret_cast<LeafNode *>(frame.get_data());
+        bool found = leaf_node->lower_bound(key).second;
+        if (found) {
+            leaf_node->erase(key);
+        }
+        bool underflow = found && leaf_node->count < LeafNode::kMinCount && page_id != *root;
+        buffer_manager.unfix_page(frame, found);
+        if (underflow) {
+            rebalance(path, 0, key);
+        }
     }
 
     /// Inserts a new entry into the tree.
+    /// A full leaf is split and the separator is then added to the parent,
+    /// one level at a time. Only the node that is split and its new right
+    /// sibling are latched during a split; the child is released before the
+    /// parent is latched.
     /// @param[in] key      The key that should be inserted.
     /// @param[in] value    The value that should be inserted.
     void insert(const KeyT &key, const ValueT &value) {
-        // TODO
-	    // new root
-	    if (!root.has_value()) {
-	      BufferFrame &frame = buffer_manager.fix_page(
-		  buffer_manager.get_overall_page_id(segment_id, next_page_id), true);
+        if (!has_root.load(std::memory_order_acquire)) {
+            create_root();
+        }
 
-	      auto *root_node = new (frame.get_data()) LeafNode();
-	      root_node->insert(key, value);
+        while (true) {
+            std::vector<uint64_t> path;
+            OptimisticRead leaf;
+            if (!descend(key, leaf, &path)) {
+                continue;
+            }
 
-	      buffer_manager.unfix_page(frame, true);
-	      next_page_id++;
-	      return;
-	    }
+            uint64_t page_id = leaf.page_id;
+            FixGuard frame{buffer_manager, fix_covering(page_id, key, 0)};
+            auto *leaf_node = reinterpret_cast<LeafNode *>(frame->get_data());
+            if (leaf_node->lower_bound(key).second || leaf_node->count < LeafNode::kCapacity) {
+                leaf_node->insert(key, value);
+                frame.unfix(true);
+                return;
+            }
+            if (page_id == *root) {
+                // The root keeps its page, so it is split in place. Retry
+                // with the new children.
+                BufferManager::AtomicChange change{buffer_manager};
+                split_root(*frame);
+                frame.unfix(true);
+                continue;
+            }
 
-        uint64_t current_page_id = find_leaf_node(key);
-        Node *parent_node = NULL;
-        uint64_t parent_page_id = 0;
+            uint64_t right_page_id;
+            KeyT split_key;
+            {
+                BufferManager::AtomicChange change{buffer_manager};
+                right_page_id = allocate_page();
+                FixGuard right_frame{buffer_manager, buffer_manager.fix_page(right_page_id, true)};
+                std::optional<FixGuard> next_frame;
+                if (leaf_node->right_sibling != 0) {
+                    // Latches are taken left to right, like in fix_covering().
+                    next_frame.emplace(buffer_manager, buffer_manager.fix_page(leaf_node->right_sibling, true));
+                }
 
-        // here leaf should either be found or id is invalid 
-        if (current_page_id != 0){
-            BufferFrame &leaf_frame = buffer_manager.fix_page(current_page_id, true) ; 
-            LeafNode *leaf_node = (LeafNode *) leaf_frame.get_data() ; 
+                auto *right_leaf_node = reinterpret_cast<LeafNode *>(right_frame->get_data());
+                split_key = leaf_node->split(reinterpret_cast<std::byte *>(right_leaf_node), right_page_id);
+                (ComparatorT()(split_key, key) ? right_leaf_node : leaf_node)->insert(key, value);
+                right_leaf_node->left_sibling = page_id;
+                if (next_frame) {
+                    reinterpret_cast<LeafNode *>((*next_frame)->get_data())->left_sibling = right_page_id;
+                    next_frame->unfix(true);
+                }
+                right_frame.unfix(true);
+                frame.unfix(true);
+            }
+            counters.add(LEAF_SPLITS);
 
-            KeyT split_key;
-            LeafNode* new_leaf_node = NULL;
+            insert_separator(path, 1, split_key, right_page_id);
+            return;
+        }
+    }
 
-            if (leaf_node->count < LeafNode::kCapacity ){
-                leaf_node->insert(key, value);
+    /// Inserts a batch of entries. The batch is sorted and each leaf it
+    /// touches is descended to once: all entries that belong into the leaf
+    /// are merged into it in one pass, and if they do not fit, the leaf is
+    /// split into as many leaves as needed at once. An existing key gets its
+    /// value overwritten; of repeated keys in the batch, the last one wins.
+    /// @param[in] begin    The first entry, a pair of key and value. The
+    ///                     entries are sorted in place.
+    /// @param[in] end      The end of the entries.
+    template <typename RandomIt>
+    void insert_batch(RandomIt begin, RandomIt end) {
+        if (begin == end) {
+            return;
+        }
+        std::stable_sort(begin, end, [](const auto &a, const auto &b) {
+            return ComparatorT()(a.first, b.first);
+        });
+        if (!has_root.load(std::memory_order_acquire)) {
+            create_root();
+        }
+
+        std::vector<uint64_t> path;
+        while (begin != end) {
+            const KeyT &key = begin->first;
+            OptimisticRead leaf;
+            path.clear();
+            if (!descend(key, leaf, &path)) {
+                continue;
+            }
+
+            uint64_t page_id = leaf.page_id;
+            FixGuard frame{buffer_manager, fix_covering(page_id, key, 0)};
+            auto *leaf_node = reinterpret_cast<LeafNode *>(frame->get_data());
+            RandomIt run_end = end;
+            if (leaf_node->right_sibling != 0) {
+                run_end = std::upper_bound(begin, end, leaf_node->high_key, [](const KeyT &k, const auto &entry) {
+                    return ComparatorT()(k, entry.first);
+                });
             }
-            else {
-                BufferFrame &new_leaf_frame = buffer_manager.fix_page(buffer_manager.get_overall_page_id(segment_id, next_page_id), true) ;
-                new_leaf_node = new ( new_leaf_frame.get_data()) LeafNode();
-                split_key = leaf_node->split((std::byte *)(new_leaf_node));
-                buffer_manager.unfix_page(new_leaf_frame, true);
-                next_page_id++;
+            uint32_t total = leaf_node->count + leaf_node->count_new(begin, run_end);
+            if (total <= LeafNode::kCapacity) {
+                leaf_node->merge(begin, run_end, total, leaf_node->keys, leaf_node->values);
+                leaf_node->count = total;
+                frame.unfix(true);
+                begin = run_end;
+                continue;
+            }
+            if (page_id == *root) {
+                // The root may be too small to split in half, so its entries
+                // move into a new child, which is then split like any leaf.
+                BufferManager::AtomicChange change{buffer_manager};
+                push_down_root(*frame);
+                frame.unfix(true);
+                continue;
             }
 
-            buffer_manager.unfix_page(leaf_frame, true);
+            std::vector<std::pair<KeyT, uint64_t>> separators;
+            {
+                BufferManager::AtomicChange change{buffer_manager};
+                separators = split_merge(frame, page_id, begin, run_end, total);
+            }
+            for (auto &[split_key, right_page_id] : separators) {
+                insert_separator(path, 1, split_key, right_page_id);
+            }
+            begin = run_end;
+        }
+    }
+
+    /// Builds the tree from sorted entries in one pass. Leaves are packed to
+    /// `fill_factor` of their capacity and the inner levels are built bottom-up
+    /// while the leaves are written, so every page is written exactly once.
+    /// The tree must be empty, and the keys must be strictly increasing.
+    /// @param[in] begin        The first entry, a pair of key and value.
+    /// @param[in] end          The end of the entries.
+    /// @param[in] fill_factor  The fraction of each node that is filled, in
+    ///                         (0, 1]. Room is left for later inserts.
+    /// @throws std::logic_error If the tree already has a root.
+    template <typename InputIt>
+    void bulk_load(InputIt begin, InputIt end, double fill_factor = 0.9) {
+        if (has_root.load(std::memory_order_acquire)) {
+            throw std::logic_error("bulk_load() requires an empty tree");
+        }
+        assert(fill_factor > 0 && fill_factor <= 1);
+        if (begin == end) {
+            return;
+        }
+
+        BulkLoader loader{*this, fill_factor};
+        for (; begin != end; ++begin) {
+            const auto &[key, value] = *begin;
+            loader.add(key, value);
+        }
+        uint64_t root_page_id = loader.finish();
+
+        std::unique_lock lock{root_latch};
+        if (has_root.load(std::memory_order_relaxed)) {
+            // A concurrent insert created a root. The loaded pages are lost,
+            // but the entries of the tree are kept.
+            throw std::logic_error("bulk_load() requires an empty tree");
+        }
+        root = root_page_id;
+        store_metadata(static_cast<uint16_t>(loader.levels.size()));
+        has_root.store(true, std::memory_order_release);
+    }
 
-            // now handle the node splits and propagate it up the tree 
-            while (parent_node != NULL && parent_node->count == InnerNode::kCapacity ) {
-                BufferFrame &parent_frame = buffer_manager.fix_page(parent_page_id, true);
-                InnerNode * new_inner_node;
+private:
+    /// Serializes the creation of the root.
+    std::mutex root_latch;
+
+    /// The operations that are counted, see `Stats`.
+    enum Counter {
+        LEAF_SPLITS,
+        INNER_SPLITS,
+        LEAF_MERGES,
+        INNER_MERGES,
+        TRAVERSALS,
+        TRAVERSAL_RESTARTS,
+        COUNTER_COUNT
+    };
 
-                BufferFrame &new_inner_frame = buffer_manager.fix_page(buffer_manager.get_overall_page_id(segment_id, next_page_id), true) ;
-                new_inner_node = new (new_inner_frame.get_data()) InnerNode();
-                KeyT new_split_key = ((InnerNode *) parent_node)->split((std::byte *) new_inner_node); 
+    /// The operation counters, summed up by `get_stats()`.
+    ThreadCounters<COUNTER_COUNT> counters;
+
+    /// Sums up the nodes that `get_stats()` finds, each with a weight: the
+    /// number of nodes of the tree that it stands for.
+    struct StatsBuilder {
+        std::vector<double> level_node_counts;
+        std::array<double, Stats::kFillBucketCount> leaf_fill = {};
+        std::array<double, Stats::kFillBucketCount> inner_fill = {};
+        /// The sums of the weighted shares of the capacity.
+        double leaf_fill_sum = 0;
+        double inner_fill_sum = 0;
+
+        /// Adds a node on `level` with `count` entries or children.
+        void add(uint16_t level, uint32_t count, double weight) {
+            if (level_node_counts.size() <= level) {
+                level_node_counts.resize(level + 1);
+            }
+            level_node_counts[level] += weight;
+            bool is_leaf = level == 0;
+            uint32_t capacity = is_leaf ? LeafNode::kCapacity : InnerNode::kCapacity;
+            size_t bucket = std::min<size_t>(count * Stats::kFillBucketCount / capacity, Stats::kFillBucketCount - 1);
+            (is_leaf ? leaf_fill : inner_fill)[bucket] += weight;
+            (is_leaf ? leaf_fill_sum : inner_fill_sum) += weight * count / capacity;
+        }
 
-		// Insert the separator key into the parent node  *MarcAdd*
-	        if (parent_node->parent) {
-		    parent_node->parent->insert(split_key, next_page_id);
-	        }
+        /// Rounds the sums into `stats`.
+        void finish(Stats &stats) const {
+            stats.height = level_node_counts.size();
+            for (double node_count : level_node_counts) {
+                stats.level_node_counts.push_back(std::llround(node_count));
+            }
+            double leaf_count = 0;
+            double inner_count = 0;
+            for (size_t i = 0; i < Stats::kFillBucketCount; ++i) {
+                stats.leaf_fill[i] = std::llround(leaf_fill[i]);
+                stats.inner_fill[i] = std::llround(inner_fill[i]);
+                leaf_count += leaf_fill[i];
+                inner_count += inner_fill[i];
+            }
+            stats.leaf_fill_factor = leaf_count > 0 ? leaf_fill_sum / leaf_count : 0;
+            stats.inner_fill_factor = inner_count > 0 ? inner_fill_sum / inner_count : 0;
+        }
+    };
 
-                // now unfix the new inner and parent frames and then upda new page id var 
-                buffer_manager.unfix_page(new_inner_frame, true);
-                buffer_manager.unfix_page(parent_frame, true);
-                next_page_id++;
+    /// Estimates the nodes of the tree from random paths. A path picks each
+    /// child with the same probability, so a node on it stands for as many
+    /// nodes of its level as the product of the child counts of the nodes
+    /// above it; averaged over the paths, this estimates the number of nodes
+    /// per level and per fill bucket without bias.
+    void sample_nodes(uint64_t root_page_id, StatsBuilder &builder) {
+        std::minstd_rand engine{std::random_device{}()};
+        std::vector<std::pair<uint16_t, uint32_t>> path;
+        for (size_t i = 0; i < kStatsSampleCount; ++i) {
+            while (!sample_path(root_page_id, engine, path)) {
+            }
+            double weight = 1;
+            for (auto [level, count] : path) {
+                builder.add(level, count, weight / kStatsSampleCount);
+                weight *= count;
+            }
+        }
+    }
 
-                parent_node = parent_node->parent ; 
-                split_key = new_split_key;
-                new_leaf_node = NULL;
+    /// Follows a random path from the root to a leaf. Nothing is fixed or
+    /// latched on the way.
+    /// @param[out] path    Receives the level and the count of each node on
+    ///                     the path, the root first.
+    /// @return             False if a node changed under the path.
+    bool sample_path(uint64_t root_page_id, std::minstd_rand &engine,
+                     std::vector<std::pair<uint16_t, uint32_t>> &path) {
+        path.clear();
+        OptimisticRead node = read_optimistic(root_page_id);
+        while (true) {
+            Node *current = node.node();
+            uint16_t level = current->level;
+            bool is_deleted = current->is_deleted();
+            uint32_t count = std::min<uint32_t>(current->count,
+                                                level == 0 ? LeafNode::kCapacity : InnerNode::kCapacity);
+            uint64_t child_page_id = 0;
+            if (level > 0 && count > 0) {
+                auto *inner_node = static_cast<InnerNode *>(current);
+                child_page_id = inner_node->children[std::uniform_int_distribution<uint32_t>(0, count - 1)(engine)];
+            }
+            if (!node.validate()) {
+                return false;
+            }
+            // The page was freed or reused since the parent was read.
+            if (is_deleted || (!path.empty() && level + 1 != path.back().first) || (level > 0 && count == 0)) {
+                return false;
             }
+            path.emplace_back(level, count);
+            if (level == 0) {
+                return true;
+            }
+            node = read_optimistic(child_page_id);
+        }
+    }
 
-            //  Does the root also need to be split??  
-            if (!parent_node) {
-                BufferFrame &new_root_frame = buffer_manager.fix_page(buffer_manager.get_overall_page_id(segment_id, next_page_id), true);
-                InnerNode *new_root_node = new (new_root_frame.get_data()) InnerNode();
-                new_root_node->keys[0] = split_key;
-                new_root_node->children[0] = root.value_or(0) ;
-                new_root_node->children[1] = next_page_id - 1;
-                new_root_node->count = 1;
-                root = next_page_id ;
-                buffer_manager.unfix_page(new_root_frame, true) ;
-                next_page_id++;
+    /// Visits every node, level by level from the root down and each level
+    /// from its leftmost node along the sibling links. The next node is fixed
+    /// before the current one is released, like in `Cursor::move_right()`.
+    void walk_nodes(uint64_t root_page_id, StatsBuilder &builder) {
+        uint64_t first_page_id = root_page_id;
+        while (first_page_id != 0) {
+            BufferFrame *frame = &buffer_manager.fix_page(first_page_id, false);
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            first_page_id = node->is_leaf() ? 0 : static_cast<InnerNode *>(node)->children[0];
+            while (true) {
+                builder.add(node->level, node->count, 1);
+                if (node->right_sibling == 0) {
+                    break;
+                }
+                BufferFrame *right_frame;
+                try {
+                    right_frame = &buffer_manager.fix_page(node->right_sibling, false);
+                } catch (...) {
+                    buffer_manager.unfix_page(*frame, false);
+                    throw;
+                }
+                buffer_manager.unfix_page(*frame, false);
+                frame = right_frame;
+                node = reinterpret_cast<Node *>(frame->get_data());
             }
+            buffer_manager.unfix_page(*frame, false);
         }
-        else {
-            // means that the key wasn't found!!!  
+    }
+
+    /// Is `root` set? `root` is only read after this was seen to be true.
+    std::atomic<bool> has_root = false;
+
+    /// Creates an empty leaf as root unless another thread did so already.
+    void create_root() {
+        std::unique_lock lock{root_latch};
+        if (has_root.load(std::memory_order_relaxed)) {
             return;
         }
+        uint64_t root_page_id = allocate_page();
+        BufferFrame &frame = buffer_manager.fix_page(root_page_id, true);
+        new (frame.get_data()) LeafNode();
+        buffer_manager.unfix_page(frame, true);
+        root = root_page_id;
+        store_metadata(1);
+        has_root.store(true, std::memory_order_release);
+    }
+
+    /// Stores the root and the height in the segment header, so the tree is
+    /// found again when the segment is reopened. The root page id never
+    /// changes, so this is only needed when the height changes, which
+    /// happens with the root exclusively fixed.
+    /// @param[in] height       The number of levels.
+    void store_metadata(uint16_t height) {
+        Metadata metadata{*root, height};
+        write_metadata(&metadata, sizeof(metadata));
+    }
+
+    /// Exclusively fixes the node on `level` whose key range includes `key`.
+    /// Starts at `page_id`, which should be on `level` or, if the tree grew
+    /// since it was looked up, be the root. A start page that was deleted or
+    /// reused since is detected by its low key or level, and the search
+    /// starts over at the root. Latches are coupled to the right and
+    /// downwards only, so writers cannot deadlock.
+    /// @param[in,out] page_id  The start page, receives the page of the node.
+    /// @param[in] key          The key that should be covered.
+    /// @param[in] level        The level of the node. If the tree shrank
+    ///                         below it, the root is returned instead.
+    BufferFrame &fix_covering(uint64_t &page_id, const KeyT &key, uint16_t level) {
+        BufferFrame *frame = &buffer_manager.fix_page(page_id, true);
+        while (true) {
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            if (node->follows(key) || node->level < level) {
+                if (page_id == *root) {
+                    return *frame;
+                }
+                // Latches are never coupled upwards.
+                buffer_manager.unfix_page(*frame, false);
+                page_id = *root;
+                frame = &buffer_manager.fix_page(page_id, true);
+                continue;
+            }
+            uint64_t next_page_id;
+            if (!node->covers(key)) {
+                next_page_id = node->right_sibling;
+            } else if (node->level > level) {
+                auto *inner_node = static_cast<InnerNode *>(node);
+                next_page_id = inner_node->children[inner_node->lower_bound(key).first];
+            } else {
+                assert(node->level == level);
+                return *frame;
+            }
+            BufferFrame *next_frame;
+            try {
+                next_frame = &buffer_manager.fix_page(next_page_id, true);
+            } catch (...) {
+                buffer_manager.unfix_page(*frame, false);
+                throw;
+            }
+            buffer_manager.unfix_page(*frame, false);
+            frame = next_frame;
+            page_id = next_page_id;
+        }
+    }
+
+    /// Returns whether `node` has too few entries or children.
+    static bool underflows(const Node &node) {
+        return node.count < (node.is_leaf() ? LeafNode::kMinCount : InnerNode::kMinCount);
+    }
+
+    /// Merges the node on `level` that covers `key` with an adjacent sibling
+    /// under the same parent, or moves entries between both if they would
+    /// not fit into three quarters of a node. Continues with the parent if
+    /// it underflows after a merge. A root that is left with one child takes
+    /// over the content of the child, so the root keeps its page. Merged
+    /// pages are returned to the segment.
+    /// Latches are taken top-down and left to right: the parent, then both
+    /// siblings. Siblings that are not linked, as the left one was split and
+    /// its parent does not know the new node yet, are left alone.
+    /// @param[in] path     The inner nodes passed during the descent,
+    ///                     indexed by level.
+    /// @param[in] level    The level of the underflowing node.
+    /// @param[in] key      A key in the range of the node.
+    void rebalance(const std::vector<uint64_t> &path, uint16_t level, const KeyT &key) {
+        while (true) {
+            uint16_t parent_level = level + 1;
+            uint64_t parent_page_id = parent_level < path.size() ? path[parent_level] : *root;
+            // The changes of the three nodes are one log record, which ends
+            // before the merged pages are freed.
+            std::optional<BufferManager::AtomicChange> change{std::in_place, buffer_manager};
+            FixGuard parent_frame{buffer_manager, fix_covering(parent_page_id, key, parent_level)};
+            auto *parent = reinterpret_cast<InnerNode *>(parent_frame->get_data());
+            if (parent->level != parent_level || parent->count < 2) {
+                // The tree shrank meanwhile, or there is no sibling.
+                parent_frame.unfix(false);
+                return;
+            }
+
+            uint32_t index = parent->lower_bound(key).first;
+            uint32_t left_index = index + 1 < parent->count ? index : index - 1;
+            uint64_t left_page_id = parent->children[left_index];
+            uint64_t right_page_id = parent->children[left_index + 1];
+            FixGuard left_frame{buffer_manager, buffer_manager.fix_page(left_page_id, true)};
+            FixGuard right_frame{buffer_manager, buffer_manager.fix_page(right_page_id, true)};
+            auto *left = reinterpret_cast<Node *>(left_frame->get_data());
+            auto *right = reinterpret_cast<Node *>(right_frame->get_data());
+
+            bool changed = left->right_sibling == right_page_id && (underflows(*left) || underflows(*right));
+            uint32_t capacity = left->is_leaf() ? LeafNode::kCapacity : InnerNode::kCapacity;
+            bool merged = changed && left->count + right->count <= capacity * 3 / 4;
+            // The root can only take over a child that covers all keys; a
+            // right sibling would be the pending half of a split.
+            bool collapse = merged && parent_page_id == *root && parent->count == 2 && right->right_sibling == 0;
+
+            // Everything that may throw comes before the first change, see
+            // `FixGuard`.
+            std::optional<FixGuard> next_frame;
+            if (merged && left->is_leaf() && right->right_sibling != 0) {
+                // The leaf after both points back to the left one. Latches
+                // are taken left to right, like in fix_covering().
+                next_frame.emplace(buffer_manager, buffer_manager.fix_page(right->right_sibling, true));
+            }
+            if (collapse) {
+                store_metadata(left->level + 1);
+            }
+
+            if (changed) {
+                if (merged) {
+                    counters.add(left->is_leaf() ? LEAF_MERGES : INNER_MERGES);
+                    if (left->is_leaf()) {
+                        static_cast<LeafNode *>(left)->merge(*static_cast<LeafNode *>(right));
+                        if (next_frame) {
+                            reinterpret_cast<LeafNode *>((*next_frame)->get_data())->left_sibling = left_page_id;
+                            next_frame->unfix(true);
+                        }
+                    } else {
+                        static_cast<InnerNode *>(left)->merge(*static_cast<InnerNode *>(right),
+                                                              parent->keys[left_index]);
+                    }
+                    parent->erase(left_index);
+                } else if (left->is_leaf()) {
+                    parent->keys[left_index] = static_cast<LeafNode *>(left)->balance(*static_cast<LeafNode *>(right));
+                } else {
+                    parent->keys[left_index] = static_cast<InnerNode *>(left)->balance(
+                        *static_cast<InnerNode *>(right), parent->keys[left_index]);
+                }
+            }
+
+            if (collapse) {
+                std::memcpy(parent_frame->get_data(), left_frame->get_data(), PageSize);
+                left->flags |= Node::kDeleted;
+            }
+            bool parent_underflows = merged && parent_page_id != *root && underflows(*parent);
+            right_frame.unfix(changed);
+            left_frame.unfix(changed);
+            parent_frame.unfix(changed);
+            change.reset();
+            if (merged) {
+                free_page(right_page_id);
+            }
+            if (collapse) {
+                free_page(left_page_id);
+            }
+            if (!parent_underflows) {
+                return;
+            }
+            level = parent_level;
+        }
+    }
+
+    /// Adds the separator of a split to the parent level, splitting parents
+    /// as needed. Each parent is latched only after its child was released.
+    /// @param[in] path         The inner nodes passed during the descent,
+    ///                         indexed by level.
+    /// @param[in] level        The level of the parent.
+    /// @param[in] split_key    The separator.
+    /// @param[in] right_page_id The new right child.
+    void insert_separator(const std::vector<uint64_t> &path, uint16_t level, KeyT split_key,
+                          uint64_t right_page_id) {
+        while (true) {
+            // The root may have grown above the levels of the path.
+            uint64_t page_id = level < path.size() ? path[level] : *root;
+            FixGuard frame{buffer_manager, fix_covering(page_id, split_key, level)};
+            auto *inner_node = reinterpret_cast<InnerNode *>(frame->get_data());
+            if (inner_node->count < InnerNode::kCapacity) {
+                inner_node->insert(split_key, right_page_id);
+                frame.unfix(true);
+                return;
+            }
+            if (page_id == *root) {
+                BufferManager::AtomicChange change{buffer_manager};
+                split_root(*frame);
+                frame.unfix(true);
+                continue;
+            }
+
+            BufferManager::AtomicChange change{buffer_manager};
+            uint64_t new_page_id = allocate_page();
+            FixGuard new_frame{buffer_manager, buffer_manager.fix_page(new_page_id, true)};
+            auto *new_inner_node = reinterpret_cast<InnerNode *>(new_frame->get_data());
+            KeyT new_split_key = inner_node->split(reinterpret_cast<std::byte *>(new_inner_node), new_page_id);
+            (ComparatorT()(new_split_key, split_key) ? new_inner_node : inner_node)->insert(split_key, right_page_id);
+            new_frame.unfix(true);
+            frame.unfix(true);
+            counters.add(INNER_SPLITS);
+
+            split_key = new_split_key;
+            right_page_id = new_page_id;
+            ++level;
+        }
+    }
+
+    /// Merges the sorted entries [begin, end) into an exclusively fixed leaf
+    /// that cannot hold them and spreads the result evenly over the leaf and
+    /// as many new right siblings as needed. The leaf is unfixed.
+    /// @param[in] frame        The leaf.
+    /// @param[in] page_id      The page id of the leaf.
+    /// @param[in] total        The number of merged entries.
+    /// @return                 The separators and page ids of the new leaves
+    ///                         in key order, for the parent level.
+    template <typename RandomIt>
+    std::vector<std::pair<KeyT, uint64_t>> split_merge(FixGuard &frame, uint64_t page_id, RandomIt begin,
+                                                       RandomIt end, uint32_t total) {
+        auto *leaf_node = reinterpret_cast<LeafNode *>(frame->get_data());
+        std::vector<KeyT> keys(total);
+        std::vector<ValueT> values(total);
+        leaf_node->merge(begin, end, total, keys.data(), values.data());
+
+        // Leaf i gets the entries [total * i / leaf_count, total * (i + 1) / leaf_count).
+        uint32_t leaf_count = (total + LeafNode::kCapacity - 1) / LeafNode::kCapacity;
+        auto bound = [&](uint32_t i) { return static_cast<uint32_t>(static_cast<uint64_t>(total) * i / leaf_count); };
+        std::vector<uint64_t> page_ids(leaf_count);
+        page_ids[0] = page_id;
+        for (uint32_t i = 1; i < leaf_count; ++i) {
+            page_ids[i] = allocate_page();
+        }
+
+        // The new leaves are unreachable until the leaf links to them, so
+        // they are written first, one at a time.
+        std::vector<std::pair<KeyT, uint64_t>> separators;
+        for (uint32_t i = 1; i < leaf_count; ++i) {
+            uint32_t from = bound(i);
+            uint32_t to = bound(i + 1);
+            FixGuard new_frame{buffer_manager, buffer_manager.fix_page(page_ids[i], true)};
+            auto *node = new (new_frame->get_data()) LeafNode();
+            node->set_low_key(keys[from - 1]);
+            node->left_sibling = page_ids[i - 1];
+            if (i + 1 < leaf_count) {
+                node->high_key = keys[to - 1];
+                node->right_sibling = page_ids[i + 1];
+            } else {
+                node->high_key = leaf_node->high_key;
+                node->right_sibling = leaf_node->right_sibling;
+            }
+            std::copy(keys.begin() + from, keys.begin() + to, node->keys);
+            std::copy(values.begin() + from, values.begin() + to, node->values);
+            node->count = to - from;
+            new_frame.unfix(true);
+            separators.emplace_back(keys[from - 1], page_ids[i]);
+        }
+
+        std::optional<FixGuard> next_frame;
+        if (leaf_node->right_sibling != 0) {
+            // Latches are taken left to right, like in fix_covering().
+            next_frame.emplace(buffer_manager, buffer_manager.fix_page(leaf_node->right_sibling, true));
+        }
+
+        uint32_t to = bound(1);
+        std::copy(keys.begin(), keys.begin() + to, leaf_node->keys);
+        std::copy(values.begin(), values.begin() + to, leaf_node->values);
+        leaf_node->count = to;
+        leaf_node->high_key = keys[to - 1];
+        leaf_node->right_sibling = page_ids[1];
+        if (next_frame) {
+            reinterpret_cast<LeafNode *>((*next_frame)->get_data())->left_sibling = page_ids.back();
+            next_frame->unfix(true);
+        }
+        frame.unfix(true);
+        counters.add(LEAF_SPLITS, leaf_count - 1);
+        return separators;
+    }
+
+    /// Builds the levels of a tree bottom-up from sorted entries. Each level
+    /// has one open node. A full node is linked to its successor, unfixed for
+    /// good and added to the level above when the successor is started.
+    struct BulkLoader {
+        struct Level {
+            /// The open node.
+            uint64_t page_id = 0;
+            BufferFrame *frame = nullptr;
+
+            /// The largest key in the open node's subtree.
+            KeyT max_key;
+
+            /// The number of nodes started on this level.
+            uint64_t node_count = 0;
+        };
+
+        BTree &tree;
+
+        /// The number of entries per leaf and children per inner node.
+        uint32_t leaf_fill;
+        uint32_t inner_fill;
+
+        /// The levels, leaves first.
+        std::vector<Level> levels;
+
+        BulkLoader(BTree &tree, double fill_factor)
+            : tree(tree),
+              leaf_fill(std::max<uint32_t>(1, static_cast<uint32_t>(LeafNode::kCapacity * fill_factor))),
+              inner_fill(std::max<uint32_t>(2, static_cast<uint32_t>(InnerNode::kCapacity * fill_factor))) {}
+
+        /// Destructor. Unfixes the open nodes if the load ended by an
+        /// exception; their pages are not part of the tree.
+        ~BulkLoader() {
+            for (Level &level : levels) {
+                if (level.frame) {
+                    tree.buffer_manager.unfix_page(*level.frame, false);
+                }
+            }
+        }
+
+        /// Returns the open node of `level`, starting a new one if it is
+        /// full.
+        Node *open_node(uint16_t level) {
+            if (levels.size() <= level) {
+                levels.resize(level + 1);
+            }
+            if (levels[level].frame) {
+                auto *node = reinterpret_cast<Node *>(levels[level].frame->get_data());
+                if (node->count < (level == 0 ? leaf_fill : inner_fill)) {
+                    return node;
+                }
+            }
+
+            uint64_t page_id = tree.allocate_page();
+            BufferFrame &frame = tree.buffer_manager.fix_page(page_id, true);
+            Node *node;
+            if (level == 0) {
+                auto *leaf_node = new (frame.get_data()) LeafNode();
+                leaf_node->left_sibling = levels[level].page_id;
+                node = leaf_node;
+            } else {
+                node = new (frame.get_data()) InnerNode(level);
+            }
+
+            Level full = levels[level];
+            if (full.frame) {
+                node->set_low_key(full.max_key);
+            }
+            levels[level].page_id = page_id;
+            levels[level].frame = &frame;
+            ++levels[level].node_count;
+            if (full.frame) {
+                auto *full_node = reinterpret_cast<Node *>(full.frame->get_data());
+                full_node->high_key = full.max_key;
+                full_node->right_sibling = page_id;
+                tree.buffer_manager.unfix_page(*full.frame, true);
+                add_child(level + 1, full.page_id, full.max_key);
+            }
+            return node;
+        }
+
+        /// Appends a child to the open node of the inner `level`.
+        void add_child(uint16_t level, uint64_t child_page_id, const KeyT &child_max_key) {
+            auto *inner_node = static_cast<InnerNode *>(open_node(level));
+            if (inner_node->count > 0) {
+                inner_node->keys[inner_node->count - 1] = levels[level].max_key;
+            }
+            inner_node->children[inner_node->count++] = child_page_id;
+            levels[level].max_key = child_max_key;
+        }
+
+        /// Appends an entry to the open leaf.
+        void add(const KeyT &key, const ValueT &value) {
+            auto *leaf_node = static_cast<LeafNode *>(open_node(0));
+            assert((levels[0].node_count == 1 && leaf_node->count == 0) ||
+                   ComparatorT()(levels[0].max_key, key));
+            leaf_node->keys[leaf_node->count] = key;
+            leaf_node->values[leaf_node->count] = value;
+            ++leaf_node->count;
+            levels[0].max_key = key;
+        }
+
+        /// Closes the open nodes bottom-up.
+        /// @return             The page id of the root.
+        uint64_t finish() {
+            for (uint16_t level = 0;; ++level) {
+                Level last = levels[level];
+                tree.buffer_manager.unfix_page(*last.frame, true);
+                levels[level].frame = nullptr;
+                if (last.node_count == 1) {
+                    return last.page_id;
+                }
+                add_child(level + 1, last.page_id, last.max_key);
+            }
+        }
+    };
+
+    /// Moves the entries of the root into a new page, which becomes the only
+    /// child of the root one level higher.
+    /// @param[in] root_frame   The exclusively fixed root.
+    void push_down_root(BufferFrame &root_frame) {
+        auto *root_node = reinterpret_cast<Node *>(root_frame.get_data());
+        uint64_t child_page_id = allocate_page();
+        FixGuard child_frame{buffer_manager, buffer_manager.fix_page(child_page_id, true)};
+        uint16_t level = root_node->level + 1;
+        store_metadata(level + 1);
+
+        std::memcpy(child_frame->get_data(), root_frame.get_data(), PageSize);
+        auto *new_root_node = new (root_frame.get_data()) InnerNode(level);
+        new_root_node->children[0] = child_page_id;
+        new_root_node->count = 1;
+        child_frame.unfix(true);
+    }
+
+    /// Splits the root in place: its entries move into two new children and
+    /// it becomes an inner node one level higher.
+    /// @param[in] root_frame   The exclusively fixed root.
+    void split_root(BufferFrame &root_frame) {
+        auto *root_node = reinterpret_cast<Node *>(root_frame.get_data());
+        uint64_t left_page_id = allocate_page();
+        uint64_t right_page_id = allocate_page();
+        FixGuard left_frame{buffer_manager, buffer_manager.fix_page(left_page_id, true)};
+        FixGuard right_frame{buffer_manager, buffer_manager.fix_page(right_page_id, true)};
+        uint16_t level = root_node->level + 1;
+        store_metadata(level + 1);
+
+        std::memcpy(left_frame->get_data(), root_frame.get_data(), PageSize);
+        auto *left_node = reinterpret_cast<Node *>(left_frame->get_data());
+        auto *right_buffer = reinterpret_cast<std::byte *>(right_frame->get_data());
+        KeyT split_key;
+        if (left_node->is_leaf()) {
+            split_key = static_cast<LeafNode *>(left_node)->split(right_buffer, right_page_id);
+            reinterpret_cast<LeafNode *>(right_buffer)->left_sibling = left_page_id;
+        } else {
+            split_key = static_cast<InnerNode *>(left_node)->split(right_buffer, right_page_id);
+        }
+        auto *new_root_node = new (root_frame.get_data()) InnerNode(level);
+        new_root_node->keys[0] = split_key;
+        new_root_node->children[0] = left_page_id;
+        new_root_node->children[1] = right_page_id;
+        new_root_node->count = 2;
+
+        right_frame.unfix(true);
+        left_frame.unfix(true);
+        counters.add(level == 1 ? LEAF_SPLITS : INNER_SPLITS);
     }
 };
 
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace buzzdb {
+
+/// Searches the sorted key arrays of B-tree nodes. The primary template
+/// works for any key type and comparator. Specializations provide kernels
+/// that compare several keys per instruction. They are compiled for their
+/// instruction set only and picked at run time, so the build does not
+/// require more than the baseline of the target.
+template <typename KeyT, typename ComparatorT>
+struct KeySearch {
+    /// Returns the index of the first of the `count` sorted `keys` that is
+    /// not less than `key`, or `count` if there is none.
+    static uint32_t lower_bound(const KeyT *keys, uint32_t count, const KeyT &key) {
+        return static_cast<uint32_t>(std::lower_bound(keys, keys + count, key, ComparatorT()) - keys);
+    }
+};
+
+#if defined(__x86_64__)
+
+/// Unsigned 64 bit keys in ascending order. A branch-free binary search
+/// narrows the range down to a few vectors, which are then compared with
+/// the key at once, with AVX2 or SSE4.2 if the CPU has it; the number of
+/// smaller keys is the result.
+template <>
+struct KeySearch<uint64_t, std::less<uint64_t>> {
+    /// The number of keys that are compared in the final step. Larger
+    /// windows save search steps on big nodes, but cost small ones.
+    static constexpr uint32_t kWindow = 8;
+
+    static uint32_t lower_bound(const uint64_t *keys, uint32_t count, uint64_t key) {
+        const uint64_t *base = keys;
+        uint32_t n = count;
+        while (n > kWindow) {
+            uint32_t half = n / 2;
+            base = base[half - 1] < key ? base + half : base;
+            n -= half;
+        }
+        return static_cast<uint32_t>(base - keys) + count_less(base, n, key);
+    }
+
+    /// Returns the number of the `n` keys at `keys` that are less than `key`.
+    static uint32_t count_less(const uint64_t *keys, uint32_t n, uint64_t key) {
+#ifdef __AVX2__
+        // Built for CPUs with AVX2, e.g. with -march=native.
+        return count_less_avx2(keys, n, key);
+#else
+        // Reads a flag that the runtime sets at startup.
+        if (__builtin_cpu_supports("avx2")) {
+            return count_less_avx2(keys, n, key);
+        }
+        if (__builtin_cpu_supports("sse4.2")) {
+            return count_less_sse42(keys, n, key);
+        }
+        return count_less_scalar(keys, 0, n, key);
+#endif
+    }
+
+    // The instructions compare signed integers, flipping the sign bit makes
+    // that an unsigned comparison.
+    static constexpr uint64_t kSignBit = 1ull << 63;
+
+    /// `count_less()` with AVX2, 4 keys per instruction.
+    __attribute__((target("avx2"))) static uint32_t count_less_avx2(const uint64_t *keys, uint32_t n,
+                                                                    uint64_t key) {
+        const __m256i sign = _mm256_set1_epi64x(static_cast<int64_t>(kSignBit));
+        const __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<int64_t>(key)), sign);
+        uint32_t less = 0;
+        uint32_t i = 0;
+        for (; i + 4 <= n; i += 4) {
+            __m256i values = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+            __m256i is_less = _mm256_cmpgt_epi64(needle, _mm256_xor_si256(values, sign));
+            less += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(is_less)));
+        }
+        return less + count_less_scalar(keys, i, n, key);
+    }
+
+    /// `count_less()` with SSE4.2, 2 keys per instruction.
+    __attribute__((target("sse4.2"))) static uint32_t count_less_sse42(const uint64_t *keys, uint32_t n,
+                                                                       uint64_t key) {
+        const __m128i sign = _mm_set1_epi64x(static_cast<int64_t>(kSignBit));
+        const __m128i needle = _mm_xor_si128(_mm_set1_epi64x(static_cast<int64_t>(key)), sign);
+        uint32_t less = 0;
+        uint32_t i = 0;
+        for (; i + 2 <= n; i += 2) {
+            __m128i values = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+            __m128i is_less = _mm_cmpgt_epi64(needle, _mm_xor_si128(values, sign));
+            less += __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(is_less)));
+        }
+        return less + count_less_scalar(keys, i, n, key);
+    }
+
+    /// Returns the number of the keys [begin, end) at `keys` that are less
+    /// than `key`, one at a time.
+    static uint32_t count_less_scalar(const uint64_t *keys, uint32_t begin, uint32_t end, uint64_t key) {
+        uint32_t less = 0;
+        for (uint32_t i = begin; i < end; ++i) {
+            less += keys[i] < key;
+        }
+        return less;
+    }
+};
+
+#endif
+
+}  // namespace buzzdb
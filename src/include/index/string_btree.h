@@ -0,0 +1,598 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+#include "storage/segment.h"
+
+namespace buzzdb {
+
+/// A B-link tree for variable-length byte string keys, ordered bytewise.
+/// Nodes are slotted pages: a directory of fixed-size slots grows from the
+/// front of the page and the keys with their payloads grow from the back.
+/// Separators that move up on a leaf split are truncated to the shortest
+/// prefix that still separates both halves.
+///
+/// Concurrency follows `BTree`: nodes carry high keys and right sibling
+/// links, splits happen one level at a time, and the root keeps its page.
+/// Readers couple shared latches top-down instead of reading optimistically,
+/// since a torn slot directory could point anywhere in the page.
+///
+/// Unlike in `BTree`, a separator is the smallest key of the node to its
+/// right: keys less than a separator go left.
+template<typename ValueT, size_t PageSize>
+struct StringBTree : public Segment {
+    static_assert(std::is_trivially_copyable_v<ValueT>, "values are copied into pages bytewise");
+    static_assert(PageSize < (1u << 16), "slot offsets are 16 bit");
+
+    /// Where an entry lives in the heap of a node. The key bytes are followed
+    /// by the payload: the value in leaves, the child page id in inner nodes.
+    struct Slot {
+        uint16_t offset;
+        uint16_t length;
+    };
+
+    /// The node header, followed by the slot directory.
+    struct Node {
+        /// The page id of the next node on the same level, 0 if there is
+        /// none. Keys not less than `high_key` moved there in a split.
+        uint64_t right_sibling;
+
+        /// The child for keys not less than the last separator. Only used
+        /// by inner nodes.
+        uint64_t upper;
+
+        /// The level in the tree.
+        uint16_t level;
+
+        /// The number of slots.
+        uint16_t count;
+
+        /// The offset of the heap, which ends at the end of the page.
+        uint16_t heap_begin;
+
+        /// The number of heap bytes that belong to erased entries. They are
+        /// reclaimed by compacting the node.
+        uint16_t heap_unused;
+
+        /// The exclusive upper bound of the key range, stored in the heap.
+        /// Only meaningful if there is a right sibling.
+        Slot high_key;
+
+        /// Constructor.
+        explicit Node(uint16_t level)
+            : right_sibling(0), upper(0), level(level), count(0), heap_begin(PageSize),
+              heap_unused(0), high_key{0, 0} {}
+
+        /// Is the node a leaf node?
+        bool is_leaf() const { return level == 0; }
+
+        /// Returns the slot directory.
+        Slot *slots() { return reinterpret_cast<Slot *>(this + 1); }
+        const Slot *slots() const { return reinterpret_cast<const Slot *>(this + 1); }
+
+        /// Returns the bytes of the page.
+        char *data() { return reinterpret_cast<char *>(this); }
+        const char *data() const { return reinterpret_cast<const char *>(this); }
+
+        /// Returns the size of the payload after each key.
+        uint32_t payload_size() const { return is_leaf() ? sizeof(ValueT) : sizeof(uint64_t); }
+
+        /// Returns the key of slot `index`.
+        std::string_view key(uint32_t index) const {
+            return {data() + slots()[index].offset, slots()[index].length};
+        }
+
+        /// Returns the payload of slot `index`.
+        char *payload(uint32_t index) {
+            return data() + slots()[index].offset + slots()[index].length;
+        }
+
+        /// Returns the value of slot `index` of a leaf.
+        ValueT value(uint32_t index) const {
+            ValueT value;
+            std::memcpy(&value, data() + slots()[index].offset + slots()[index].length, sizeof(ValueT));
+            return value;
+        }
+
+        /// Returns the child of slot `index` of an inner node, `upper` for
+        /// `index == count`.
+        uint64_t child(uint32_t index) const {
+            if (index == count) {
+                return upper;
+            }
+            uint64_t child;
+            std::memcpy(&child, data() + slots()[index].offset + slots()[index].length, sizeof(uint64_t));
+            return child;
+        }
+
+        /// Sets the child of slot `index` of an inner node, `upper` for
+        /// `index == count`.
+        void set_child(uint32_t index, uint64_t child) {
+            if (index == count) {
+                upper = child;
+            } else {
+                std::memcpy(payload(index), &child, sizeof(uint64_t));
+            }
+        }
+
+        /// Does the key range of this node include `key`? If not, `key` is
+        /// found by following the right sibling links.
+        bool covers(std::string_view key) const {
+            return right_sibling == 0 || key < std::string_view{data() + high_key.offset, high_key.length};
+        }
+
+        /// Returns the index of the first slot whose key is not less than
+        /// `key`.
+        uint32_t lower_bound(std::string_view key) const {
+            uint32_t lo = 0, hi = count;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (this->key(mid) < key) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        /// Returns the index of the child of an inner node that covers `key`:
+        /// the first slot whose separator is greater than `key`.
+        uint32_t child_index(std::string_view key) const {
+            uint32_t lo = 0, hi = count;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (this->key(mid) <= key) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        /// Returns the number of bytes between the slot directory and the
+        /// heap.
+        uint32_t free_space() const { return heap_begin - sizeof(Node) - count * sizeof(Slot); }
+
+        /// Makes room for an entry with a key of `key_length` bytes,
+        /// compacting the heap if that helps.
+        /// @return             False if the entry does not fit.
+        bool make_room(uint32_t key_length) {
+            uint32_t needed = sizeof(Slot) + key_length + payload_size();
+            if (free_space() >= needed) {
+                return true;
+            }
+            if (free_space() + heap_unused < needed) {
+                return false;
+            }
+            compact();
+            return true;
+        }
+
+        /// Copies `length` bytes to the heap.
+        /// @return             The offset of the copy.
+        uint16_t append_to_heap(const void *bytes, uint32_t length) {
+            heap_begin -= length;
+            std::memcpy(data() + heap_begin, bytes, length);
+            return heap_begin;
+        }
+
+        /// Inserts an entry at slot `index`. There must be room for it.
+        void insert_at(uint32_t index, std::string_view key, const void *payload) {
+            assert(free_space() >= sizeof(Slot) + key.size() + payload_size());
+            heap_begin -= payload_size();
+            std::memcpy(data() + heap_begin, payload, payload_size());
+            uint16_t offset = append_to_heap(key.data(), key.size());
+            std::memmove(slots() + index + 1, slots() + index, (count - index) * sizeof(Slot));
+            slots()[index] = Slot{offset, static_cast<uint16_t>(key.size())};
+            ++count;
+        }
+
+        /// Erases slot `index`.
+        void erase_at(uint32_t index) {
+            heap_unused += slots()[index].length + payload_size();
+            std::memmove(slots() + index, slots() + index + 1, (count - index - 1) * sizeof(Slot));
+            --count;
+        }
+
+        /// Replaces the high key.
+        void set_high_key(std::string_view key) {
+            heap_unused += high_key.length;
+            high_key = Slot{append_to_heap(key.data(), key.size()), static_cast<uint16_t>(key.size())};
+        }
+
+        /// Copies the slots [begin, end) of `other` to the end of this node.
+        void append_from(const Node &other, uint32_t begin, uint32_t end) {
+            for (uint32_t i = begin; i < end; ++i) {
+                std::string_view key = other.key(i);
+                insert_at(count, key, other.data() + other.slots()[i].offset + key.size());
+            }
+        }
+
+        /// Rewrites the node without the unused heap bytes.
+        void compact() {
+            alignas(Node) char buffer[PageSize];
+            auto *copy = new (buffer) Node(level);
+            copy->right_sibling = right_sibling;
+            copy->upper = upper;
+            if (right_sibling != 0) {
+                copy->set_high_key({data() + high_key.offset, high_key.length});
+            }
+            copy->append_from(*this, 0, count);
+            std::memcpy(data(), buffer, PageSize);
+        }
+    };
+
+    /// The longest supported key. Eight maximal entries fit into a node, so
+    /// a split always leaves room for one more entry and a high key.
+    static constexpr uint32_t kMaxKeyLength =
+        (PageSize - sizeof(Node)) / 8 - sizeof(Slot) - std::max(sizeof(ValueT), sizeof(uint64_t));
+
+    /// The root. It is created by the first insert and keeps its page id from
+    /// then on; a root split moves the root entries into two new children.
+    std::optional<uint64_t> root;
+
+    /// The metadata of the tree in the segment header.
+    struct Metadata {
+        /// The page id of the root, 0 for an empty tree.
+        uint64_t root_page_id;
+    };
+
+    /// Constructor. Attaches to the tree that is stored in the segment, if
+    /// any.
+    StringBTree(uint16_t segment_id, BufferManager &buffer_manager)
+        : Segment(segment_id, buffer_manager) {
+        Metadata metadata;
+        read_metadata(&metadata, sizeof(metadata));
+        if (metadata.root_page_id != 0) {
+            root = metadata.root_page_id;
+            has_root.store(true, std::memory_order_release);
+        }
+    }
+
+    /// Lookup an entry in the tree.
+    /// @param[in] key      The key that should be searched.
+    std::optional<ValueT> lookup(std::string_view key) {
+        uint64_t page_id = find_leaf_node(key);
+        if (page_id == 0) {
+            return std::nullopt;
+        }
+        BufferFrame &frame = fix_covering(page_id, key, 0, false);
+        auto *node = reinterpret_cast<Node *>(frame.get_data());
+        uint32_t index = node->lower_bound(key);
+        std::optional<ValueT> result;
+        if (index < node->count && node->key(index) == key) {
+            result = node->value(index);
+        }
+        buffer_manager.unfix_page(frame, false);
+        return result;
+    }
+
+    /// Returns the page id of the leaf that covers `key`, 0 for an empty tree.
+    /// The leaf may have been split by the time the caller fixes it.
+    /// @param[in] key      The key that should be searched.
+    uint64_t find_leaf_node(std::string_view key) {
+        if (!has_root.load(std::memory_order_acquire)) {
+            return 0;
+        }
+        std::vector<uint64_t> path;
+        return descend(key, path);
+    }
+
+    /// Erase an entry in the tree.
+    /// @param[in] key      The key that should be searched.
+    void erase(std::string_view key) {
+        uint64_t page_id = find_leaf_node(key);
+        if (page_id == 0) {
+            return;
+        }
+        BufferFrame &frame = fix_covering(page_id, key, 0, true);
+        auto *node = reinterpret_cast<Node *>(frame.get_data());
+        uint32_t index = node->lower_bound(key);
+        bool found = index < node->count && node->key(index) == key;
+        if (found) {
+            node->erase_at(index);
+        }
+        buffer_manager.unfix_page(frame, found);
+    }
+
+    /// Inserts a new entry into the tree. An existing key gets its value
+    /// overwritten.
+    /// @param[in] key      The key that should be inserted, at most
+    ///                     `kMaxKeyLength` bytes long. Longer keys throw
+    ///                     `std::invalid_argument`.
+    /// @param[in] value    The value that should be inserted.
+    void insert(std::string_view key, const ValueT &value) {
+        if (key.size() > kMaxKeyLength) {
+            throw std::invalid_argument("key of " + std::to_string(key.size()) + " bytes exceeds the maximum of " +
+                                        std::to_string(kMaxKeyLength));
+        }
+        if (!has_root.load(std::memory_order_acquire)) {
+            create_root();
+        }
+
+        while (true) {
+            std::vector<uint64_t> path;
+            uint64_t page_id = descend(key, path);
+            FixGuard frame{buffer_manager, fix_covering(page_id, key, 0, true)};
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            uint32_t index = node->lower_bound(key);
+            if (index < node->count && node->key(index) == key) {
+                std::memcpy(node->payload(index), &value, sizeof(ValueT));
+                frame.unfix(true);
+                return;
+            }
+            if (node->make_room(key.size())) {
+                node->insert_at(index, key, &value);
+                frame.unfix(true);
+                return;
+            }
+            if (page_id == *root) {
+                // The root keeps its page, so it is split in place. Retry
+                // with the new children.
+                BufferManager::AtomicChange change{buffer_manager};
+                split_root(*frame);
+                frame.unfix(true);
+                continue;
+            }
+
+            uint64_t right_page_id;
+            std::string split_key;
+            {
+                // The new page is fixed before the node changes, see
+                // `FixGuard`.
+                BufferManager::AtomicChange change{buffer_manager};
+                right_page_id = allocate_page();
+                FixGuard right_frame{buffer_manager, buffer_manager.fix_page(right_page_id, true)};
+                auto *right_node = reinterpret_cast<Node *>(right_frame->get_data());
+                split_key = split(*node, right_frame->get_data(), right_page_id);
+                Node *target = key < split_key ? node : right_node;
+                bool has_room = target->make_room(key.size());
+                assert(has_room);
+                static_cast<void>(has_room);
+                target->insert_at(target->lower_bound(key), key, &value);
+                right_frame.unfix(true);
+                frame.unfix(true);
+            }
+
+            insert_separator(path, 1, std::move(split_key), right_page_id);
+            return;
+        }
+    }
+
+private:
+    /// Serializes the creation of the root.
+    std::mutex root_latch;
+
+    /// Is `root` set? `root` is only read after this was seen to be true.
+    std::atomic<bool> has_root = false;
+
+    /// Creates an empty leaf as root unless another thread did so already.
+    void create_root() {
+        std::unique_lock lock{root_latch};
+        if (has_root.load(std::memory_order_relaxed)) {
+            return;
+        }
+        uint64_t root_page_id = allocate_page();
+        BufferFrame &frame = buffer_manager.fix_page(root_page_id, true);
+        new (frame.get_data()) Node(0);
+        buffer_manager.unfix_page(frame, true);
+        root = root_page_id;
+        // The root keeps its page, so it is stored only once.
+        Metadata metadata{root_page_id};
+        write_metadata(&metadata, sizeof(metadata));
+        has_root.store(true, std::memory_order_release);
+    }
+
+    /// Descends from the root to the leaf that covers `key`, coupling shared
+    /// latches on the way.
+    /// @param[in]  key     The key that should be searched.
+    /// @param[out] path    Receives the page ids of the inner nodes that were
+    ///                     passed, indexed by level.
+    /// @return             The page id of the leaf.
+    uint64_t descend(std::string_view key, std::vector<uint64_t> &path) {
+        uint64_t page_id = *root;
+        BufferFrame *frame = &buffer_manager.fix_page(page_id, false);
+        while (true) {
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            uint64_t next_page_id;
+            if (!node->covers(key)) {
+                next_page_id = node->right_sibling;
+            } else if (node->is_leaf()) {
+                buffer_manager.unfix_page(*frame, false);
+                return page_id;
+            } else {
+                if (path.size() <= node->level) {
+                    path.resize(node->level + 1);
+                }
+                path[node->level] = page_id;
+                next_page_id = node->child(node->child_index(key));
+            }
+            BufferFrame *next_frame;
+            try {
+                next_frame = &buffer_manager.fix_page(next_page_id, false);
+            } catch (...) {
+                buffer_manager.unfix_page(*frame, false);
+                throw;
+            }
+            buffer_manager.unfix_page(*frame, false);
+            frame = next_frame;
+            page_id = next_page_id;
+        }
+    }
+
+    /// Fixes the node on `level` whose key range includes `key`. Starts at
+    /// `page_id`, which must be on `level` or, if the tree grew since it was
+    /// looked up, be the root. Latches are coupled to the right and
+    /// downwards only, so writers cannot deadlock.
+    /// @param[in,out] page_id  The start page, receives the page of the node.
+    /// @param[in] key          The key that should be covered.
+    /// @param[in] level        The level of the node.
+    /// @param[in] exclusive    Should the node be latched exclusively?
+    BufferFrame &fix_covering(uint64_t &page_id, std::string_view key, uint16_t level, bool exclusive) {
+        BufferFrame *frame = &buffer_manager.fix_page(page_id, exclusive);
+        while (true) {
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            uint64_t next_page_id;
+            if (!node->covers(key)) {
+                next_page_id = node->right_sibling;
+            } else if (node->level > level) {
+                next_page_id = node->child(node->child_index(key));
+            } else {
+                assert(node->level == level);
+                return *frame;
+            }
+            BufferFrame *next_frame;
+            try {
+                next_frame = &buffer_manager.fix_page(next_page_id, exclusive);
+            } catch (...) {
+                buffer_manager.unfix_page(*frame, false);
+                throw;
+            }
+            buffer_manager.unfix_page(*frame, false);
+            frame = next_frame;
+            page_id = next_page_id;
+        }
+    }
+
+    /// Adds the separator of a split to the parent level, splitting parents
+    /// as needed. Each parent is latched only after its child was released.
+    /// @param[in] path         The inner nodes passed during the descent,
+    ///                         indexed by level.
+    /// @param[in] level        The level of the parent.
+    /// @param[in] split_key    The separator.
+    /// @param[in] right_page_id The new right child.
+    void insert_separator(const std::vector<uint64_t> &path, uint16_t level, std::string split_key,
+                          uint64_t right_page_id) {
+        while (true) {
+            // The root may have grown above the levels of the path.
+            uint64_t page_id = level < path.size() ? path[level] : *root;
+            FixGuard frame{buffer_manager, fix_covering(page_id, split_key, level, true)};
+            auto *node = reinterpret_cast<Node *>(frame->get_data());
+            if (node->make_room(split_key.size())) {
+                insert_child(*node, split_key, right_page_id);
+                frame.unfix(true);
+                return;
+            }
+            if (page_id == *root) {
+                BufferManager::AtomicChange change{buffer_manager};
+                split_root(*frame);
+                frame.unfix(true);
+                continue;
+            }
+
+            BufferManager::AtomicChange change{buffer_manager};
+            uint64_t new_page_id = allocate_page();
+            FixGuard new_frame{buffer_manager, buffer_manager.fix_page(new_page_id, true)};
+            auto *new_node = reinterpret_cast<Node *>(new_frame->get_data());
+            std::string new_split_key = split(*node, new_frame->get_data(), new_page_id);
+            Node *target = split_key < new_split_key ? node : new_node;
+            bool has_room = target->make_room(split_key.size());
+            assert(has_room);
+            static_cast<void>(has_room);
+            insert_child(*target, split_key, right_page_id);
+            new_frame.unfix(true);
+            frame.unfix(true);
+
+            split_key = std::move(new_split_key);
+            right_page_id = new_page_id;
+            ++level;
+        }
+    }
+
+    /// Adds the right half of a split child to an inner node that covers the
+    /// separator and has room for it.
+    static void insert_child(Node &node, std::string_view split_key, uint64_t right_page_id) {
+        // The split child keeps the keys below the separator.
+        uint32_t index = node.child_index(split_key);
+        uint64_t left_page_id = node.child(index);
+        node.insert_at(index, split_key, &left_page_id);
+        node.set_child(index + 1, right_page_id);
+    }
+
+    /// Returns the shortest separator `s` with `left < s <= right`.
+    static std::string truncate_separator(std::string_view left, std::string_view right) {
+        auto mismatch = std::mismatch(left.begin(), left.end(), right.begin(), right.end());
+        return std::string{right.substr(0, mismatch.second - right.begin() + 1)};
+    }
+
+    /// Moves the upper half of `node`, by bytes, into the empty page `buffer`
+    /// and links both.
+    /// @return             The separator, the smallest key of the right node.
+    static std::string split(Node &node, char *buffer, uint64_t buffer_page_id) {
+        // Split where the entries reach half of the used bytes.
+        uint32_t overhead = sizeof(Slot) + node.payload_size();
+        uint32_t used = 0;
+        for (uint32_t i = 0; i < node.count; ++i) {
+            used += node.slots()[i].length + overhead;
+        }
+        uint32_t split_point = 1, left_bytes = node.slots()[0].length + overhead;
+        while (split_point + 1 < node.count && 2 * left_bytes < used) {
+            left_bytes += node.slots()[split_point++].length + overhead;
+        }
+
+        auto *right = new (buffer) Node(node.level);
+        std::string split_key;
+        if (node.is_leaf()) {
+            split_key = truncate_separator(node.key(split_point - 1), node.key(split_point));
+            right->append_from(node, split_point, node.count);
+        } else {
+            // The separator at the split point moves up, its child becomes
+            // the upper child of the left node.
+            split_key = std::string{node.key(split_point)};
+            right->append_from(node, split_point + 1, node.count);
+            right->upper = node.upper;
+        }
+
+        right->right_sibling = node.right_sibling;
+        if (node.right_sibling != 0) {
+            right->set_high_key({node.data() + node.high_key.offset, node.high_key.length});
+        }
+
+        alignas(Node) char left_buffer[PageSize];
+        auto *left = new (left_buffer) Node(node.level);
+        left->append_from(node, 0, split_point);
+        left->upper = node.is_leaf() ? 0 : node.child(split_point);
+        left->right_sibling = buffer_page_id;
+        left->set_high_key(split_key);
+        std::memcpy(node.data(), left_buffer, PageSize);
+        return split_key;
+    }
+
+    /// Splits the root in place: its entries move into two new children and
+    /// it becomes an inner node one level higher.
+    /// @param[in] root_frame   The exclusively fixed root.
+    void split_root(BufferFrame &root_frame) {
+        auto *root_node = reinterpret_cast<Node *>(root_frame.get_data());
+        uint64_t left_page_id = allocate_page();
+        uint64_t right_page_id = allocate_page();
+        FixGuard left_frame{buffer_manager, buffer_manager.fix_page(left_page_id, true)};
+        FixGuard right_frame{buffer_manager, buffer_manager.fix_page(right_page_id, true)};
+
+        std::memcpy(left_frame->get_data(), root_frame.get_data(), PageSize);
+        std::string split_key =
+            split(*reinterpret_cast<Node *>(left_frame->get_data()), right_frame->get_data(), right_page_id);
+        uint16_t level = root_node->level + 1;
+        auto *new_root_node = new (root_frame.get_data()) Node(level);
+        new_root_node->insert_at(0, split_key, &left_page_id);
+        new_root_node->upper = right_page_id;
+
+        right_frame.unfix(true);
+        left_frame.unfix(true);
+    }
+};
+
+}  // namespace buzzdb
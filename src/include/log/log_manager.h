@@ -0,0 +1,111 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "storage/file.h"
+
+namespace buzzdb {
+
+/// An append-only write-ahead log of opaque records. Records are collected in
+/// memory and written to the log file in batches: when several threads wait
+/// for their records to become durable at the same time, one of them writes
+/// everything that was appended so far and syncs the file once, and the
+/// others only wait for it (group commit).
+///
+/// The position of a record is its log sequence number (LSN), the offset in
+/// the log file at which the record ends. Each record carries a checksum, so
+/// a record that was torn by a crash ends the log.
+class LogManager {
+public:
+    /// Constructor.
+    /// @param[in] file     The log file, opened in `WRITE` mode. Its records
+    ///                     are read back with `replay()` before new ones are
+    ///                     appended.
+    explicit LogManager(std::unique_ptr<File> file);
+
+    /// Destructor. Writes the records that are not durable yet, and drops
+    /// them if that fails.
+    ~LogManager();
+
+    /// Appends a record. It becomes durable with the next write of the log.
+    /// Is thread-safe.
+    /// @param[in] data     The record.
+    /// @param[in] size     The size of the record in bytes, at least 1.
+    /// @return             The LSN of the record.
+    uint64_t append(const char* data, size_t size);
+
+    /// Waits until all records up to `lsn` are durable, writing the log if
+    /// no other thread is doing so already.
+    /// Is thread-safe.
+    /// @param[in] lsn      The LSN of the last record that must be durable.
+    ///                     LSNs past the end of the log, such as those of
+    ///                     records before a `reset()`, mean the end.
+    void flush(uint64_t lsn);
+
+    /// Returns the LSN of the last appended record, 0 for an empty log.
+    uint64_t get_end_lsn();
+
+    /// Returns the number of writes of the log file so far.
+    size_t get_write_count();
+
+    /// Calls `redo` for every complete record in the log file, in log order.
+    /// A torn record at the end is cut off. Must be called before records
+    /// are appended.
+    /// @param[in] redo     Called with each record and its size.
+    void replay(const std::function<void(const char* data, size_t size)>& redo);
+
+    /// Drops all records. The caller guarantees that their changes are
+    /// stored elsewhere, and that no records are appended concurrently.
+    void reset();
+
+private:
+    /// The header in front of every record in the log file.
+    struct RecordHeader {
+        /// The size of the record without the header.
+        uint32_t size;
+        /// The checksum of the record, seeded with its offset, so stale
+        /// records of an earlier run are not mistaken for new ones.
+        uint32_t checksum;
+    };
+
+    /// The number of buffered bytes at which `append()` writes the log.
+    static constexpr size_t kBufferLimit = 1 << 20;
+    /// The number of bytes by which the log file grows at once.
+    static constexpr size_t kFileExtent = 1 << 20;
+
+    /// Returns the checksum of a record that starts at `offset`.
+    static uint32_t get_checksum(uint64_t offset, const char* data, size_t size);
+
+    /// Writes the buffered records and wakes up waiting threads. `lock`
+    /// holds `latch` and is released during the write. If the write fails,
+    /// the records stay buffered.
+    void write(std::unique_lock<std::mutex>& lock);
+
+    /// The log file.
+    std::unique_ptr<File> file;
+
+    /// Protects the members below.
+    std::mutex latch;
+    /// Signaled when a write of the log finished.
+    std::condition_variable write_finished;
+    /// The records that were appended since the last write started.
+    std::vector<char> buffer;
+    /// The records that are being written, kept to reuse their memory.
+    std::vector<char> write_buffer;
+    /// The offset of `buffer` in the log file.
+    uint64_t buffer_lsn = 0;
+    /// All records up to this LSN are durable.
+    uint64_t flushed_lsn = 0;
+    /// Is a thread writing the log?
+    bool writing = false;
+    /// The number of writes of the log file.
+    size_t write_count = 0;
+};
+
+}  // namespace buzzdb
@@ -13,6 +13,22 @@ class File {
   /// File mode (read or write)
   enum Mode { READ, WRITE };
 
+  /// When written data reaches the device.
+  enum Durability {
+    /// Writes go to the OS page cache. Only `sync()` makes them durable.
+    BUFFERED,
+    /// Every write returns once its data is durable (`O_DSYNC`).
+    DSYNC,
+    /// Writes bypass the OS page cache (`O_DIRECT`), but may still sit in a
+    /// device cache until `sync()`. Offsets, sizes and memory addresses of
+    /// all reads and writes must be multiples of `kDirectAlignment`.
+    DIRECT
+  };
+
+  /// The alignment of I/O on files with `DIRECT` durability. It is the
+  /// largest logical block size of common devices.
+  static constexpr size_t kDirectAlignment = 4096;
+
   virtual ~File() = default;
 
   /// Returns the `Mode` this file was opened with.
@@ -59,14 +75,69 @@ class File {
   /// @param[in] size   The size of the block.
   virtual void write_block(const char* block, size_t offset, size_t size) = 0;
 
+  /// A block of a vectored read or write.
+  struct Block {
+    /// The offset of the block in the file.
+    size_t offset;
+    /// The size of the block.
+    size_t size;
+    /// The memory of the block. Only read by `write_blocks()`.
+    char* data;
+  };
+
+  /// Reads several blocks like `read_block()`. Blocks that follow each
+  /// other both in `blocks` and in the file are read with a single call,
+  /// so callers should sort them by offset.
+  /// Is thread-safe like `read_block()`.
+  /// @param[in] blocks The blocks.
+  /// @param[in] count  The number of blocks.
+  virtual void read_blocks(const Block* blocks, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      read_block(blocks[i].offset, blocks[i].size, blocks[i].data);
+    }
+  }
+
+  /// Writes several blocks like `write_block()`. Blocks that follow each
+  /// other both in `blocks` and in the file are written with a single call,
+  /// so callers should sort them by offset.
+  /// Is thread-safe like `write_block()`.
+  /// @param[in] blocks The blocks.
+  /// @param[in] count  The number of blocks.
+  virtual void write_blocks(const Block* blocks, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      write_block(blocks[i].data, blocks[i].offset, blocks[i].size);
+    }
+  }
+
+  /// Waits until all written data and the file size are durable.
+  /// Is thread-safe.
+  virtual void sync() = 0;
+
+  /// Writes back the data in a range of the file and waits for it. Unlike
+  /// `sync()`, this neither includes the file size nor flushes the device
+  /// cache, so it is no durability barrier on its own. It bounds the amount
+  /// of data that a later `sync()` has to write.
+  /// Is thread-safe.
+  /// @param[in] offset The offset of the range.
+  /// @param[in] size   The size of the range.
+  virtual void sync_range(size_t offset, size_t size) = 0;
+
+  /// Returns the POSIX file descriptor of the file, or -1 if it has none.
+  /// Asynchronous I/O hands it to the kernel.
+  virtual int get_descriptor() const { return -1; }
+
   /// Opens a file with the given mode. Existing files are never overwritten.
-  /// @param[in] filename Path to the file.
-  /// @param[in] mode     `Mode` that should be used to open the file.
-  static std::unique_ptr<File> open_file(const char* filename, Mode mode);
+  /// @param[in] filename   Path to the file.
+  /// @param[in] mode       `Mode` that should be used to open the file.
+  /// @param[in] durability `Durability` of the writes to the file.
+  static std::unique_ptr<File> open_file(const char* filename, Mode mode,
+                                         Durability durability = BUFFERED);
 
   /// Opens a temporary file in `WRITE` mode. The file will be deleted
   /// automatically after use.
-  static std::unique_ptr<File> make_temporary_file();
+  /// @param[in] durability `Durability` of the writes to the file.
+  static std::unique_ptr<File> make_temporary_file(
+      Durability durability = BUFFERED);
 };
 
 }  // namespace buzzdb
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "storage/file.h"
+
+namespace buzzdb {
+
+/// A queue of asynchronous block reads and writes on files. Requests are
+/// collected with `read()` and `write()`, handed over in one batch with
+/// `submit()`, and their completions are collected with `reap()`, so a single
+/// thread can keep many requests in flight. Uses io_uring where the kernel
+/// supports it, and otherwise a pool of threads that run the blocking calls
+/// of `File`.
+/// A queue must only be used by one thread at a time.
+class IOQueue {
+public:
+    /// The implementation of the queue.
+    enum class Backend {
+        /// io_uring if the kernel supports it, else a thread pool.
+        DEFAULT,
+        /// io_uring. Files without a descriptor are read and written
+        /// synchronously in `submit()`.
+        IO_URING,
+        /// A pool of threads that call `File::read_block()` and
+        /// `File::write_block()`.
+        THREAD_POOL
+    };
+
+    /// A finished request.
+    struct Completion {
+        /// The tag that the request was queued with.
+        uint64_t tag;
+        /// 0, or the errno of the failure.
+        int error;
+    };
+
+    /// Creates a queue.
+    /// @param[in] depth    The maximum number of pending requests.
+    /// @param[in] backend  The implementation.
+    /// @return             The queue, or null if `backend` is `IO_URING`
+    ///                     and the kernel does not support it.
+    static std::unique_ptr<IOQueue> create(size_t depth, Backend backend = Backend::DEFAULT);
+
+    /// Destructor. Waits for the requests in flight.
+    virtual ~IOQueue() = default;
+
+    /// Returns the implementation, `IO_URING` or `THREAD_POOL`.
+    virtual Backend get_backend() const = 0;
+
+    /// Queues a read of a block like `File::read_block()`. It starts with the
+    /// next `submit()`. At most `depth` requests may be pending.
+    /// @param[in]  file    The file.
+    /// @param[in]  offset  The offset of the block in the file.
+    /// @param[in]  size    The size of the block.
+    /// @param[out] block   Receives the block. Must stay valid until the
+    ///                     request completed.
+    /// @param[in]  tag     Identifies the request in its completion.
+    void read(File& file, size_t offset, size_t size, char* block, uint64_t tag) {
+        queue(Request{&file, block, offset, size, tag, false});
+    }
+
+    /// Queues a write of a block like `File::write_block()`. It starts with
+    /// the next `submit()`. At most `depth` requests may be pending.
+    /// @param[in] file     The file, which must be large enough.
+    /// @param[in] block    The block. Must stay valid until the request
+    ///                     completed.
+    /// @param[in] offset   The offset of the block in the file.
+    /// @param[in] size     The size of the block.
+    /// @param[in] tag      Identifies the request in its completion.
+    void write(File& file, const char* block, size_t offset, size_t size, uint64_t tag) {
+        queue(Request{&file, const_cast<char*>(block), offset, size, tag, true});
+    }
+
+    /// Starts all queued requests.
+    virtual void submit() = 0;
+
+    /// Waits until at least `min_count` requests completed and returns the
+    /// completions, at most `max_count`, in no particular order.
+    /// @param[out] completions Receives the completions.
+    /// @param[in]  max_count   The capacity of `completions`.
+    /// @param[in]  min_count   The number of completions to wait for. Must
+    ///                         not exceed the number of submitted requests.
+    /// @return                 The number of completions.
+    virtual size_t reap(Completion* completions, size_t max_count, size_t min_count) = 0;
+
+    /// Returns the number of requests that were queued and are not reaped
+    /// yet.
+    size_t get_pending() const { return pending; }
+
+    /// Returns the maximum number of pending requests.
+    size_t get_depth() const { return depth; }
+
+protected:
+    /// A read or write.
+    struct Request {
+        File* file;
+        char* block;
+        size_t offset;
+        size_t size;
+        uint64_t tag;
+        bool is_write;
+    };
+
+    explicit IOQueue(size_t depth) : depth(depth) {}
+
+    /// Runs `request` with the blocking calls of `File`.
+    /// @return             0, or the errno of the failure.
+    static int run(const Request& request);
+
+    /// The requests that were queued since the last `submit()`.
+    std::vector<Request> queued;
+    /// The maximum number of pending requests.
+    size_t depth;
+    /// The number of requests that were queued and are not reaped yet.
+    size_t pending = 0;
+
+private:
+    void queue(const Request& request);
+};
+
+}  // namespace buzzdb
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+
+#include "storage/file.h"
+
+namespace buzzdb {
+
+/// A file that is mapped read-only into memory. Reads are copies from the
+/// mapping, and `get_data()` exposes the mapped bytes without any copy. The
+/// file must not be changed by others while it is mapped.
+class MmapFile : public File {
+ public:
+  /// The expected access pattern, which tunes read-ahead (`madvise()`).
+  enum Access {
+    /// The default read-ahead of the OS.
+    NORMAL,
+    /// No read-ahead, for point lookups that touch few pages.
+    RANDOM,
+    /// Aggressive read-ahead, for scans.
+    SEQUENTIAL,
+    /// Load the range right away, for data that is probed heavily.
+    WILL_NEED
+  };
+
+  /// Maps the file `filename` read-only.
+  /// @param[in] filename Path to the file.
+  /// @param[in] access   The expected `Access` of the whole file.
+  static std::unique_ptr<MmapFile> map_file(const char* filename,
+                                            Access access = NORMAL);
+
+  ~MmapFile() override;
+
+  /// Returns `READ`.
+  Mode get_mode() const override { return READ; }
+
+  size_t size() const override { return mapping_size; }
+
+  /// Throws, as the file is read-only.
+  void resize(size_t new_size) override;
+
+  using File::read_block;
+
+  /// Copies a block from the mapping. Bytes past the end of the file are
+  /// not read.
+  void read_block(size_t offset, size_t size, char* block) override;
+
+  /// Throws, as the file is read-only.
+  void write_block(const char* block, size_t offset, size_t size) override;
+
+  /// Does nothing, as the file is never written.
+  void sync() override {}
+
+  /// Does nothing, as the file is never written.
+  void sync_range(size_t /*offset*/, size_t /*size*/) override {}
+
+  int get_descriptor() const override { return fd; }
+
+  /// Returns the mapped content of the file, `size()` bytes. Null for an
+  /// empty file.
+  const char* get_data() const { return data; }
+
+  /// Declares the expected access to a range of the file. The range is
+  /// extended to whole OS pages.
+  /// @param[in] access The expected `Access`.
+  /// @param[in] offset The offset of the range.
+  /// @param[in] size   The size of the range.
+  void advise(Access access, size_t offset, size_t size);
+
+  /// Declares the expected access to the whole file.
+  void advise(Access access) { advise(access, 0, mapping_size); }
+
+ private:
+  MmapFile(int fd, char* data, size_t size)
+      : fd(fd), data(data), mapping_size(size) {}
+
+  int fd;
+  char* data;
+  size_t mapping_size;
+};
+
+}  // namespace buzzdb
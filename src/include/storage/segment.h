@@ -1,20 +1,116 @@
 #pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
 #include "buffer/buffer_manager.h"
 namespace buzzdb {
 
+/// A set of pages that share a file. The segment keeps track of which of its
+/// pages are in use in allocation maps that are stored in the segment itself:
+/// page 0 holds the segment header, and each map page is followed by the
+/// pages it covers, one bit per page. Pages are handed out first-fit, so
+/// freed pages are reused before the segment grows, and the file grows in
+/// extents of `kExtentPages` pages.
+///
+/// The rest of the header page holds metadata of the segment's owner, such
+/// as the root of an index, so the owner is found again when the segment is
+/// opened by a later process.
 class Segment {
     public:
-    /// Constructor.
+    /// The number of pages by which the segment file grows at once.
+    static constexpr uint64_t kExtentPages = 64;
+    /// Identifies the header page of a segment.
+    static constexpr uint32_t kMagic = 0x425a5347;  // "BZSG"
+    /// The version of the on-disk format of segments and their owners.
+    /// Segments with another version are rejected.
+    static constexpr uint32_t kFormatVersion = 2;
+
+    /// The segment header at the start of page 0.
+    struct Header {
+        /// `kMagic`, or 0 if the segment was never written.
+        uint32_t magic;
+        /// `kFormatVersion` of the process that created the segment.
+        uint32_t format_version;
+        /// No page before this one, counted without map pages, is free.
+        uint64_t first_free;
+        /// The number of pages the segment file is known to hold.
+        uint64_t reserved_pages;
+    };
+
+    /// Constructor. Reads the segment header, or writes one for a new
+    /// segment.
     /// @param[in] segment_id       Id of the segment.
     /// @param[in] buffer_manager   The buffer manager that should be used by the segment.
-    Segment(uint16_t segment_id, BufferManager& buffer_manager)
-        : segment_id(segment_id), buffer_manager(buffer_manager) {}
+    /// @throws Exception           If the segment has an unknown format.
+    Segment(uint16_t segment_id, BufferManager& buffer_manager);
+
+    /// Allocates a page of this segment.
+    /// Is thread-safe. Fixes an allocation map page and the header page, so
+    /// the caller may hold latches on other pages, but none on these.
+    /// @return                     The overall page id of the page.
+    uint64_t allocate_page();
+
+    /// Returns a page of this segment that is no longer used. It may be
+    /// handed out again right away. When the trailing extents of the file
+    /// are all free afterwards, the file shrinks by them, and their pages
+    /// read as zeroes from then on.
+    /// Is thread-safe like `allocate_page()`.
+    /// @param[in] page_id          The overall page id of the page.
+    void free_page(uint64_t page_id);
 
     protected:
+    /// Copies the owner metadata from the header page. It is all zeroes
+    /// until it was first written.
+    /// @param[out] data            The metadata.
+    /// @param[in] size             The size of the metadata in bytes.
+    void read_metadata(void* data, size_t size);
+
+    /// Stores the owner metadata on the header page.
+    /// Is thread-safe, but concurrent writers must be serialized by the
+    /// owner. The caller must not hold a latch on the header page.
+    /// @param[in] data             The metadata.
+    /// @param[in] size             The size of the metadata in bytes.
+    void write_metadata(const void* data, size_t size);
+
     /// The segment id
     uint16_t segment_id;
     /// The buffer manager
     BufferManager& buffer_manager;
+
+    private:
+    /// Returns the overall page id of the header page.
+    uint64_t get_header_page_id() const {
+        return BufferManager::get_overall_page_id(segment_id, 0);
+    }
+
+    /// Copies the allocation state into the segment header.
+    /// `allocator_latch` must be held.
+    void store_allocation_state();
+
+    /// Returns whether no page of the extent that starts at segment page
+    /// `first_page_id` is allocated. Extents with the header or a map page
+    /// are never free, so the pages of a free extent are all covered by
+    /// the map that follows the last map page before it.
+    /// @param[in] map_page_id      The segment page id of that map page.
+    /// @param[in] words            The content of that map page.
+    bool is_extent_free(uint64_t first_page_id, uint64_t map_page_id, const uint64_t* words) const;
+
+    /// Returns the number of pages that one allocation map page covers.
+    uint64_t get_pages_per_map() const { return buffer_manager.get_page_size() * 8; }
+
+    /// Returns the segment page id of the allocation map page `map_index`.
+    uint64_t get_map_page_id(uint64_t map_index) const {
+        return 1 + map_index * (get_pages_per_map() + 1);
+    }
+
+    /// Protects the allocation maps, `first_free` and `reserved_pages`. They
+    /// are mirrored in the segment header.
+    std::mutex allocator_latch;
+    /// No page before this one, counted without map pages, is free.
+    uint64_t first_free = 0;
+    /// The number of pages the segment file is known to hold.
+    uint64_t reserved_pages = 0;
 };
 
 }  // namespace buzzdb
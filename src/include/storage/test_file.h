@@ -36,6 +36,16 @@ class TestFile : public File {
   void read_block(size_t offset, size_t size, char* block);
 
   void write_block(const char* block, size_t offset, size_t size);
+
+  /// Checks all blocks before any of them is read.
+  void read_blocks(const Block* blocks, size_t count) override;
+
+  /// Checks all blocks before any of them is written.
+  void write_blocks(const Block* blocks, size_t count) override;
+
+  void sync() override {}
+
+  void sync_range(size_t /*offset*/, size_t /*size*/) override {}
 };
 
 }  // namespace buzzdb
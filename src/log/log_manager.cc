@@ -0,0 +1,162 @@
+#include "log/log_manager.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+
+namespace buzzdb {
+
+LogManager::LogManager(std::unique_ptr<File> file) : file(std::move(file)) {}
+
+
+LogManager::~LogManager() {
+    std::unique_lock lock{latch};
+    while (writing) {
+        write_finished.wait(lock);
+    }
+    if (!buffer.empty()) {
+        try {
+            write(lock);
+        } catch (...) {
+            // No one waits for these records, so they were never reported
+            // durable.
+        }
+    }
+}
+
+
+uint32_t LogManager::get_checksum(uint64_t offset, const char* data, size_t size) {
+    // FNV-1a, which is good enough to detect torn and stale records.
+    uint32_t hash = 2166136261u;
+    auto add = [&hash](const char* bytes, size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(bytes[i])) * 16777619u;
+        }
+    };
+    add(reinterpret_cast<const char*>(&offset), sizeof(offset));
+    add(data, size);
+    return hash;
+}
+
+
+uint64_t LogManager::append(const char* data, size_t size) {
+    assert(size > 0);
+    std::unique_lock lock{latch};
+    uint64_t offset = buffer_lsn + buffer.size();
+    RecordHeader header{static_cast<uint32_t>(size), get_checksum(offset, data, size)};
+    buffer.insert(buffer.end(), reinterpret_cast<const char*>(&header),
+                  reinterpret_cast<const char*>(&header) + sizeof(header));
+    buffer.insert(buffer.end(), data, data + size);
+    uint64_t lsn = buffer_lsn + buffer.size();
+    if (buffer.size() >= kBufferLimit && !writing) {
+        write(lock);
+    }
+    return lsn;
+}
+
+
+void LogManager::flush(uint64_t lsn) {
+    std::unique_lock lock{latch};
+    // Pages may still carry the LSN of a record that was dropped by reset().
+    lsn = std::min(lsn, buffer_lsn + buffer.size());
+    while (flushed_lsn < lsn) {
+        if (writing) {
+            // Our records are written by the current writer or the next one.
+            write_finished.wait(lock);
+        } else {
+            write(lock);
+        }
+    }
+}
+
+
+void LogManager::write(std::unique_lock<std::mutex>& lock) {
+    assert(!writing && !buffer.empty());
+    writing = true;
+    write_buffer.clear();
+    std::swap(buffer, write_buffer);
+    uint64_t offset = buffer_lsn;
+    buffer_lsn += write_buffer.size();
+    lock.unlock();
+
+    try {
+        // Only the writer touches the file, so it may be resized here.
+        uint64_t end = offset + write_buffer.size();
+        if (file->size() < end) {
+            file->resize((end + kFileExtent - 1) / kFileExtent * kFileExtent);
+        }
+        file->write_block(write_buffer.data(), offset, write_buffer.size());
+        file->sync();
+    } catch (...) {
+        // The records go back in front of those appended meanwhile, whose
+        // checksums were seeded with offsets behind them, and the next write
+        // tries again.
+        lock.lock();
+        buffer.insert(buffer.begin(), write_buffer.begin(), write_buffer.end());
+        buffer_lsn = offset;
+        writing = false;
+        write_finished.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    writing = false;
+    flushed_lsn = offset + write_buffer.size();
+    ++write_count;
+    write_finished.notify_all();
+}
+
+
+uint64_t LogManager::get_end_lsn() {
+    std::unique_lock lock{latch};
+    return buffer_lsn + buffer.size();
+}
+
+
+size_t LogManager::get_write_count() {
+    std::unique_lock lock{latch};
+    return write_count;
+}
+
+
+void LogManager::replay(const std::function<void(const char* data, size_t size)>& redo) {
+    std::unique_lock lock{latch};
+    assert(buffer_lsn == 0 && buffer.empty() && "replay() must come before append()");
+    uint64_t offset = 0;
+    size_t file_size = file->size();
+    std::vector<char> record;
+    while (offset + sizeof(RecordHeader) <= file_size) {
+        RecordHeader header;
+        file->read_block(offset, sizeof(header), reinterpret_cast<char*>(&header));
+        if (header.size == 0 || offset + sizeof(header) + header.size > file_size) {
+            break;
+        }
+        record.resize(header.size);
+        file->read_block(offset + sizeof(header), header.size, record.data());
+        if (header.checksum != get_checksum(offset, record.data(), record.size())) {
+            break;
+        }
+        redo(record.data(), record.size());
+        offset += sizeof(header) + header.size;
+    }
+
+    // Cut off the rest, so that a torn record, or records after it that were
+    // never acknowledged, cannot reappear behind the records of this run.
+    file->resize(offset);
+    file->sync();
+    buffer_lsn = offset;
+    flushed_lsn = offset;
+}
+
+
+void LogManager::reset() {
+    std::unique_lock lock{latch};
+    assert(!writing && buffer.empty() && "reset() requires a flushed log");
+    file->resize(0);
+    file->sync();
+    buffer_lsn = 0;
+    flushed_lsn = 0;
+}
+
+}  // namespace buzzdb
@@ -0,0 +1,346 @@
+#include "storage/io_queue.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+
+namespace buzzdb {
+
+namespace {
+
+/// An io_uring instance, driven with the raw system calls. Each request in
+/// flight occupies a slot, whose index is the user data of its submission.
+class UringQueue : public IOQueue {
+public:
+    /// Returns a queue, or null if the kernel has no io_uring or one that
+    /// lacks the read and write operations.
+    static std::unique_ptr<UringQueue> open(size_t depth) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        int ring_fd = static_cast<int>(::syscall(__NR_io_uring_setup, static_cast<unsigned>(depth), &params));
+        if (ring_fd < 0) {
+            return nullptr;
+        }
+        // IORING_OP_READ and IORING_OP_WRITE came with the same kernel
+        // release as this feature.
+        if (!(params.features & IORING_FEAT_RW_CUR_POS)) {
+            ::close(ring_fd);
+            return nullptr;
+        }
+        return std::unique_ptr<UringQueue>(new UringQueue(depth, ring_fd, params));
+    }
+
+    ~UringQueue() override {
+        while (depth - free_slots.size() > 0) {
+            harvest(nullptr, 0, 0);
+            if (depth - free_slots.size() > 0) {
+                enter(1);
+            }
+        }
+        ::munmap(sqes, sqes_size);
+        if (cq_ring != sq_ring) {
+            ::munmap(cq_ring, cq_ring_size);
+        }
+        ::munmap(sq_ring, sq_ring_size);
+        ::close(ring_fd);
+    }
+
+    Backend get_backend() const override { return Backend::IO_URING; }
+
+    void submit() override {
+        for (auto& request : queued) {
+            if (request.file->get_descriptor() < 0) {
+                ready.push_back({request.tag, run(request)});
+                continue;
+            }
+            size_t slot = free_slots.back();
+            free_slots.pop_back();
+            slots[slot] = request;
+            push(slot);
+        }
+        queued.clear();
+        enter(0);
+    }
+
+    size_t reap(Completion* completions, size_t max_count, size_t min_count) override {
+        size_t count = 0;
+        while (count < max_count && !ready.empty()) {
+            completions[count++] = ready.back();
+            ready.pop_back();
+        }
+        while (true) {
+            count = harvest(completions, count, max_count);
+            if (count >= min_count) {
+                // Hand over the remainders of short transfers.
+                enter(0);
+                break;
+            }
+            enter(1);
+        }
+        pending -= count;
+        return count;
+    }
+
+private:
+    UringQueue(size_t depth, int ring_fd, const io_uring_params& params)
+        : IOQueue(depth), ring_fd(ring_fd), slots(depth) {
+        for (size_t slot = depth; slot > 0; --slot) {
+            free_slots.push_back(slot - 1);
+        }
+        sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+        }
+        sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+        cq_ring = single_mmap ? sq_ring : map(cq_ring_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(map(sqes_size, IORING_OFF_SQES));
+
+        auto* sq = static_cast<char*>(sq_ring);
+        sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto* cq = static_cast<char*>(cq_ring);
+        cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    void* map(size_t size, off_t offset) {
+        void* ring = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+        if (ring == MAP_FAILED) {
+            throw std::system_error{errno, std::system_category()};
+        }
+        return ring;
+    }
+
+    /// Adds the request in `slot` to the submission ring.
+    void push(size_t slot) {
+        const Request& request = slots[slot];
+        unsigned tail = *sq_tail;
+        unsigned index = tail & sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = request.is_write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe.fd = request.file->get_descriptor();
+        sqe.addr = reinterpret_cast<uint64_t>(request.block);
+        sqe.len = static_cast<uint32_t>(request.size);
+        sqe.off = request.offset;
+        sqe.user_data = slot;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++unsubmitted;
+    }
+
+    /// Submits the new entries of the submission ring and waits for
+    /// `min_complete` completions.
+    void enter(unsigned min_complete) {
+        unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+        while (unsubmitted > 0 || min_complete > 0) {
+            int result = static_cast<int>(
+                ::syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete, flags, nullptr, 0));
+            if (result < 0) {
+                if (errno == EINTR || errno == EAGAIN) {
+                    continue;
+                }
+                throw std::system_error{errno, std::system_category()};
+            }
+            unsubmitted -= static_cast<unsigned>(result);
+            min_complete = 0;
+        }
+    }
+
+    /// Moves finished requests from the completion ring to `completions`,
+    /// starting at `count`, until it holds `max_count`. Short transfers are
+    /// resubmitted for their remainder instead.
+    /// @return             The new number of completions.
+    size_t harvest(Completion* completions, size_t count, size_t max_count) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail && (!completions || count < max_count); ++head) {
+            const io_uring_cqe& cqe = cqes[head & cq_mask];
+            size_t slot = cqe.user_data;
+            Request& request = slots[slot];
+            int result = cqe.res;
+            if (result == -EINTR || result == -EAGAIN) {
+                push(slot);
+                continue;
+            }
+            if (result > 0 && static_cast<size_t>(result) < request.size) {
+                request.block += result;
+                request.offset += result;
+                request.size -= result;
+                push(slot);
+                continue;
+            }
+            // A read that returns 0 bytes hit the end of the file, which
+            // `File::read_block()` accepts as well.
+            if (completions) {
+                completions[count++] = {request.tag, result < 0 ? -result : 0};
+            }
+            free_slots.push_back(slot);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    int ring_fd;
+
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    io_uring_sqe* sqes;
+    size_t sqes_size;
+
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe* cqes;
+
+    /// Ring entries that were not handed to the kernel yet.
+    unsigned unsubmitted = 0;
+
+    /// The requests in flight, indexed by slot.
+    std::vector<Request> slots;
+    /// The slots that are not in use.
+    std::vector<size_t> free_slots;
+    /// Completions of requests that were run synchronously.
+    std::vector<Completion> ready;
+};
+
+
+/// Runs requests on a pool of threads.
+class ThreadPoolQueue : public IOQueue {
+public:
+    /// The maximum number of threads.
+    static constexpr size_t kMaxThreadCount = 16;
+
+    explicit ThreadPoolQueue(size_t depth) : IOQueue(depth) {
+        for (size_t i = 0; i < std::min(depth, kMaxThreadCount); ++i) {
+            threads.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPoolQueue() override {
+        {
+            std::unique_lock lock{latch};
+            stopping = true;
+            work_available.notify_all();
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    Backend get_backend() const override { return Backend::THREAD_POOL; }
+
+    void submit() override {
+        std::unique_lock lock{latch};
+        work_queue.insert(work_queue.end(), queued.begin(), queued.end());
+        queued.clear();
+        work_available.notify_all();
+    }
+
+    size_t reap(Completion* completions, size_t max_count, size_t min_count) override {
+        std::unique_lock lock{latch};
+        while (done.size() < min_count) {
+            work_done.wait(lock);
+        }
+        size_t count = std::min(max_count, done.size());
+        std::copy(done.end() - count, done.end(), completions);
+        done.resize(done.size() - count);
+        pending -= count;
+        return count;
+    }
+
+private:
+    void work() {
+        std::unique_lock lock{latch};
+        while (true) {
+            while (work_queue.empty() && !stopping) {
+                work_available.wait(lock);
+            }
+            // Requests that did not start yet are dropped.
+            if (stopping) {
+                return;
+            }
+            Request request = work_queue.front();
+            work_queue.pop_front();
+            lock.unlock();
+            int error = run(request);
+            lock.lock();
+            done.push_back({request.tag, error});
+            work_done.notify_one();
+        }
+    }
+
+    std::vector<std::thread> threads;
+
+    /// Protects the members below.
+    std::mutex latch;
+    std::condition_variable work_available;
+    std::condition_variable work_done;
+    /// Submitted requests that no thread took yet.
+    std::deque<Request> work_queue;
+    /// Completions that were not reaped yet.
+    std::vector<Completion> done;
+    bool stopping = false;
+};
+
+}  // namespace
+
+
+std::unique_ptr<IOQueue> IOQueue::create(size_t depth, Backend backend) {
+    if (backend != Backend::THREAD_POOL) {
+        if (auto queue = UringQueue::open(depth)) {
+            return queue;
+        }
+        if (backend == Backend::IO_URING) {
+            return nullptr;
+        }
+    }
+    return std::make_unique<ThreadPoolQueue>(depth);
+}
+
+
+void IOQueue::queue(const Request& request) {
+    assert(pending < depth && "too many pending requests");
+    queued.push_back(request);
+    ++pending;
+}
+
+
+int IOQueue::run(const Request& request) {
+    try {
+        if (request.is_write) {
+            request.file->write_block(request.block, request.offset, request.size);
+        } else {
+            request.file->read_block(request.offset, request.size, request.block);
+        }
+        return 0;
+    } catch (const std::system_error& e) {
+        return e.code().value();
+    } catch (...) {
+        return EIO;
+    }
+}
+
+}  // namespace buzzdb
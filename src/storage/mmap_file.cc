@@ -0,0 +1,98 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <system_error>
+
+#include "storage/mmap_file.h"
+
+namespace buzzdb {
+
+namespace {
+
+[[noreturn]] void throw_errno(int error = errno) {
+  throw std::system_error{error, std::system_category()};
+}
+
+int get_advice(MmapFile::Access access) {
+  switch (access) {
+    case MmapFile::NORMAL:
+      return MADV_NORMAL;
+    case MmapFile::RANDOM:
+      return MADV_RANDOM;
+    case MmapFile::SEQUENTIAL:
+      return MADV_SEQUENTIAL;
+    case MmapFile::WILL_NEED:
+      return MADV_WILLNEED;
+  }
+  return MADV_NORMAL;
+}
+
+}  // namespace
+
+std::unique_ptr<MmapFile> MmapFile::map_file(const char* filename,
+                                             Access access) {
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    throw_errno();
+  }
+  struct ::stat file_stat;
+  if (::fstat(fd, &file_stat) < 0) {
+    int error = errno;
+    ::close(fd);
+    throw_errno(error);
+  }
+  size_t size = file_stat.st_size;
+  char* data = nullptr;
+  // An empty mapping is invalid, so empty files have none.
+  if (size > 0) {
+    void* mapping = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+      int error = errno;
+      ::close(fd);
+      throw_errno(error);
+    }
+    data = static_cast<char*>(mapping);
+  }
+  std::unique_ptr<MmapFile> file{new MmapFile(fd, data, size)};
+  file->advise(access);
+  return file;
+}
+
+MmapFile::~MmapFile() {
+  if (data) {
+    ::munmap(data, mapping_size);
+  }
+  ::close(fd);
+}
+
+void MmapFile::resize(size_t /*new_size*/) { throw_errno(EBADF); }
+
+void MmapFile::read_block(size_t offset, size_t size, char* block) {
+  if (offset < mapping_size) {
+    std::memcpy(block, data + offset, std::min(size, mapping_size - offset));
+  }
+}
+
+void MmapFile::write_block(const char* /*block*/, size_t /*offset*/,
+                           size_t /*size*/) {
+  throw_errno(EBADF);
+}
+
+void MmapFile::advise(Access access, size_t offset, size_t size) {
+  if (offset >= mapping_size || size == 0) {
+    return;
+  }
+  size_t os_page_size = ::sysconf(_SC_PAGESIZE);
+  size_t begin = offset / os_page_size * os_page_size;
+  size_t end = std::min(offset + size, mapping_size);
+  if (::madvise(data + begin, end - begin, get_advice(access)) < 0) {
+    throw_errno();
+  }
+}
+
+}  // namespace buzzdb
@@ -3,10 +3,13 @@
 #include <stdlib.h>  // NOLINT
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <cerrno>
+#include <climits>
 #include <memory>
 #include <system_error>
+#include <vector>
 
 #include "storage/file.h"
 
@@ -18,6 +21,19 @@ namespace {
   throw std::system_error{errno, std::system_category()};
 }
 
+/// Returns the `open()` flags for `durability`.
+int get_durability_flags(File::Durability durability) {
+  switch (durability) {
+    case File::BUFFERED:
+      return 0;
+    case File::DSYNC:
+      return O_DSYNC;
+    case File::DIRECT:
+      return O_DIRECT;
+  }
+  return 0;
+}
+
 }  // namespace
 
 class PosixFile : public File {
@@ -34,17 +50,68 @@ class PosixFile : public File {
     return file_stat.st_size;
   }
 
+  /// Reads or writes the blocks, merging runs of adjacent ones into one
+  /// `preadv()` or `pwritev()`.
+  void transfer_blocks(const Block* blocks, size_t count, bool is_write) {
+    thread_local std::vector<::iovec> iovecs;
+    for (size_t begin = 0; begin < count;) {
+      size_t end = begin + 1;
+      while (end < count && end - begin < IOV_MAX &&
+             blocks[end - 1].offset + blocks[end - 1].size ==
+                 blocks[end].offset) {
+        ++end;
+      }
+      iovecs.clear();
+      for (size_t i = begin; i < end; ++i) {
+        iovecs.push_back({blocks[i].data, blocks[i].size});
+      }
+      transfer_run(iovecs.data(), iovecs.size(), blocks[begin].offset,
+                   is_write);
+      begin = end;
+    }
+  }
+
+  /// Reads or writes the contiguous range at `offset` that is described by
+  /// `iov`, which is consumed on the way.
+  void transfer_run(::iovec* iov, size_t iov_count, size_t offset,
+                    bool is_write) {
+    while (iov_count > 0) {
+      ssize_t bytes = is_write ? ::pwritev(fd, iov, iov_count, offset)
+                               : ::preadv(fd, iov, iov_count, offset);
+      if (bytes == 0) {
+        // end of file for reads, see `read_block()` and `write_block()`
+        return;
+      }
+      if (bytes < 0) {
+        throw_errno();
+      }
+      offset += static_cast<size_t>(bytes);
+      size_t remaining = static_cast<size_t>(bytes);
+      while (iov_count > 0 && remaining >= iov->iov_len) {
+        remaining -= iov->iov_len;
+        ++iov;
+        --iov_count;
+      }
+      if (remaining > 0) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + remaining;
+        iov->iov_len -= remaining;
+      }
+    }
+  }
+
  public:
   PosixFile(Mode mode, int fd, size_t size)
       : mode(mode), fd(fd), cached_size(size) {}
 
-  PosixFile(const char* filename, Mode mode) : mode(mode) {
+  PosixFile(const char* filename, Mode mode, Durability durability)
+      : mode(mode) {
+    int flags = get_durability_flags(durability);
     switch (mode) {
       case READ:
-        fd = ::open(filename, O_RDONLY | O_SYNC);
+        fd = ::open(filename, O_RDONLY | flags);
         break;
       case WRITE:
-        fd = ::open(filename, O_RDWR | O_CREAT | O_SYNC, 0666);
+        fd = ::open(filename, O_RDWR | O_CREAT | flags, 0666);
     }
     if (fd < 0) {
       throw_errno();
@@ -61,6 +128,8 @@ class PosixFile : public File {
 
   Mode get_mode() const override { return mode; }
 
+  int get_descriptor() const override { return fd; }
+
   size_t size() const override { return cached_size; }
 
   void resize(size_t new_size) override {
@@ -108,15 +177,44 @@ class PosixFile : public File {
       total_bytes_written += static_cast<size_t>(bytes_written);
     }
   }
+
+  void read_blocks(const Block* blocks, size_t count) override {
+    transfer_blocks(blocks, count, false);
+  }
+
+  void write_blocks(const Block* blocks, size_t count) override {
+    transfer_blocks(blocks, count, true);
+  }
+
+  void sync() override {
+    if (::fdatasync(fd) < 0) {
+      throw_errno();
+    }
+  }
+
+  void sync_range(size_t offset, size_t size) override {
+#ifdef __linux__
+    if (::sync_file_range(fd, offset, size,
+                          SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                              SYNC_FILE_RANGE_WAIT_AFTER) < 0) {
+      throw_errno();
+    }
+#else
+    static_cast<void>(offset);
+    static_cast<void>(size);
+    sync();
+#endif
+  }
 };
 
-std::unique_ptr<File> File::open_file(const char* filename, Mode mode) {
-  return std::make_unique<PosixFile>(filename, mode);
+std::unique_ptr<File> File::open_file(const char* filename, Mode mode,
+                                      Durability durability) {
+  return std::make_unique<PosixFile>(filename, mode, durability);
 }
 
-std::unique_ptr<File> File::make_temporary_file() {
+std::unique_ptr<File> File::make_temporary_file(Durability durability) {
   char file_template[] = ".tmpfile-XXXXXX";
-  int fd = ::mkstemp(file_template);
+  int fd = ::mkostemp(file_template, get_durability_flags(durability));
   if (fd < 0) {
     throw_errno();
   }
@@ -0,0 +1,152 @@
+#include "storage/segment.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <string>
+
+#include "common/error.h"
+
+
+namespace buzzdb {
+
+Segment::Segment(uint16_t segment_id, BufferManager& buffer_manager)
+    : segment_id(segment_id), buffer_manager(buffer_manager) {
+    // Existing segments are only read, so they can be opened read-only.
+    auto* frame = &buffer_manager.fix_page(get_header_page_id(), false);
+    if (reinterpret_cast<Header*>(frame->get_data())->magic == 0) {
+        buffer_manager.unfix_page(*frame, false);
+        frame = &buffer_manager.fix_page(get_header_page_id(), true);
+    }
+    auto* header = reinterpret_cast<Header*>(frame->get_data());
+    if (header->magic == 0) {
+        // A new segment. Its pages are all zeroes, so the maps are empty.
+        *header = Header{kMagic, kFormatVersion, 0, 0};
+        buffer_manager.unfix_page(*frame, true);
+        return;
+    }
+    Header copy = *header;
+    buffer_manager.unfix_page(*frame, false);
+    if (copy.magic != kMagic || copy.format_version != kFormatVersion) {
+        throw Exception("segment " + std::to_string(segment_id) +
+                        " has unsupported format version " + std::to_string(copy.format_version));
+    }
+    first_free = copy.first_free;
+    reserved_pages = copy.reserved_pages;
+}
+
+
+void Segment::read_metadata(void* data, size_t size) {
+    assert(sizeof(Header) + size <= buffer_manager.get_page_size());
+    auto& frame = buffer_manager.fix_page(get_header_page_id(), false);
+    std::memcpy(data, frame.get_data() + sizeof(Header), size);
+    buffer_manager.unfix_page(frame, false);
+}
+
+
+void Segment::write_metadata(const void* data, size_t size) {
+    assert(sizeof(Header) + size <= buffer_manager.get_page_size());
+    auto& frame = buffer_manager.fix_page(get_header_page_id(), true);
+    std::memcpy(frame.get_data() + sizeof(Header), data, size);
+    buffer_manager.unfix_page(frame, true);
+}
+
+
+void Segment::store_allocation_state() {
+    auto& frame = buffer_manager.fix_page(get_header_page_id(), true);
+    auto* header = reinterpret_cast<Header*>(frame.get_data());
+    header->first_free = first_free;
+    header->reserved_pages = reserved_pages;
+    buffer_manager.unfix_page(frame, true);
+}
+
+
+uint64_t Segment::allocate_page() {
+    std::unique_lock lock{allocator_latch};
+    // The map and the header are one log record.
+    BufferManager::AtomicChange change{buffer_manager};
+    uint64_t pages_per_map = get_pages_per_map();
+    uint64_t words_per_map = pages_per_map / 64;
+    for (uint64_t map_index = first_free / pages_per_map;; ++map_index) {
+        uint64_t map_page_id = get_map_page_id(map_index);
+        auto& frame = buffer_manager.fix_page(
+            BufferManager::get_overall_page_id(segment_id, map_page_id), true);
+        auto* words = reinterpret_cast<uint64_t*>(frame.get_data());
+        uint64_t word = map_index == first_free / pages_per_map
+            ? first_free % pages_per_map / 64 : 0;
+        for (; word < words_per_map; ++word) {
+            if (~words[word] == 0) {
+                continue;
+            }
+            uint64_t bit = __builtin_ctzll(~words[word]);
+            words[word] |= 1ull << bit;
+            buffer_manager.unfix_page(frame, true);
+
+            uint64_t index = word * 64 + bit;
+            first_free = map_index * pages_per_map + index + 1;
+            uint64_t segment_page_id = map_page_id + 1 + index;
+            if (segment_page_id >= reserved_pages) {
+                reserved_pages = (segment_page_id / kExtentPages + 1) * kExtentPages;
+                buffer_manager.reserve_pages(segment_id, reserved_pages);
+            }
+            store_allocation_state();
+            return BufferManager::get_overall_page_id(segment_id, segment_page_id);
+        }
+        buffer_manager.unfix_page(frame, false);
+    }
+}
+
+
+void Segment::free_page(uint64_t page_id) {
+    assert(BufferManager::get_segment_id(page_id) == segment_id);
+    uint64_t segment_page_id = BufferManager::get_segment_page_id(page_id);
+    uint64_t pages_per_map = get_pages_per_map();
+    assert(segment_page_id > 0 && (segment_page_id - 1) % (pages_per_map + 1) != 0 &&
+           "header and map pages are not allocated");
+    uint64_t map_index = (segment_page_id - 1) / (pages_per_map + 1);
+    uint64_t index = segment_page_id - get_map_page_id(map_index) - 1;
+
+    std::unique_lock lock{allocator_latch};
+    BufferManager::AtomicChange change{buffer_manager};
+    uint64_t map_page_id = get_map_page_id(map_index);
+    auto& frame = buffer_manager.fix_page(BufferManager::get_overall_page_id(segment_id, map_page_id), true);
+    auto* words = reinterpret_cast<uint64_t*>(frame.get_data());
+    assert(words[index / 64] & (1ull << (index % 64)) && "page is not allocated");
+    words[index / 64] &= ~(1ull << (index % 64));
+    // Only the last extent can have become free, but the ones before it may
+    // have been free already.
+    uint64_t page_count = reserved_pages;
+    if (segment_page_id < page_count && segment_page_id + kExtentPages >= page_count) {
+        while (is_extent_free(page_count - kExtentPages, map_page_id, words)) {
+            page_count -= kExtentPages;
+        }
+    }
+    buffer_manager.unfix_page(frame, true);
+    first_free = std::min(first_free, map_index * pages_per_map + index);
+    if (page_count < reserved_pages) {
+        buffer_manager.truncate_pages(segment_id, page_count);
+        reserved_pages = page_count;
+    }
+    store_allocation_state();
+}
+
+
+bool Segment::is_extent_free(uint64_t first_page_id, uint64_t map_page_id, const uint64_t* words) const {
+    uint64_t pages_per_map = get_pages_per_map();
+    for (uint64_t segment_page_id = first_page_id; segment_page_id < first_page_id + kExtentPages;
+         ++segment_page_id) {
+        if (segment_page_id == 0 || (segment_page_id - 1) % (pages_per_map + 1) == 0) {
+            return false;
+        }
+    }
+    assert(first_page_id > map_page_id && first_page_id + kExtentPages <= map_page_id + 1 + pages_per_map);
+    for (uint64_t index = first_page_id - map_page_id - 1; index < first_page_id - map_page_id - 1 + kExtentPages;
+         ++index) {
+        if (words[index / 64] & (1ull << (index % 64))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}  // namespace buzzdb
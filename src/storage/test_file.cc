@@ -53,4 +53,31 @@ void TestFile::write_block(const char* block, size_t offset, size_t size) {
   std::memcpy(file_content.data() + offset, block, size);
 }
 
+void TestFile::read_blocks(const Block* blocks, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (blocks[i].offset + blocks[i].size > file_content.size()) {
+      throw TestFileError{"trying to read past end of file"};
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(blocks[i].data, file_content.data() + blocks[i].offset,
+                blocks[i].size);
+  }
+}
+
+void TestFile::write_blocks(const Block* blocks, size_t count) {
+  if (mode == READ) {
+    throw TestFileError{"trying to write to a read only file"};
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (blocks[i].offset + blocks[i].size > file_content.size()) {
+      throw TestFileError{"trying to write past end of file"};
+    }
+  }
+  for (size_t i = 0; i < count; ++i) {
+    std::memcpy(file_content.data() + blocks[i].offset, blocks[i].data,
+                blocks[i].size);
+  }
+}
+
 }  // namespace buzzdb
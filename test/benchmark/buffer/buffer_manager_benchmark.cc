@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+
+#include "buffer/buffer_manager.h"
+
+using BufferManager = buzzdb::BufferManager;
+using File = buzzdb::File;
+
+namespace {
+
+constexpr uint16_t kSegmentId = 21;
+constexpr uint64_t kPageCount = 4096;
+
+/// Random exclusive fixes that dirty pages of a segment that is much larger
+/// than the pool, so most fixes evict a dirty page. The segment file is
+/// opened with `DSYNC`, so every write back reaches the device.
+/// state.range(0) is 1 if the page cleaner runs.
+void BM_DirtyFixes(benchmark::State& state) {
+  bool with_cleaner = state.range(0);
+  std::remove("21");
+  {
+    BufferManager buffer_manager(4096, 64, File::DSYNC);
+    buffer_manager.reserve_pages(kSegmentId, kPageCount);
+    if (with_cleaner) {
+      buffer_manager.start_cleaner(0.25);
+    }
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr(0, kPageCount - 1);
+    for (auto _ : state) {
+      auto& page = buffer_manager.fix_page(
+          BufferManager::get_overall_page_id(kSegmentId, distr(engine)), true);
+      ++*reinterpret_cast<uint64_t*>(page.get_data());
+      buffer_manager.unfix_page(page, true);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.SetLabel(with_cleaner ? "cleaner" : "no cleaner");
+  }
+  std::remove("21");
+}
+
+/// Shared fixes of random pages that are all resident, the path whose
+/// cost is dominated by the buffer manager's own bookkeeping.
+void BM_HitFixes(benchmark::State& state) {
+  constexpr uint64_t kResidentPages = 1024;
+  static BufferManager* buffer_manager;
+  if (state.thread_index() == 0) {
+    std::remove("21");
+    buffer_manager = new BufferManager(4096, kResidentPages);
+    for (uint64_t i = 0; i < kResidentPages; ++i) {
+      auto& page = buffer_manager->fix_page(BufferManager::get_overall_page_id(kSegmentId, i), false);
+      buffer_manager->unfix_page(page, false);
+    }
+  }
+  std::mt19937_64 engine{static_cast<uint64_t>(state.thread_index())};
+  std::uniform_int_distribution<uint64_t> distr(0, kResidentPages - 1);
+  for (auto _ : state) {
+    auto& page = buffer_manager->fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, distr(engine)), false);
+    benchmark::DoNotOptimize(page.get_data()[0]);
+    buffer_manager->unfix_page(page, false);
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0) {
+    delete buffer_manager;
+    std::remove("21");
+  }
+}
+
+}  // namespace
+
+BENCHMARK(BM_DirtyFixes)->Arg(0)->Arg(1)->UseRealTime();
+BENCHMARK(BM_HitFixes)->Threads(1)->Threads(4)->UseRealTime();
+
+BENCHMARK_MAIN();
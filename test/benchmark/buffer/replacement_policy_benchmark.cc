@@ -0,0 +1,102 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+
+using BufferManager = buzzdb::BufferManager;
+using File = buzzdb::File;
+using ReplacementPolicy = buzzdb::ReplacementPolicy;
+
+namespace {
+
+constexpr uint16_t kSegmentId = 22;
+constexpr size_t kPoolPages = 1024;
+constexpr size_t kTraceLength = 1 << 20;
+
+/// The page ids of a workload, in the order in which they are fixed.
+enum Workload {
+  /// Point lookups, 90% of them on 10% of 8 pool sizes of pages.
+  LOOKUPS,
+  /// The lookups interleaved with a scan of 32 pool sizes of other pages,
+  /// one scanned page per lookup.
+  LOOKUPS_AND_SCAN,
+  /// The lookups, but the hot pages move to other pages every 16 pool sizes
+  /// of fixes.
+  SHIFTING_LOOKUPS
+};
+
+std::vector<uint64_t> make_trace(Workload workload) {
+  constexpr uint64_t kLookupPages = 8 * kPoolPages;
+  constexpr uint64_t kScanPages = 32 * kPoolPages;
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<uint64_t> hot_distr(0, kLookupPages / 10 - 1);
+  std::uniform_int_distribution<uint64_t> cold_distr(kLookupPages / 10, kLookupPages - 1);
+  std::bernoulli_distribution is_hot(0.9);
+  auto lookup = [&] { return is_hot(engine) ? hot_distr(engine) : cold_distr(engine); };
+
+  std::vector<uint64_t> trace;
+  trace.reserve(kTraceLength);
+  for (uint64_t i = 0; trace.size() < kTraceLength; ++i) {
+    switch (workload) {
+      case LOOKUPS:
+        trace.push_back(lookup());
+        break;
+      case LOOKUPS_AND_SCAN:
+        trace.push_back(lookup());
+        trace.push_back(kLookupPages + i % kScanPages);
+        break;
+      case SHIFTING_LOOKUPS:
+        trace.push_back((lookup() + i / (16 * kPoolPages) * kLookupPages / 10) % kLookupPages);
+        break;
+    }
+  }
+  trace.resize(kTraceLength);
+  for (auto& page_id : trace) {
+    page_id = BufferManager::get_overall_page_id(kSegmentId, page_id);
+  }
+  return trace;
+}
+
+/// Replays a trace of shared fixes through a pool of `kPoolPages` pages.
+/// The pages are holes of the segment file, so misses cost a read that does
+/// not wait for a device. Reports the share of fixes that found their page
+/// resident.
+/// state.range(0) is the policy, state.range(1) the workload.
+void BM_ReplayTrace(benchmark::State& state) {
+  auto policy = static_cast<ReplacementPolicy::Kind>(state.range(0));
+  auto trace = make_trace(static_cast<Workload>(state.range(1)));
+  std::remove("22");
+  {
+    BufferManager buffer_manager(4096, kPoolPages, File::BUFFERED, policy);
+    buffer_manager.reserve_pages(kSegmentId, 41 * kPoolPages);
+    size_t position = 0;
+    size_t hits = 0;
+    for (auto _ : state) {
+      uint64_t page_id = trace[position];
+      position = (position + 1) % trace.size();
+      uint64_t version;
+      hits += buffer_manager.peek_page(page_id, version) != nullptr;
+      auto& page = buffer_manager.fix_page(page_id, false);
+      benchmark::DoNotOptimize(page.get_data()[0]);
+      buffer_manager.unfix_page(page, false);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["hit_ratio"] = static_cast<double>(hits) / state.iterations();
+    const char* policy_names[] = {"2Q", "CLOCK", "ARC"};
+    const char* workload_names[] = {"lookups", "lookups+scan", "shifting lookups"};
+    state.SetLabel(std::string(policy_names[policy]) + " " + workload_names[state.range(1)]);
+  }
+  std::remove("22");
+}
+
+}  // namespace
+
+BENCHMARK(BM_ReplayTrace)
+    ->ArgsProduct({{ReplacementPolicy::TWO_Q, ReplacementPolicy::CLOCK, ReplacementPolicy::ARC},
+                   {LOOKUPS, LOOKUPS_AND_SCAN, SHIFTING_LOOKUPS}});
+
+BENCHMARK_MAIN();
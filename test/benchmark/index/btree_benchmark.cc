@@ -0,0 +1,174 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "index/btree.h"
+
+using BufferManager = buzzdb::BufferManager;
+using BTree =
+    buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, 4096>;  // NOLINT
+
+namespace {
+
+/// Removes the segment file, so every tree starts with empty allocation maps.
+void remove_segment() { std::remove("0"); }
+
+/// Sorted entries with the given number of keys.
+std::vector<std::pair<uint64_t, uint64_t>> make_entries(uint64_t n) {
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  entries.reserve(n);
+  for (uint64_t i = 0; i < n; ++i) {
+    entries.emplace_back(i, 2 * i);
+  }
+  return entries;
+}
+
+void BM_BTreeInsertSorted(benchmark::State& state) {
+  auto entries = make_entries(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    remove_segment();
+    state.ResumeTiming();
+    BufferManager buffer_manager(4096, 1024);
+    BTree tree(0, buffer_manager);
+    for (auto& [key, value] : entries) {
+      tree.insert(key, value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Random entries with the given number of keys.
+std::vector<std::pair<uint64_t, uint64_t>> make_random_entries(uint64_t n) {
+  auto entries = make_entries(n);
+  std::shuffle(entries.begin(), entries.end(), std::mt19937_64{0});
+  return entries;
+}
+
+void BM_BTreeInsertRandom(benchmark::State& state) {
+  auto entries = make_random_entries(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    remove_segment();
+    state.ResumeTiming();
+    BufferManager buffer_manager(4096, 1024);
+    BTree tree(0, buffer_manager);
+    for (auto& [key, value] : entries) {
+      tree.insert(key, value);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_BTreeInsertBatch(benchmark::State& state) {
+  // Batches of state.range(1) random keys into a tree of state.range(0) keys.
+  auto entries = make_random_entries(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    remove_segment();
+    state.ResumeTiming();
+    BufferManager buffer_manager(4096, 1024);
+    BTree tree(0, buffer_manager);
+    for (auto it = entries.begin(); it != entries.end();) {
+      auto batch_end = it + std::min<int64_t>(state.range(1), entries.end() - it);
+      std::vector<std::pair<uint64_t, uint64_t>> batch(it, batch_end);
+      tree.insert_batch(batch.begin(), batch.end());
+      it = batch_end;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+void BM_BTreeBulkLoad(benchmark::State& state) {
+  auto entries = make_entries(state.range(0));
+  for (auto _ : state) {
+    state.PauseTiming();
+    remove_segment();
+    state.ResumeTiming();
+    BufferManager buffer_manager(4096, 1024);
+    BTree tree(0, buffer_manager);
+    tree.bulk_load(entries.begin(), entries.end());
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+/// Builds a tree of state.range(0) keys in a pool that holds all of it.
+/// Returns random probe keys, half of them missing.
+std::vector<uint64_t> make_probe_tree(benchmark::State& state, BTree& tree) {
+  auto entries = make_entries(state.range(0));
+  tree.bulk_load(entries.begin(), entries.end());
+  std::vector<uint64_t> keys(1 << 16);
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<uint64_t> distr(0, 2 * state.range(0));
+  for (auto& key : keys) {
+    key = distr(engine);
+  }
+  return keys;
+}
+
+void BM_BTreeLookup(benchmark::State& state) {
+  remove_segment();
+  BufferManager buffer_manager(4096, state.range(0) / 128);
+  BTree tree(0, buffer_manager);
+  auto keys = make_probe_tree(state, tree);
+  for (auto _ : state) {
+    for (auto key : keys) {
+      benchmark::DoNotOptimize(tree.lookup(key));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void BM_BTreeLookupMany(benchmark::State& state) {
+  remove_segment();
+  BufferManager buffer_manager(4096, state.range(0) / 128);
+  BTree tree(0, buffer_manager);
+  auto keys = make_probe_tree(state, tree);
+  std::vector<std::optional<uint64_t>> results(keys.size());
+  for (auto _ : state) {
+    tree.lookup_many(keys.data(), keys.size(), results.data());
+    benchmark::DoNotOptimize(results.data());
+  }
+  state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void BM_BTreeColdScan(benchmark::State& state) {
+  // A pool that starts empty and bypasses the page cache, so the scan reads
+  // every leaf from the disk.
+  remove_segment();
+  {
+    BufferManager buffer_manager(4096, 1024);
+    BTree tree(0, buffer_manager);
+    auto entries = make_entries(state.range(0));
+    tree.bulk_load(entries.begin(), entries.end());
+  }
+  for (auto _ : state) {
+    BufferManager buffer_manager(4096, 1024, buzzdb::File::DIRECT);
+    BTree tree(0, buffer_manager);
+    uint64_t sum = 0;
+    for (auto cursor = tree.scan(0, state.range(0)); cursor.is_valid();
+         cursor.next()) {
+      sum += cursor.value();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+}  // namespace
+
+BENCHMARK(BM_BTreeInsertSorted)->Arg(1 << 16)->Arg(1 << 20);
+BENCHMARK(BM_BTreeInsertRandom)->Arg(1 << 16);
+BENCHMARK(BM_BTreeInsertBatch)->Args({1 << 16, 1 << 8})->Args({1 << 16, 1 << 12});
+BENCHMARK(BM_BTreeBulkLoad)->Arg(1 << 16)->Arg(1 << 20);
+BENCHMARK(BM_BTreeLookup)->Arg(1 << 16)->Arg(1 << 24);
+BENCHMARK(BM_BTreeLookupMany)->Arg(1 << 16)->Arg(1 << 24);
+BENCHMARK(BM_BTreeColdScan)->Arg(1 << 20)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,59 @@
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "index/key_search.h"
+
+namespace {
+
+/// A node worth of sorted keys and lookup keys that hit all of its slots.
+struct Node {
+  std::vector<uint64_t> keys;
+  std::vector<uint64_t> probes;
+
+  explicit Node(uint32_t count) : keys(count), probes(1024) {
+    std::mt19937_64 engine{0};
+    for (auto& key : keys) {
+      key = engine();
+    }
+    std::sort(keys.begin(), keys.end());
+    for (auto& probe : probes) {
+      probe = engine();
+    }
+  }
+};
+
+/// The scalar binary search that the nodes used before.
+void BM_NodeSearchScalar(benchmark::State& state) {
+  Node node(static_cast<uint32_t>(state.range(0)));
+  size_t i = 0;
+  for (auto _ : state) {
+    auto probe = node.probes[i++ & 1023];
+    auto it = std::lower_bound(node.keys.begin(), node.keys.end(), probe);
+    benchmark::DoNotOptimize(it);
+  }
+}
+
+/// The kernel picked for `uint64_t` keys in this build.
+void BM_NodeSearchKernel(benchmark::State& state) {
+  Node node(static_cast<uint32_t>(state.range(0)));
+  auto count = static_cast<uint32_t>(node.keys.size());
+  size_t i = 0;
+  for (auto _ : state) {
+    auto probe = node.probes[i++ & 1023];
+    auto index = buzzdb::KeySearch<uint64_t, std::less<uint64_t>>::lower_bound(
+        node.keys.data(), count, probe);
+    benchmark::DoNotOptimize(index);
+  }
+}
+
+}  // namespace
+
+// Node capacities for 1 KiB, 4 KiB and 16 KiB pages.
+BENCHMARK(BM_NodeSearchScalar)->Arg(63)->Arg(255)->Arg(1023);
+BENCHMARK(BM_NodeSearchKernel)->Arg(63)->Arg(255)->Arg(1023);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,28 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <memory>
+
+#include "log/log_manager.h"
+#include "storage/file.h"
+
+using File = buzzdb::File;
+using LogManager = buzzdb::LogManager;
+
+namespace {
+
+void BM_LogManagerCommit(benchmark::State& state) {
+  // All threads commit small records to one log; concurrent commits share
+  // the synchronous writes of the log file.
+  static LogManager log(File::make_temporary_file());
+  char record[64] = {};
+  for (auto _ : state) {
+    log.flush(log.append(record, sizeof(record)));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}  // namespace
+
+BENCHMARK(BM_LogManagerCommit)->Threads(1)->Threads(4)->Threads(16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,100 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "storage/file.h"
+
+using File = buzzdb::File;
+
+namespace {
+
+constexpr size_t kBlockSize = 4096;
+constexpr size_t kFileSize = 64 << 20;
+
+/// Random block writes into a temporary file. state.range(0) is the
+/// `File::Durability`, state.range(1) the number of writes per `sync()`, or
+/// 0 for none.
+void BM_FileWrite(benchmark::State& state) {
+  auto durability = static_cast<File::Durability>(state.range(0));
+  auto sync_interval = state.range(1);
+  std::unique_ptr<File> file;
+  try {
+    file = File::make_temporary_file(durability);
+  } catch (const std::exception& e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+  file->resize(kFileSize);
+  std::unique_ptr<char, decltype(&std::free)> block{
+      static_cast<char*>(std::aligned_alloc(File::kDirectAlignment, kBlockSize)),
+      &std::free};
+  std::memset(block.get(), 'b', kBlockSize);
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<size_t> distr(0, kFileSize / kBlockSize - 1);
+
+  int64_t writes = 0;
+  for (auto _ : state) {
+    file->write_block(block.get(), distr(engine) * kBlockSize, kBlockSize);
+    if (sync_interval != 0 && ++writes % sync_interval == 0) {
+      file->sync();
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * kBlockSize);
+  const char* names[] = {"buffered", "dsync", "direct"};
+  state.SetLabel(names[durability]);
+}
+
+/// Writes runs of state.range(0) adjacent blocks, such as neighbouring
+/// dirty pages, with one `write_block()` per block or, if state.range(1) is
+/// 1, with one `write_blocks()` per run.
+void BM_FileWriteRun(benchmark::State& state) {
+  auto run_length = static_cast<size_t>(state.range(0));
+  bool vectored = state.range(1);
+  auto file = File::make_temporary_file();
+  file->resize(kFileSize);
+  std::vector<char> data(run_length * kBlockSize, 'r');
+  std::vector<File::Block> blocks;
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<size_t> distr(
+      0, kFileSize / kBlockSize - run_length);
+
+  for (auto _ : state) {
+    size_t offset = distr(engine) * kBlockSize;
+    if (vectored) {
+      blocks.clear();
+      for (size_t i = 0; i < run_length; ++i) {
+        blocks.push_back(
+            {offset + i * kBlockSize, kBlockSize, data.data() + i * kBlockSize});
+      }
+      file->write_blocks(blocks.data(), blocks.size());
+    } else {
+      for (size_t i = 0; i < run_length; ++i) {
+        file->write_block(data.data() + i * kBlockSize, offset + i * kBlockSize,
+                          kBlockSize);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * run_length);
+  state.SetBytesProcessed(state.iterations() * run_length * kBlockSize);
+  state.SetLabel(vectored ? "write_blocks" : "write_block");
+}
+
+}  // namespace
+
+BENCHMARK(BM_FileWrite)
+    ->Args({File::BUFFERED, 0})
+    ->Args({File::BUFFERED, 1})
+    ->Args({File::BUFFERED, 64})
+    ->Args({File::DSYNC, 0})
+    ->Args({File::DIRECT, 0})
+    ->Args({File::DIRECT, 64})
+    ->UseRealTime();
+
+BENCHMARK(BM_FileWriteRun)->ArgsProduct({{8, 64}, {0, 1}});
+
+BENCHMARK_MAIN();
@@ -0,0 +1,85 @@
+#include <benchmark/benchmark.h>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "storage/file.h"
+#include "storage/io_queue.h"
+
+using File = buzzdb::File;
+using IOQueue = buzzdb::IOQueue;
+
+namespace {
+
+constexpr size_t kBlockSize = 4096;
+constexpr size_t kFileSize = 64 << 20;
+
+/// Random block reads from a temporary file, with direct I/O where the file
+/// system supports it. Keeps state.range(1) reads in flight.
+/// state.range(0) is the `IOQueue::Backend`.
+void BM_IOQueueRead(benchmark::State& state) {
+  auto backend = static_cast<IOQueue::Backend>(state.range(0));
+  auto depth = static_cast<size_t>(state.range(1));
+  auto queue = IOQueue::create(depth, backend);
+  if (!queue) {
+    state.SkipWithError("io_uring is not supported");
+    return;
+  }
+  std::unique_ptr<File> file;
+  try {
+    file = File::make_temporary_file(File::DIRECT);
+  } catch (const std::exception&) {
+    file = File::make_temporary_file();
+  }
+  file->resize(kFileSize);
+  std::unique_ptr<char, decltype(&std::free)> blocks{
+      static_cast<char*>(
+          std::aligned_alloc(File::kDirectAlignment, depth * kBlockSize)),
+      &std::free};
+  std::memset(blocks.get(), 'b', depth * kBlockSize);
+  for (size_t offset = 0; offset < kFileSize; offset += kBlockSize) {
+    file->write_block(blocks.get(), offset, kBlockSize);
+  }
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<size_t> distr(0, kFileSize / kBlockSize - 1);
+
+  // Every iteration reaps one read and queues the next one into its block.
+  for (size_t i = 0; i < depth; ++i) {
+    queue->read(*file, distr(engine) * kBlockSize, kBlockSize,
+                blocks.get() + i * kBlockSize, i);
+  }
+  queue->submit();
+  std::vector<IOQueue::Completion> completions(depth);
+  int64_t reads = 0;
+  for (auto _ : state) {
+    size_t count = queue->reap(completions.data(), depth, 1);
+    for (size_t i = 0; i < count; ++i) {
+      uint64_t tag = completions[i].tag;
+      queue->read(*file, distr(engine) * kBlockSize, kBlockSize,
+                  blocks.get() + tag * kBlockSize, tag);
+    }
+    queue->submit();
+    reads += count;
+  }
+  while (queue->get_pending() > 0) {
+    queue->reap(completions.data(), depth, 1);
+  }
+  state.SetItemsProcessed(reads);
+  state.SetBytesProcessed(reads * kBlockSize);
+  state.SetLabel(queue->get_backend() == IOQueue::Backend::IO_URING
+                     ? "io_uring"
+                     : "thread pool");
+}
+
+}  // namespace
+
+BENCHMARK(BM_IOQueueRead)
+    ->ArgsProduct({{static_cast<int64_t>(IOQueue::Backend::IO_URING),
+                    static_cast<int64_t>(IOQueue::Backend::THREAD_POOL)},
+                   {1, 32}})
+    ->UseRealTime();
+
+BENCHMARK_MAIN();
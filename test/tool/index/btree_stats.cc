@@ -0,0 +1,109 @@
+// Prints the statistics of the B-tree in a segment file of the current
+// directory. The segment is mapped read-only, so the file is not changed.
+//
+//   btree_stats <segment_id> [--full] [--page_size=<bytes>]
+//
+// By default the node counts and fill histograms are estimated from random
+// paths, `--full` visits every node. Keys and values are 64 bit integers.
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+
+#include "index/btree.h"
+
+using BufferManager = buzzdb::BufferManager;
+
+namespace {
+
+template <size_t PageSize>
+void print_stats(uint16_t segment_id, bool full) {
+  using BTree = buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, PageSize>;
+
+  // A mapped segment needs no frames of its own.
+  BufferManager buffer_manager(PageSize, 16);
+  buffer_manager.map_segment(segment_id);
+  BTree tree(segment_id, buffer_manager);
+  auto stats = tree.get_stats(full ? BTree::FULL : BTree::SAMPLED);
+
+  auto node_count = std::accumulate(stats.level_node_counts.begin(),
+                                    stats.level_node_counts.end(), 0ul);
+  std::cout << "segment " << segment_id << ": height " << stats.height << ", "
+            << node_count << " nodes"
+            << (stats.is_sampled ? " (estimated from a sample)" : "") << "\n";
+  for (size_t level = stats.level_node_counts.size(); level > 0; --level) {
+    std::cout << "  level " << level - 1 << ": "
+              << stats.level_node_counts[level - 1] << " nodes\n";
+  }
+
+  auto print_fill = [](const char* name, double fill_factor,
+                       const auto& histogram) {
+    std::cout << name << " fill " << std::fixed << std::setprecision(1)
+              << 100 * fill_factor << "%\n";
+    for (size_t i = 0; i < histogram.size(); ++i) {
+      std::cout << "  " << std::setw(3) << 100 * i / histogram.size() << "-"
+                << std::setw(3) << 100 * (i + 1) / histogram.size()
+                << "%: " << histogram[i] << "\n";
+    }
+  };
+  print_fill("leaf", stats.leaf_fill_factor, stats.leaf_fill);
+  print_fill("inner", stats.inner_fill_factor, stats.inner_fill);
+
+  // The counters only cover this run, which is read-only, but are printed
+  // for completeness.
+  std::cout << "splits: " << stats.leaf_splits << " leaf, "
+            << stats.inner_splits << " inner\n"
+            << "merges: " << stats.leaf_merges << " leaf, "
+            << stats.inner_merges << " inner\n"
+            << "traversals: " << stats.traversals << " ("
+            << stats.traversal_restarts << " restarts)\n";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0]
+              << " <segment_id> [--full] [--page_size=<bytes>]\n";
+    return 1;
+  }
+  auto segment_id = static_cast<uint16_t>(std::strtoul(argv[1], nullptr, 10));
+  bool full = false;
+  size_t page_size = 4096;
+  for (int i = 2; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--full") == 0) {
+      full = true;
+    } else if (std::strncmp(argv[i], "--page_size=", 12) == 0) {
+      page_size = std::strtoul(argv[i] + 12, nullptr, 10);
+    } else {
+      std::cerr << "unknown argument " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  try {
+    switch (page_size) {
+      case 1024:
+        print_stats<1024>(segment_id, full);
+        break;
+      case 4096:
+        print_stats<4096>(segment_id, full);
+        break;
+      case 16384:
+        print_stats<16384>(segment_id, full);
+        break;
+      default:
+        std::cerr << "unsupported page size " << page_size << "\n";
+        return 1;
+    }
+  } catch (const std::exception& e) {
+    std::cerr << "segment " << segment_id << ": " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,880 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+#include "common/error.h"
+#include "storage/test_file.h"
+
+using BufferFrame = buzzdb::BufferFrame;
+using BufferManager = buzzdb::BufferManager;
+using ReplacementPolicy = buzzdb::ReplacementPolicy;
+
+namespace {
+
+/// Removes the segment files that the tests write.
+void remove_segment_files() {
+  for (const char* filename : {"0", "1", "2", "3", "4", "5", "6"}) {
+    std::remove(filename);
+  }
+}
+
+/// A file whose reads and writes fail while `is_failing` is set.
+class FailingFile : public buzzdb::TestFile {
+ public:
+  std::atomic<bool> is_failing = false;
+  /// The number of failed calls.
+  std::atomic<size_t> failures = 0;
+
+  void read_block(size_t offset, size_t size, char* block) override {
+    check();
+    TestFile::read_block(offset, size, block);
+  }
+
+  void write_block(const char* block, size_t offset, size_t size) override {
+    check();
+    TestFile::write_block(block, offset, size);
+  }
+
+  void read_blocks(const Block* blocks, size_t count) override {
+    check();
+    TestFile::read_blocks(blocks, count);
+  }
+
+  void write_blocks(const Block* blocks, size_t count) override {
+    check();
+    TestFile::write_blocks(blocks, count);
+  }
+
+ private:
+  void check() {
+    if (is_failing) {
+      ++failures;
+      throw std::system_error{EIO, std::system_category()};
+    }
+  }
+};
+
+/// Waits up to 10 seconds for `condition`.
+template <typename Condition>
+bool wait_for(Condition condition) {
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!condition()) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return false;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return true;
+}
+
+/// Starts every test without segment files and removes those it wrote.
+class BufferManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { remove_segment_files(); }
+  void TearDown() override { remove_segment_files(); }
+};
+
+TEST_F(BufferManagerTest, FixSingle) {
+  BufferManager buffer_manager{1024, 10};
+  std::vector<uint64_t> expected_values(1024 / sizeof(uint64_t), 123);
+  {
+    auto& page = buffer_manager.fix_page(1, true);
+    std::memcpy(page.get_data(), expected_values.data(), 1024);
+    buffer_manager.unfix_page(page, true);
+    EXPECT_EQ(std::vector<uint64_t>{1}, buffer_manager.get_fifo_list());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+  }
+  {
+    std::vector<uint64_t> values(1024 / sizeof(uint64_t));
+    auto& page = buffer_manager.fix_page(1, false);
+    std::memcpy(values.data(), page.get_data(), 1024);
+    buffer_manager.unfix_page(page, true);
+    EXPECT_TRUE(buffer_manager.get_fifo_list().empty());
+    EXPECT_EQ(std::vector<uint64_t>{1}, buffer_manager.get_lru_list());
+    ASSERT_EQ(expected_values, values);
+  }
+}
+
+TEST_F(BufferManagerTest, PersistentRestart) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 10);
+  for (uint16_t segment = 0; segment < 3; ++segment) {
+    for (uint64_t segment_page = 0; segment_page < 10; ++segment_page) {
+      uint64_t page_id =
+          BufferManager::get_overall_page_id(segment, segment_page);
+      auto& page = buffer_manager->fix_page(page_id, true);
+      uint64_t& value = *reinterpret_cast<uint64_t*>(page.get_data());
+      value = segment * 10 + segment_page;
+      buffer_manager->unfix_page(page, true);
+    }
+  }
+  // Destroy the buffer manager and create a new one.
+  buffer_manager = std::make_unique<BufferManager>(1024, 10);
+  for (uint16_t segment = 0; segment < 3; ++segment) {
+    for (uint64_t segment_page = 0; segment_page < 10; ++segment_page) {
+      uint64_t page_id =
+          BufferManager::get_overall_page_id(segment, segment_page);
+      auto& page = buffer_manager->fix_page(page_id, false);
+      uint64_t value = *reinterpret_cast<uint64_t*>(page.get_data());
+      buffer_manager->unfix_page(page, false);
+      EXPECT_EQ(segment * 10 + segment_page, value);
+    }
+  }
+}
+
+TEST_F(BufferManagerTest, MappedSegment) {
+  constexpr uint16_t kSegmentId = 3;
+  std::remove("3");
+  {
+    BufferManager buffer_manager{1024, 10};
+    for (uint64_t segment_page = 0; segment_page < 10; ++segment_page) {
+      auto& page = buffer_manager.fix_page(
+          BufferManager::get_overall_page_id(kSegmentId, segment_page), true);
+      *reinterpret_cast<uint64_t*>(page.get_data()) = segment_page;
+      buffer_manager.unfix_page(page, true);
+    }
+  }
+  // Far fewer frames than pages, but mapped pages take none of them.
+  BufferManager buffer_manager{1024, 1};
+  buffer_manager.map_segment(kSegmentId);
+  std::vector<BufferFrame*> fixed;
+  for (uint64_t segment_page = 0; segment_page < 10; ++segment_page) {
+    auto& page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, segment_page), false);
+    EXPECT_EQ(*reinterpret_cast<uint64_t*>(page.get_data()), segment_page);
+    fixed.push_back(&page);
+  }
+  uint64_t version;
+  EXPECT_EQ(buffer_manager.peek_page(
+                BufferManager::get_overall_page_id(kSegmentId, 4), version),
+            fixed[4]);
+  for (auto* page : fixed) {
+    buffer_manager.unfix_page(*page, false);
+  }
+  EXPECT_TRUE(buffer_manager.get_fifo_list().empty());
+  EXPECT_THROW(buffer_manager.fix_page(
+                   BufferManager::get_overall_page_id(kSegmentId, 0), true),
+               buzzdb::Exception);
+  EXPECT_THROW(buffer_manager.fix_page(
+                   BufferManager::get_overall_page_id(kSegmentId, 10), false),
+               buzzdb::Exception);
+
+  // Other segments still use the pool
+  auto& page = buffer_manager.fix_page(1, true);
+  buffer_manager.unfix_page(page, false);
+  EXPECT_EQ(buffer_manager.get_fifo_list(), std::vector<uint64_t>{1});
+  std::remove("3");
+}
+
+TEST_F(BufferManagerTest, Prefetch) {
+  constexpr uint16_t kSegmentId = 6;
+  std::remove("6");
+  std::vector<uint64_t> page_ids;
+  for (uint64_t segment_page = 0; segment_page < 20; ++segment_page) {
+    page_ids.push_back(
+        BufferManager::get_overall_page_id(kSegmentId, segment_page));
+  }
+  {
+    BufferManager buffer_manager{1024, 10};
+    for (uint64_t i = 0; i < page_ids.size(); ++i) {
+      auto& page = buffer_manager.fix_page(page_ids[i], true);
+      *reinterpret_cast<uint64_t*>(page.get_data()) = i + 1;
+      buffer_manager.unfix_page(page, true);
+    }
+  }
+
+  BufferManager buffer_manager{1024, 30};
+  buffer_manager.prefetch(page_ids.data(), 10);
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (buffer_manager.get_fifo_list().size() < 10 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  EXPECT_EQ(buffer_manager.get_fifo_list(),
+            std::vector<uint64_t>(page_ids.begin(), page_ids.begin() + 10));
+  // The first fix of a prefetched page is its first access
+  auto& page = buffer_manager.fix_page(page_ids[0], false);
+  EXPECT_EQ(*reinterpret_cast<uint64_t*>(page.get_data()), 1u);
+  buffer_manager.unfix_page(page, false);
+  EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+
+  // Fixes of pages in flight wait for them
+  buffer_manager.prefetch(page_ids.data() + 10, 10);
+  for (uint64_t i = 10; i < page_ids.size(); ++i) {
+    auto& page = buffer_manager.fix_page(page_ids[i], false);
+    EXPECT_EQ(*reinterpret_cast<uint64_t*>(page.get_data()), i + 1);
+    buffer_manager.unfix_page(page, false);
+  }
+  // Pages past the end of the file are zero
+  uint64_t new_page_id = BufferManager::get_overall_page_id(kSegmentId, 100);
+  buffer_manager.prefetch(&new_page_id, 1);
+  auto& new_page = buffer_manager.fix_page(new_page_id, false);
+  EXPECT_EQ(*reinterpret_cast<uint64_t*>(new_page.get_data()), 0u);
+  buffer_manager.unfix_page(new_page, false);
+  std::remove("6");
+}
+
+TEST_F(BufferManagerTest, PrefetchErrors) {
+  BufferManager buffer_manager{1024, 8};
+  auto dirty_file = std::make_unique<FailingFile>();
+  auto* dirty = dirty_file.get();
+  buffer_manager.set_segment_file(1, std::move(dirty_file));
+  auto prefetched_file = std::make_unique<FailingFile>();
+  auto* prefetched = prefetched_file.get();
+  prefetched->get_content().resize(8 * 1024);
+  std::vector<uint64_t> page_ids;
+  for (uint64_t i = 0; i < 8; ++i) {
+    page_ids.push_back(BufferManager::get_overall_page_id(2, i));
+    prefetched->get_content()[i * 1024] = static_cast<char>(i + 1);
+  }
+  buffer_manager.set_segment_file(2, std::move(prefetched_file));
+
+  // The pool is full of dirty pages, which cannot be written back
+  for (uint64_t i = 0; i < 8; ++i) {
+    auto& page = buffer_manager.fix_page(BufferManager::get_overall_page_id(1, i), true);
+    page.get_data()[0] = static_cast<char>(i + 1);
+    buffer_manager.unfix_page(page, true);
+  }
+  dirty->is_failing = true;
+  buffer_manager.prefetch(page_ids.data(), 4);
+  ASSERT_TRUE(wait_for([&] { return dirty->failures > 0; }));
+
+  // The prefetcher survived the error
+  dirty->is_failing = false;
+  buffer_manager.prefetch(page_ids.data(), 4);
+  EXPECT_TRUE(
+      wait_for([&] { return buffer_manager.get_stats().prefetches == 4; }));
+
+  // Pages whose reads failed are not left latched
+  prefetched->is_failing = true;
+  buffer_manager.prefetch(page_ids.data() + 4, 4);
+  ASSERT_TRUE(wait_for([&] { return prefetched->failures >= 4; }));
+  prefetched->is_failing = false;
+  for (uint64_t i = 0; i < 8; ++i) {
+    auto& page = buffer_manager.fix_page(page_ids[i], false);
+    EXPECT_EQ(page.get_data()[0], static_cast<char>(i + 1));
+    buffer_manager.unfix_page(page, false);
+  }
+  for (uint64_t i = 0; i < 8; ++i) {
+    auto& page = buffer_manager.fix_page(BufferManager::get_overall_page_id(1, i), false);
+    EXPECT_EQ(page.get_data()[0], static_cast<char>(i + 1));
+    buffer_manager.unfix_page(page, false);
+  }
+}
+
+TEST_F(BufferManagerTest, DestructorIgnoresWriteErrors) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 8);
+  auto file = std::make_unique<FailingFile>();
+  auto* failing_file = file.get();
+  buffer_manager->set_segment_file(1, std::move(file));
+  auto& page =
+      buffer_manager->fix_page(BufferManager::get_overall_page_id(1, 0), true);
+  page.get_data()[0] = 1;
+  buffer_manager->unfix_page(page, true);
+
+  failing_file->is_failing = true;
+  EXPECT_THROW(buffer_manager->checkpoint(), std::system_error);
+  buffer_manager.reset();
+}
+
+TEST_F(BufferManagerTest, FIFOEvict) {
+  BufferManager buffer_manager{1024, 10};
+  for (uint64_t i = 1; i < 11; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    buffer_manager.unfix_page(page, false);
+  }
+  {
+    std::vector<uint64_t> expected_fifo{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    EXPECT_EQ(expected_fifo, buffer_manager.get_fifo_list());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+  }
+  {
+    auto& page = buffer_manager.fix_page(11, false);
+    buffer_manager.unfix_page(page, false);
+  }
+  {
+    std::vector<uint64_t> expected_fifo{2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+    EXPECT_EQ(expected_fifo, buffer_manager.get_fifo_list());
+    EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+  }
+}
+
+TEST_F(BufferManagerTest, BufferFull) {
+  BufferManager buffer_manager{1024, 10};
+  std::vector<BufferFrame*> pages;
+  pages.reserve(10);
+  for (uint64_t i = 1; i < 11; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    pages.push_back(&page);
+  }
+  EXPECT_THROW(buffer_manager.fix_page(11, false), buzzdb::buffer_full_error);
+  for (auto* page : pages) {
+    buffer_manager.unfix_page(*page, false);
+  }
+}
+
+TEST_F(BufferManagerTest, MoveToLRU) {
+  BufferManager buffer_manager{1024, 10};
+  auto& fifo_page = buffer_manager.fix_page(1, false);
+  auto* lru_page = &buffer_manager.fix_page(2, false);
+  buffer_manager.unfix_page(fifo_page, false);
+  buffer_manager.unfix_page(*lru_page, false);
+  EXPECT_EQ((std::vector<uint64_t>{1, 2}), buffer_manager.get_fifo_list());
+  EXPECT_TRUE(buffer_manager.get_lru_list().empty());
+  lru_page = &buffer_manager.fix_page(2, false);
+  buffer_manager.unfix_page(*lru_page, false);
+  EXPECT_EQ(std::vector<uint64_t>{1}, buffer_manager.get_fifo_list());
+  EXPECT_EQ(std::vector<uint64_t>{2}, buffer_manager.get_lru_list());
+}
+
+TEST_F(BufferManagerTest, LRURefresh) {
+  BufferManager buffer_manager{1024, 10};
+  for (uint64_t i = 1; i < 4; ++i) {
+    for (size_t j = 0; j < 2; ++j) {
+      auto& page = buffer_manager.fix_page(i, false);
+      buffer_manager.unfix_page(page, false);
+    }
+  }
+  EXPECT_EQ((std::vector<uint64_t>{1, 2, 3}), buffer_manager.get_lru_list());
+  auto& page = buffer_manager.fix_page(1, false);
+  buffer_manager.unfix_page(page, false);
+  EXPECT_EQ((std::vector<uint64_t>{2, 3, 1}), buffer_manager.get_lru_list());
+}
+
+TEST_F(BufferManagerTest, EvictDirtyPage) {
+  BufferManager buffer_manager{1024, 2};
+  {
+    auto& page = buffer_manager.fix_page(1, true);
+    *reinterpret_cast<uint64_t*>(page.get_data()) = 4242;
+    buffer_manager.unfix_page(page, true);
+  }
+  // Push page 1 out of the pool and load it again from disk.
+  for (uint64_t i = 2; i < 4; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    buffer_manager.unfix_page(page, false);
+  }
+  EXPECT_EQ((std::vector<uint64_t>{2, 3}), buffer_manager.get_fifo_list());
+  auto& page = buffer_manager.fix_page(1, false);
+  EXPECT_EQ(4242u, *reinterpret_cast<uint64_t*>(page.get_data()));
+  buffer_manager.unfix_page(page, false);
+}
+
+TEST_F(BufferManagerTest, Stats) {
+  std::remove("0");
+  BufferManager buffer_manager{1024, 2};
+  {
+    auto& page = buffer_manager.fix_page(1, true);
+    buffer_manager.unfix_page(page, true);
+  }
+  auto stats = buffer_manager.get_stats();
+  EXPECT_EQ(0u, stats.hits);
+  EXPECT_EQ(1u, stats.misses);
+  EXPECT_EQ(1u, stats.resident_pages);
+  EXPECT_EQ(1u, stats.dirty_pages);
+
+  // Push page 1 out of the pool, which writes it back, and load it again.
+  for (uint64_t page_id : {2, 3, 1, 1}) {
+    auto& page = buffer_manager.fix_page(page_id, false);
+    buffer_manager.unfix_page(page, false);
+  }
+  stats = buffer_manager.get_stats();
+  EXPECT_EQ(1u, stats.hits);
+  EXPECT_EQ(4u, stats.misses);
+  EXPECT_DOUBLE_EQ(0.2, stats.get_hit_ratio());
+  EXPECT_EQ(0u, stats.prefetches);
+  EXPECT_EQ(2u, stats.evictions);
+  EXPECT_EQ(1u, stats.write_backs);
+  EXPECT_EQ(1024u, stats.written_bytes);
+  // Pages 2 and 3 were never written, so only page 1 is read.
+  EXPECT_EQ(1024u, stats.read_bytes);
+  EXPECT_EQ(2u, stats.resident_pages);
+  EXPECT_EQ(0u, stats.dirty_pages);
+}
+
+TEST_F(BufferManagerTest, StatsToJson) {
+  BufferManager::Stats stats;
+  EXPECT_EQ(0, stats.get_hit_ratio());
+  stats.hits = 3;
+  stats.misses = 1;
+  stats.prefetches = 2;
+  stats.evictions = 4;
+  stats.write_backs = 5;
+  stats.read_bytes = 4096;
+  stats.written_bytes = 5120;
+  stats.latch_wait_ns = 42;
+  stats.resident_pages = 10;
+  stats.dirty_pages = 6;
+  EXPECT_EQ(
+      "{\"hits\":3,\"misses\":1,\"hit_ratio\":0.75,\"prefetches\":2,"
+      "\"evictions\":4,\"write_backs\":5,\"read_bytes\":4096,"
+      "\"written_bytes\":5120,\"latch_wait_ns\":42,\"resident_pages\":10,"
+      "\"dirty_pages\":6}",
+      stats.to_json());
+}
+
+TEST_F(BufferManagerTest, CyclePagesThroughSmallPool) {
+  BufferManager buffer_manager{1024, 8};
+  for (size_t round = 0; round < 2; ++round) {
+    for (uint64_t i = 0; i < 1000; ++i) {
+      auto& page = buffer_manager.fix_page(i, round == 0);
+      uint64_t& value = *reinterpret_cast<uint64_t*>(page.get_data());
+      if (round == 0) {
+        value = i * 7;
+      } else {
+        EXPECT_EQ(i * 7, value);
+      }
+      buffer_manager.unfix_page(page, round == 0);
+    }
+  }
+}
+
+TEST_F(BufferManagerTest, PeekPage) {
+  BufferManager buffer_manager{1024, 2};
+  uint64_t version = 0;
+  EXPECT_EQ(nullptr, buffer_manager.peek_page(1, version));
+
+  auto* page = &buffer_manager.fix_page(1, false);
+  buffer_manager.unfix_page(*page, false);
+  auto* peeked = buffer_manager.peek_page(1, version);
+  ASSERT_EQ(page, peeked);
+  EXPECT_TRUE(peeked->validate(version));
+
+  // Shared fixes leave the version alone, exclusive fixes change it and
+  // hide the page while they are held.
+  page = &buffer_manager.fix_page(1, false);
+  buffer_manager.unfix_page(*page, false);
+  EXPECT_TRUE(peeked->validate(version));
+  page = &buffer_manager.fix_page(1, true);
+  uint64_t locked_version = 0;
+  EXPECT_EQ(nullptr, buffer_manager.peek_page(1, locked_version));
+  buffer_manager.unfix_page(*page, true);
+  EXPECT_FALSE(peeked->validate(version));
+  ASSERT_EQ(page, buffer_manager.peek_page(1, version));
+
+  // Replacing the page invalidates the version as well. Page 2 stays fixed
+  // so that page 1 is the only victim.
+  auto& fixed_page = buffer_manager.fix_page(2, false);
+  auto& other_page = buffer_manager.fix_page(3, false);
+  buffer_manager.unfix_page(other_page, false);
+  buffer_manager.unfix_page(fixed_page, false);
+  EXPECT_FALSE(peeked->validate(version));
+  EXPECT_EQ(nullptr, buffer_manager.peek_page(1, version));
+}
+
+TEST_F(BufferManagerTest, SharedFixesDoNotBlockEachOther) {
+  BufferManager buffer_manager{1024, 10};
+  constexpr size_t kThreads = 8;
+  std::atomic<size_t> holders = 0;
+  std::atomic<bool> all_held = false;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      auto& page = buffer_manager.fix_page(1, false);
+      ++holders;
+      // Every reader keeps its shared latch until all readers hold it at the
+      // same time. Serialized readers would never get there.
+      auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+      while (holders.load() < kThreads &&
+             std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+      if (holders.load() == kThreads) {
+        all_held = true;
+      }
+      buffer_manager.unfix_page(page, false);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_TRUE(all_held);
+}
+
+TEST_F(BufferManagerTest, ExclusiveFixesSerialize) {
+  BufferManager buffer_manager{1024, 10};
+  constexpr size_t kThreads = 4;
+  constexpr size_t kIncrements = 2000;
+  {
+    auto& page = buffer_manager.fix_page(1, true);
+    std::memset(page.get_data(), 0, 1024);
+    buffer_manager.unfix_page(page, true);
+  }
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      for (size_t j = 0; j < kIncrements; ++j) {
+        auto& page = buffer_manager.fix_page(1, true);
+        // Not atomic, the exclusive latch has to protect it.
+        auto& value = *reinterpret_cast<uint64_t*>(page.get_data());
+        value = value + 1;
+        buffer_manager.unfix_page(page, true);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto& page = buffer_manager.fix_page(1, false);
+  EXPECT_EQ(kThreads * kIncrements, *reinterpret_cast<uint64_t*>(page.get_data()));
+  buffer_manager.unfix_page(page, false);
+}
+
+TEST_F(BufferManagerTest, ConcurrentFixesWithEviction) {
+  constexpr size_t kThreads = 4;
+  constexpr uint64_t kPages = 200;
+  constexpr size_t kFixes = 5000;
+  BufferManager buffer_manager{1024, 16};
+  for (uint64_t i = 0; i < kPages; ++i) {
+    auto& page = buffer_manager.fix_page(i, true);
+    std::memset(page.get_data(), 0, 1024);
+    buffer_manager.unfix_page(page, true);
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 engine{t};
+      std::uniform_int_distribution<uint64_t> page_distr{0, kPages - 1};
+      for (size_t i = 0; i < kFixes; ++i) {
+        uint64_t page_id = page_distr(engine);
+        bool exclusive = i % 4 == 0;
+        auto& page = buffer_manager.fix_page(page_id, exclusive);
+        auto* values = reinterpret_cast<uint64_t*>(page.get_data());
+        if (exclusive) {
+          // Every thread counts its own writes in a separate slot.
+          ++values[t];
+        }
+        buffer_manager.unfix_page(page, exclusive);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> per_thread(kThreads);
+  for (uint64_t i = 0; i < kPages; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    auto* values = reinterpret_cast<uint64_t*>(page.get_data());
+    for (size_t t = 0; t < kThreads; ++t) {
+      per_thread[t] += values[t];
+    }
+    buffer_manager.unfix_page(page, false);
+  }
+  for (size_t t = 0; t < kThreads; ++t) {
+    EXPECT_EQ(kFixes / 4, per_thread[t]) << "thread " << t << " lost writes";
+  }
+}
+
+/// Returns the first value of the page `segment_page` in the file of segment
+/// `segment_id`, or 0 if the file does not hold the page.
+uint64_t read_value_from_file(uint16_t segment_id, uint64_t segment_page) {
+  auto file = buzzdb::File::open_file(std::to_string(segment_id).c_str(),
+                                      buzzdb::File::READ);
+  uint64_t value = 0;
+  if ((segment_page + 1) * 1024 <= file->size()) {
+    file->read_block(segment_page * 1024, sizeof(value),
+                     reinterpret_cast<char*>(&value));
+  }
+  return value;
+}
+
+TEST_F(BufferManagerTest, FlushAll) {
+  constexpr uint16_t kSegmentId = 4;
+  std::remove("4");
+  BufferManager buffer_manager{1024, 10};
+  for (uint64_t segment_page = 0; segment_page < 8; ++segment_page) {
+    auto& page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, segment_page), true);
+    *reinterpret_cast<uint64_t*>(page.get_data()) = segment_page + 1;
+    buffer_manager.unfix_page(page, true);
+  }
+  // A page that is fixed shared is written, too
+  auto& fixed = buffer_manager.fix_page(
+      BufferManager::get_overall_page_id(kSegmentId, 3), false);
+  buffer_manager.flush_all();
+  buffer_manager.unfix_page(fixed, false);
+  for (uint64_t segment_page = 0; segment_page < 8; ++segment_page) {
+    EXPECT_EQ(read_value_from_file(kSegmentId, segment_page), segment_page + 1)
+        << "page " << segment_page;
+  }
+  // All pages are clean, so none is written when they are evicted
+  {
+    auto file = buzzdb::File::open_file("4", buzzdb::File::WRITE);
+    uint64_t zero = 0;
+    file->write_block(reinterpret_cast<char*>(&zero), 0, sizeof(zero));
+  }
+  for (uint64_t segment_page = 8; segment_page < 20; ++segment_page) {
+    auto& page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, segment_page), false);
+    buffer_manager.unfix_page(page, false);
+  }
+  EXPECT_EQ(read_value_from_file(kSegmentId, 0), 0u);
+  std::remove("4");
+}
+
+TEST_F(BufferManagerTest, CleanerWritesNextVictims) {
+  constexpr uint16_t kSegmentId = 5;
+  std::remove("5");
+  BufferManager buffer_manager{1024, 10};
+  for (uint64_t segment_page = 0; segment_page < 10; ++segment_page) {
+    auto& page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, segment_page), true);
+    *reinterpret_cast<uint64_t*>(page.get_data()) = segment_page + 1;
+    buffer_manager.unfix_page(page, true);
+  }
+  buffer_manager.start_cleaner(0.5);
+  // The first half of the pages are the next victims of the FIFO list
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (read_value_from_file(kSegmentId, 4) != 5 &&
+         std::chrono::steady_clock::now() < deadline) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  buffer_manager.stop_cleaner();
+  for (uint64_t segment_page = 0; segment_page < 5; ++segment_page) {
+    EXPECT_EQ(read_value_from_file(kSegmentId, segment_page), segment_page + 1)
+        << "page " << segment_page;
+  }
+  for (uint64_t segment_page = 5; segment_page < 10; ++segment_page) {
+    EXPECT_EQ(read_value_from_file(kSegmentId, segment_page), 0u)
+        << "page " << segment_page;
+  }
+  std::remove("5");
+}
+
+TEST_F(BufferManagerTest, CleanerWithConcurrentFixes) {
+  constexpr size_t kThreads = 4;
+  constexpr uint64_t kPages = 200;
+  constexpr size_t kFixes = 5000;
+  BufferManager buffer_manager{1024, 16};
+  buffer_manager.start_cleaner(0.25);
+  for (uint64_t i = 0; i < kPages; ++i) {
+    auto& page = buffer_manager.fix_page(i, true);
+    std::memset(page.get_data(), 0, 1024);
+    buffer_manager.unfix_page(page, true);
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 engine{t};
+      std::uniform_int_distribution<uint64_t> page_distr{0, kPages - 1};
+      for (size_t i = 0; i < kFixes; ++i) {
+        bool exclusive = i % 2 == 0;
+        auto& page = buffer_manager.fix_page(page_distr(engine), exclusive);
+        if (exclusive) {
+          ++reinterpret_cast<uint64_t*>(page.get_data())[t];
+        }
+        buffer_manager.unfix_page(page, exclusive);
+        if (t == 0 && i % 1000 == 0) {
+          buffer_manager.flush_all();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> per_thread(kThreads);
+  for (uint64_t i = 0; i < kPages; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    auto* values = reinterpret_cast<uint64_t*>(page.get_data());
+    for (size_t t = 0; t < kThreads; ++t) {
+      per_thread[t] += values[t];
+    }
+    buffer_manager.unfix_page(page, false);
+  }
+  for (size_t t = 0; t < kThreads; ++t) {
+    EXPECT_EQ(kFixes / 2, per_thread[t]) << "thread " << t << " lost writes";
+  }
+}
+
+TEST_F(BufferManagerTest, ConcurrentReadersOnDistinctPages) {
+  constexpr size_t kThreads = 8;
+  constexpr size_t kFixes = 20000;
+  BufferManager buffer_manager{1024, 64};
+  for (uint64_t i = 0; i < kThreads * 4; ++i) {
+    auto& page = buffer_manager.fix_page(i, true);
+    std::memset(page.get_data(), 0, 1024);
+    buffer_manager.unfix_page(page, true);
+  }
+  std::vector<std::thread> threads;
+  std::atomic<size_t> mismatches = 0;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      // Each reader stays on its own pages, which fall into different page
+      // table partitions.
+      for (size_t i = 0; i < kFixes; ++i) {
+        uint64_t page_id = t * 4 + i % 4;
+        auto& page = buffer_manager.fix_page(page_id, false);
+        if (*reinterpret_cast<uint64_t*>(page.get_data()) != 0) {
+          ++mismatches;
+        }
+        buffer_manager.unfix_page(page, false);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0u, mismatches.load());
+  EXPECT_EQ(kThreads * 4, buffer_manager.get_lru_list().size());
+}
+
+/// Returns whether `page_id` is resident, without fixing it.
+bool is_resident(BufferManager& buffer_manager, uint64_t page_id) {
+  uint64_t version;
+  return buffer_manager.peek_page(page_id, version) != nullptr;
+}
+
+/// Fixes and unfixes a page without changing it.
+void touch(BufferManager& buffer_manager, uint64_t page_id) {
+  auto& page = buffer_manager.fix_page(page_id, false);
+  buffer_manager.unfix_page(page, false);
+}
+
+TEST_F(BufferManagerTest, ClockSecondChance) {
+  BufferManager buffer_manager{1024, 3, buzzdb::File::BUFFERED,
+                               ReplacementPolicy::CLOCK};
+  for (uint64_t i = 1; i < 4; ++i) {
+    touch(buffer_manager, i);
+  }
+  EXPECT_EQ((std::vector<uint64_t>{1, 2, 3}), buffer_manager.get_fifo_list());
+  // Page 1 was fixed again, so the hand passes it once
+  touch(buffer_manager, 1);
+  touch(buffer_manager, 4);
+  EXPECT_TRUE(is_resident(buffer_manager, 1));
+  EXPECT_FALSE(is_resident(buffer_manager, 2));
+  // Now its bit is clear
+  touch(buffer_manager, 5);
+  EXPECT_FALSE(is_resident(buffer_manager, 3));
+  touch(buffer_manager, 6);
+  EXPECT_FALSE(is_resident(buffer_manager, 1));
+}
+
+TEST_F(BufferManagerTest, ArcGhostHit) {
+  BufferManager buffer_manager{1024, 2, buzzdb::File::BUFFERED,
+                               ReplacementPolicy::ARC};
+  touch(buffer_manager, 1);
+  touch(buffer_manager, 1);
+  touch(buffer_manager, 2);
+  EXPECT_EQ(std::vector<uint64_t>{2}, buffer_manager.get_fifo_list());
+  EXPECT_EQ(std::vector<uint64_t>{1}, buffer_manager.get_lru_list());
+  // Pages that were fixed once go first
+  touch(buffer_manager, 3);
+  EXPECT_EQ(std::vector<uint64_t>{3}, buffer_manager.get_fifo_list());
+  // Page 2 was evicted recently, so it returns as a repeatedly used page
+  touch(buffer_manager, 2);
+  EXPECT_TRUE(buffer_manager.get_fifo_list().empty());
+  EXPECT_EQ((std::vector<uint64_t>{1, 2}), buffer_manager.get_lru_list());
+  touch(buffer_manager, 4);
+  EXPECT_EQ(std::vector<uint64_t>{4}, buffer_manager.get_fifo_list());
+  EXPECT_EQ(std::vector<uint64_t>{2}, buffer_manager.get_lru_list());
+}
+
+class ReplacementPolicyTest
+    : public ::testing::TestWithParam<ReplacementPolicy::Kind> {
+ protected:
+  void SetUp() override { remove_segment_files(); }
+  void TearDown() override { remove_segment_files(); }
+};
+
+TEST_P(ReplacementPolicyTest, HotPagesSurviveScan) {
+  BufferManager buffer_manager{1024, 10, buzzdb::File::BUFFERED, GetParam()};
+  EXPECT_EQ(GetParam(), buffer_manager.get_policy());
+  constexpr uint64_t kHotPages = 3;
+  for (uint64_t i = 0; i < kHotPages; ++i) {
+    touch(buffer_manager, i);
+    touch(buffer_manager, i);
+  }
+  // A scan of many pages that are used once, while the hot pages are used
+  // all the time
+  for (uint64_t i = 0; i < 200; ++i) {
+    touch(buffer_manager, 1000 + i);
+    if (i % 4 == 3) {
+      for (uint64_t j = 0; j < kHotPages; ++j) {
+        EXPECT_TRUE(is_resident(buffer_manager, j)) << "page " << j;
+        touch(buffer_manager, j);
+      }
+    }
+  }
+  EXPECT_FALSE(is_resident(buffer_manager, 1000));
+}
+
+TEST_P(ReplacementPolicyTest, ConcurrentFixesWithCleaner) {
+  constexpr size_t kThreads = 4;
+  constexpr uint64_t kPages = 200;
+  constexpr size_t kFixes = 5000;
+  std::remove("0");
+  BufferManager buffer_manager{1024, 16, buzzdb::File::BUFFERED, GetParam()};
+  buffer_manager.start_cleaner(0.25);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([&, t] {
+      std::mt19937_64 engine{t};
+      // Skewed, so some pages are hot
+      std::geometric_distribution<uint64_t> page_distr{0.02};
+      for (size_t i = 0; i < kFixes; ++i) {
+        uint64_t page_id = page_distr(engine) % kPages;
+        bool exclusive = i % 4 == 0;
+        auto& page = buffer_manager.fix_page(page_id, exclusive);
+        if (exclusive) {
+          ++reinterpret_cast<uint64_t*>(page.get_data())[t];
+        }
+        buffer_manager.unfix_page(page, exclusive);
+        if (i % 64 == 0) {
+          uint64_t next = (page_id + 1) % kPages;
+          buffer_manager.prefetch(&next, 1);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  std::vector<uint64_t> per_thread(kThreads);
+  for (uint64_t i = 0; i < kPages; ++i) {
+    auto& page = buffer_manager.fix_page(i, false);
+    auto* values = reinterpret_cast<uint64_t*>(page.get_data());
+    for (size_t t = 0; t < kThreads; ++t) {
+      per_thread[t] += values[t];
+    }
+    buffer_manager.unfix_page(page, false);
+  }
+  for (size_t t = 0; t < kThreads; ++t) {
+    EXPECT_EQ(kFixes / 4, per_thread[t]) << "thread " << t << " lost writes";
+  }
+}
+
+INSTANTIATE_TEST_SUITE_P(Policies, ReplacementPolicyTest,
+                         ::testing::Values(ReplacementPolicy::TWO_Q,
+                                           ReplacementPolicy::CLOCK,
+                                           ReplacementPolicy::ARC),
+                         [](const auto& info) {
+                           switch (info.param) {
+                             case ReplacementPolicy::TWO_Q:
+                               return "TwoQ";
+                             case ReplacementPolicy::CLOCK:
+                               return "Clock";
+                             default:
+                               return "Arc";
+                           }
+                         });
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,9 +1,18 @@
 #include <gtest/gtest.h>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstddef>
+#include <map>
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <random>
 #include <sstream>
+#include <stdexcept>
 #include <vector>
 #include <thread>
 
@@ -13,12 +22,48 @@
 using BufferFrame = buzzdb::BufferFrame;
 using BufferManager = buzzdb::BufferManager;
 using Defer = buzzdb::Defer;
+using File = buzzdb::File;
+using LogManager = buzzdb::LogManager;
 using BTree =
     buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, 1024>;  // NOLINT
 
 namespace {
 
-TEST(BTreeTest, InsertEmptyTree) {
+/// Starts every test with a fresh segment file, as the segment keeps its
+/// allocation maps there, and without a log. Removes the files that the test
+/// wrote at the end.
+class BTreeTest : public ::testing::Test {
+ protected:
+  void SetUp() override { remove_files(); }
+  void TearDown() override { remove_files(); }
+
+  static void remove_files() {
+    for (const char* filename :
+         {"0", "1", "log", "0.crash", "log.crash", "log.full"}) {
+      std::remove(filename);
+    }
+  }
+};
+
+TEST_F(BTreeTest, NodeCapacities) {
+  // The nodes fill their page, one more entry would not fit.
+  using InnerNode = BTree::InnerNode;
+  using LeafNode = BTree::LeafNode;
+  EXPECT_LE(sizeof(InnerNode), 1024u);
+  EXPECT_GT(sizeof(InnerNode) + sizeof(uint64_t) + sizeof(uint64_t), 1024u);
+  EXPECT_LE(sizeof(LeafNode), 1024u);
+  EXPECT_GT(sizeof(LeafNode) + sizeof(uint64_t) + sizeof(uint64_t), 1024u);
+  EXPECT_EQ(InnerNode::kCapacity, 62u);
+  EXPECT_EQ(LeafNode::kCapacity, 61u);
+
+  // Small keys raise the fan-out of inner nodes.
+  using SmallKeyTree =
+      buzzdb::BTree<uint32_t, uint64_t, std::less<uint32_t>, 1024>;
+  EXPECT_LE(sizeof(SmallKeyTree::InnerNode), 1024u);
+  EXPECT_EQ(SmallKeyTree::InnerNode::kCapacity, 83u);
+}
+
+TEST_F(BTreeTest, InsertEmptyTree) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
   ASSERT_FALSE(tree.root);
@@ -28,7 +73,7 @@ TEST(BTreeTest, InsertEmptyTree) {
   auto test = "inserting an element into an empty B-Tree";
   ASSERT_TRUE(tree.root) << test << " does not create a node.";
 
-  auto root_page = buffer_manager.fix_page(*tree.root, false);
+  auto& root_page = buffer_manager.fix_page(*tree.root, false);
   auto root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
   Defer root_page_unfix([&]() { buffer_manager.unfix_page(root_page, false); });
 
@@ -37,7 +82,7 @@ TEST(BTreeTest, InsertEmptyTree) {
       << test << " does not create a leaf node with count = 1.";
 }
 
-TEST(BTreeTest, InsertLeafNode) {
+TEST_F(BTreeTest, InsertLeafNode) {
   uint64_t page_size = 1024;
   BufferManager buffer_manager(page_size, 100);
   BTree tree(0, buffer_manager);
@@ -51,7 +96,7 @@ TEST(BTreeTest, InsertLeafNode) {
       "inserting BTree::LeafNode::kCapacity elements into an empty B-Tree";
   ASSERT_TRUE(tree.root);
 
-  auto root_page = buffer_manager.fix_page(*tree.root, false);
+  auto& root_page = buffer_manager.fix_page(*tree.root, false);
   auto root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
   auto root_inner_node = static_cast<BTree::InnerNode*>(root_node);
   Defer root_page_unfix([&]() { buffer_manager.unfix_page(root_page, false); });
@@ -62,7 +107,7 @@ TEST(BTreeTest, InsertLeafNode) {
       << test << " does not store all elements.";
 }
 
-TEST(BTreeTest, InsertLeafNodeSplit) {
+TEST_F(BTreeTest, InsertLeafNodeSplit) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
 
@@ -73,7 +118,7 @@ TEST(BTreeTest, InsertLeafNodeSplit) {
   }
 
   ASSERT_TRUE(tree.root);
-  auto root_page = buffer_manager.fix_page(*tree.root, false);
+  auto& root_page = buffer_manager.fix_page(*tree.root, false);
   auto root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
   auto root_inner_node = static_cast<BTree::InnerNode*>(root_node);
   Defer root_page_unfix([&]() { buffer_manager.unfix_page(root_page, false); });
@@ -89,12 +134,12 @@ TEST(BTreeTest, InsertLeafNodeSplit) {
 
   ASSERT_TRUE(tree.root) << test << " removes the root :-O";
 
-  root_page = buffer_manager.fix_page(*tree.root, false);
+  auto& new_root_page = buffer_manager.fix_page(*tree.root, false);
 
-  root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
+  root_node = reinterpret_cast<BTree::Node*>(new_root_page.get_data());
   root_inner_node = static_cast<BTree::InnerNode*>(root_node);
-  root_page_unfix =
-      Defer([&]() { buffer_manager.unfix_page(root_page, false); });
+  Defer new_root_page_unfix(
+      [&]() { buffer_manager.unfix_page(new_root_page, false); });
 
   ASSERT_FALSE(root_inner_node->is_leaf())
       << test << " does not create a root inner node";
@@ -102,7 +147,7 @@ TEST(BTreeTest, InsertLeafNodeSplit) {
       << test << " creates a new root with count != 2";
 }
 
-TEST(BTreeTest, LookupEmptyTree) {
+TEST_F(BTreeTest, LookupEmptyTree) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
 
@@ -111,7 +156,7 @@ TEST(BTreeTest, LookupEmptyTree) {
   ASSERT_FALSE(tree.lookup(42)) << test << " seems to return something :-O";
 }
 
-TEST(BTreeTest, LookupSingleLeaf) {
+TEST_F(BTreeTest, LookupSingleLeaf) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
 
@@ -130,7 +175,7 @@ TEST(BTreeTest, LookupSingleLeaf) {
   }
 }
 
-TEST(BTreeTest, LookupSingleSplit) {
+TEST_F(BTreeTest, LookupSingleSplit) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
 
@@ -152,7 +197,7 @@ TEST(BTreeTest, LookupSingleSplit) {
   }
 }
 
-TEST(BTreeTest, LookupMultipleSplitsIncreasing) {
+TEST_F(BTreeTest, LookupMultipleSplitsIncreasing) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
   auto n = 40 * BTree::LeafNode::kCapacity;
@@ -172,7 +217,7 @@ TEST(BTreeTest, LookupMultipleSplitsIncreasing) {
   }
 }
 
-TEST(BTreeTest, LookupMultipleSplitsDecreasing) {
+TEST_F(BTreeTest, LookupMultipleSplitsDecreasing) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
   auto n = 10 * BTree::LeafNode::kCapacity;
@@ -192,7 +237,7 @@ TEST(BTreeTest, LookupMultipleSplitsDecreasing) {
   }
 }
 
-TEST(BTreeTest, LookupRandomNonRepeating) {
+TEST_F(BTreeTest, LookupRandomNonRepeating) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
   auto n = 10 * BTree::LeafNode::kCapacity;
@@ -220,7 +265,7 @@ TEST(BTreeTest, LookupRandomNonRepeating) {
   }
 }
 
-TEST(BTreeTest, LookupRandomRepeating) {
+TEST_F(BTreeTest, LookupRandomRepeating) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
   auto n = 10 * BTree::LeafNode::kCapacity;
@@ -254,7 +299,245 @@ TEST(BTreeTest, LookupRandomRepeating) {
   }
 }
 
-TEST(BTreeTest, Erase) {
+TEST_F(BTreeTest, LeafSiblingLinks) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  auto n = 10 * BTree::LeafNode::kCapacity;
+
+  // Insert values in random order
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+  for (auto key : keys) {
+    tree.insert(key, 2 * key);
+  }
+
+  // Walk the leaves from left to right
+  uint64_t expected_key = 0;
+  for (auto page_id = tree.find_leaf_node(0); page_id != 0;) {
+    auto& page = buffer_manager.fix_page(page_id, false);
+    Defer page_unfix([&]() { buffer_manager.unfix_page(page, false); });
+    auto* leaf_node = reinterpret_cast<BTree::LeafNode*>(page.get_data());
+    ASSERT_TRUE(leaf_node->is_leaf());
+    for (auto key : leaf_node->get_key_vector()) {
+      ASSERT_EQ(key, expected_key) << "leaf " << page_id << " is out of order";
+      ++expected_key;
+    }
+    if (leaf_node->right_sibling != 0) {
+      ASSERT_EQ(leaf_node->high_key, expected_key - 1)
+          << "leaf " << page_id << " should end at its high key";
+    }
+    page_id = leaf_node->right_sibling;
+  }
+  ASSERT_EQ(expected_key, n) << "the leaves should hold all keys";
+}
+
+TEST_F(BTreeTest, ScanRange) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  ASSERT_FALSE(tree.scan(0, 10).is_valid())
+      << "scanning an empty tree should yield nothing";
+
+  // Insert the even keys in random order
+  auto n = 10 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  for (auto i = 0ul; i < n; ++i) {
+    keys[i] = 2 * i;
+  }
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+  for (auto key : keys) {
+    tree.insert(key, 3 * key);
+  }
+
+  std::pair<uint64_t, uint64_t> ranges[] = {
+      {0, 2 * n}, {1, 7}, {5, 5}, {101, 2 * n + 100}, {2 * n, 4 * n}};
+  for (auto [lo, hi] : ranges) {
+    std::vector<uint64_t> expected_keys;
+    for (auto key = lo; key < hi; ++key) {
+      if (key % 2 == 0 && key < 2 * n) {
+        expected_keys.push_back(key);
+      }
+    }
+
+    std::vector<uint64_t> forward_keys;
+    for (auto cursor = tree.scan(lo, hi); cursor.is_valid(); cursor.next()) {
+      ASSERT_EQ(cursor.value(), 3 * cursor.key());
+      forward_keys.push_back(cursor.key());
+    }
+    EXPECT_EQ(forward_keys, expected_keys)
+        << "scanning [" << lo << ", " << hi << ") forward";
+
+    std::vector<uint64_t> backward_keys;
+    for (auto cursor = tree.scan_reverse(lo, hi); cursor.is_valid();
+         cursor.prev()) {
+      ASSERT_EQ(cursor.value(), 3 * cursor.key());
+      backward_keys.push_back(cursor.key());
+    }
+    std::reverse(backward_keys.begin(), backward_keys.end());
+    EXPECT_EQ(backward_keys, expected_keys)
+        << "scanning [" << lo << ", " << hi << ") backward";
+  }
+}
+
+TEST_F(BTreeTest, BulkLoad) {
+  for (uint64_t n : {1ul, 1ul * BTree::LeafNode::kCapacity,
+                     100ul * BTree::LeafNode::kCapacity}) {
+    std::remove("0");
+    BufferManager buffer_manager(1024, 100);
+    BTree tree(0, buffer_manager);
+
+    // Load the even keys
+    std::vector<std::pair<uint64_t, uint64_t>> entries;
+    for (auto i = 0ul; i < n; ++i) {
+      entries.emplace_back(2 * i, 3 * i);
+    }
+    tree.bulk_load(entries.begin(), entries.end(), 0.5);
+    ASSERT_TRUE(tree.root) << "bulk loading should create a root";
+
+    // The leaves are filled to the requested fraction
+    auto leaf_fill = BTree::LeafNode::kCapacity / 2;
+    auto leaf_count = 0ul;
+    for (auto page_id = tree.find_leaf_node(0); page_id != 0; ++leaf_count) {
+      auto& page = buffer_manager.fix_page(page_id, false);
+      auto* leaf_node = reinterpret_cast<BTree::LeafNode*>(page.get_data());
+      page_id = leaf_node->right_sibling;
+      if (page_id != 0) {
+        EXPECT_EQ(leaf_node->count, leaf_fill);
+      }
+      buffer_manager.unfix_page(page, false);
+    }
+    EXPECT_EQ(leaf_count, (n + leaf_fill - 1) / leaf_fill);
+
+    // Insert the odd keys in between
+    for (auto i = 0ul; i < n; ++i) {
+      tree.insert(2 * i + 1, 3 * i + 1);
+    }
+    for (auto i = 0ul; i < n; ++i) {
+      auto v = tree.lookup(2 * i);
+      ASSERT_TRUE(v) << "loaded key=" << 2 * i << " is missing";
+      ASSERT_EQ(*v, 3 * i);
+      v = tree.lookup(2 * i + 1);
+      ASSERT_TRUE(v) << "inserted key=" << 2 * i + 1 << " is missing";
+      ASSERT_EQ(*v, 3 * i + 1);
+    }
+    auto key_count = 0ul;
+    for (auto cursor = tree.scan(0, 2 * n); cursor.is_valid(); cursor.next()) {
+      ASSERT_EQ(cursor.key(), key_count++);
+    }
+    EXPECT_EQ(key_count, 2 * n);
+  }
+}
+
+TEST_F(BTreeTest, BulkLoadNonEmptyTree) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  auto n = 10 * BTree::LeafNode::kCapacity;
+  for (auto i = 0ul; i < n; ++i) {
+    tree.insert(i, 2 * i);
+  }
+  auto root_page_id = tree.get_root();
+
+  // The load is rejected before the root or the metadata change
+  std::vector<std::pair<uint64_t, uint64_t>> entries{{n, 0}, {n + 1, 1}};
+  EXPECT_THROW(tree.bulk_load(entries.begin(), entries.end()), std::logic_error);
+  EXPECT_EQ(tree.get_root(), root_page_id);
+  for (auto i = 0ul; i < n; ++i) {
+    ASSERT_EQ(tree.lookup(i), 2 * i) << "key=" << i;
+  }
+  EXPECT_FALSE(tree.lookup(n));
+}
+
+TEST_F(BTreeTest, InsertBatch) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  std::map<uint64_t, uint64_t> expected;
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<uint64_t> distr(0, 50 * BTree::LeafNode::kCapacity);
+
+  // Batches of random keys with repeats, into an empty tree first
+  for (auto batch_size : {20ul * BTree::LeafNode::kCapacity, 1ul, 10ul,
+                          1ul * BTree::LeafNode::kCapacity}) {
+    std::vector<std::pair<uint64_t, uint64_t>> batch;
+    for (auto i = 0ul; i < batch_size; ++i) {
+      auto key = distr(engine);
+      batch.emplace_back(key, i);
+      expected[key] = i;
+    }
+    tree.insert_batch(batch.begin(), batch.end());
+
+    for (auto& [key, value] : expected) {
+      auto v = tree.lookup(key);
+      ASSERT_TRUE(v) << "key=" << key << " is missing";
+      ASSERT_EQ(*v, value) << "key=" << key << " has the wrong value";
+    }
+  }
+
+  // A sorted batch beyond all keys splits the last leaf many times at once
+  std::vector<std::pair<uint64_t, uint64_t>> batch;
+  for (auto i = 0ul; i < 10 * BTree::LeafNode::kCapacity; ++i) {
+    auto key = 100 * BTree::LeafNode::kCapacity + i;
+    batch.emplace_back(key, 2 * key);
+    expected[key] = 2 * key;
+  }
+  tree.insert_batch(batch.begin(), batch.end());
+
+  // The leaves and their links in both directions hold exactly the keys
+  std::vector<uint64_t> expected_keys;
+  for (auto& [key, value] : expected) {
+    expected_keys.push_back(key);
+  }
+  std::vector<uint64_t> forward_keys;
+  for (auto cursor = tree.scan(0, UINT64_MAX); cursor.is_valid();
+       cursor.next()) {
+    ASSERT_EQ(cursor.value(), expected[cursor.key()]);
+    forward_keys.push_back(cursor.key());
+  }
+  EXPECT_EQ(forward_keys, expected_keys);
+  std::vector<uint64_t> backward_keys;
+  for (auto cursor = tree.scan_reverse(0, UINT64_MAX); cursor.is_valid();
+       cursor.prev()) {
+    backward_keys.push_back(cursor.key());
+  }
+  std::reverse(backward_keys.begin(), backward_keys.end());
+  EXPECT_EQ(backward_keys, expected_keys);
+}
+
+TEST_F(BTreeTest, LookupMany) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  std::vector<uint64_t> keys(5 * BTree::kLookupGroupSize + 3);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::vector<std::optional<uint64_t>> results(keys.size());
+  tree.lookup_many(keys.data(), keys.size(), results.data());
+  for (auto& result : results) {
+    ASSERT_FALSE(result) << "an empty tree should contain nothing";
+  }
+
+  // Insert the even keys, so that the probes go to many leaves
+  auto n = 40 * BTree::LeafNode::kCapacity;
+  for (auto i = 0ul; i < n; ++i) {
+    tree.insert(2 * i, 3 * i);
+  }
+  keys.resize(4 * n + 5);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+  results.resize(keys.size());
+  tree.lookup_many(keys.data(), keys.size(), results.data());
+  for (auto i = 0ul; i < keys.size(); ++i) {
+    auto key = keys[i];
+    if (key % 2 == 0 && key < 2 * n) {
+      ASSERT_TRUE(results[i]) << "key=" << key << " is missing";
+      ASSERT_EQ(*results[i], key / 2 * 3);
+    } else {
+      ASSERT_FALSE(results[i]) << "key=" << key << " should be missing";
+    }
+  }
+}
+
+TEST_F(BTreeTest, Erase) {
   BufferManager buffer_manager(1024, 100);
   BTree tree(0, buffer_manager);
 
@@ -272,6 +555,625 @@ TEST(BTreeTest, Erase) {
   }
 }
 
+TEST_F(BTreeTest, EraseUnderflow) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  auto n = 40 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+  for (auto key : keys) {
+    tree.insert(key, 2 * key);
+  }
+  // Pages are allocated first-fit, so a probe page marks the end of the tree
+  auto end_page_id = tree.allocate_page();
+  tree.free_page(end_page_id);
+
+  // Erase all but every tenth key in random order
+  std::shuffle(keys.begin(), keys.end(), engine);
+  for (auto key : keys) {
+    if (key % 10 != 0) {
+      tree.erase(key);
+    }
+  }
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key).has_value(), key % 10 == 0) << "key=" << key;
+  }
+
+  // The remaining leaves are merged and linked in both directions
+  auto leaf_count = 0ul;
+  uint64_t expected_key = 0;
+  for (auto page_id = tree.find_leaf_node(0); page_id != 0; ++leaf_count) {
+    auto& page = buffer_manager.fix_page(page_id, false);
+    Defer page_unfix([&]() { buffer_manager.unfix_page(page, false); });
+    auto* leaf_node = reinterpret_cast<BTree::LeafNode*>(page.get_data());
+    EXPECT_GE(leaf_node->count, BTree::LeafNode::kMinCount);
+    for (auto key : leaf_node->get_key_vector()) {
+      ASSERT_EQ(key, expected_key);
+      expected_key += 10;
+    }
+    page_id = leaf_node->right_sibling;
+  }
+  EXPECT_EQ(expected_key, n);
+  EXPECT_LE(leaf_count, n / 10 / BTree::LeafNode::kMinCount);
+  uint64_t backward_key = n;
+  for (auto cursor = tree.scan_reverse(0, n); cursor.is_valid();
+       cursor.prev()) {
+    backward_key -= 10;
+    ASSERT_EQ(cursor.key(), backward_key);
+  }
+  EXPECT_EQ(backward_key, 0u);
+
+  // Erasing everything collapses the root into an empty leaf
+  for (auto key = 0ul; key < n; key += 10) {
+    tree.erase(key);
+  }
+  {
+    auto& root_page = buffer_manager.fix_page(*tree.root, false);
+    Defer root_page_unfix(
+        [&]() { buffer_manager.unfix_page(root_page, false); });
+    auto* root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
+    EXPECT_TRUE(root_node->is_leaf());
+    EXPECT_EQ(root_node->count, 0u);
+  }
+  EXPECT_EQ(tree.get_metadata().height, 1u);
+
+  // The freed pages are reused when the tree grows again
+  for (auto key : keys) {
+    tree.insert(key, 3 * key);
+  }
+  auto probe_page_id = tree.allocate_page();
+  EXPECT_LE(probe_page_id, end_page_id);
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key), 3 * key);
+  }
+}
+
+TEST_F(BTreeTest, FullBufferDuringStructureChange) {
+  BufferManager buffer_manager(1024, 12);
+  BTree tree(0, buffer_manager);
+  auto n = 20 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+
+  // Pages of another segment take all but two frames, so operations that
+  // change several nodes run out of frames
+  std::vector<BufferFrame*> pinned;
+  auto pin = [&]() {
+    for (uint64_t i = 0; i < 10; ++i) {
+      pinned.push_back(&buffer_manager.fix_page(
+          BufferManager::get_overall_page_id(1, i), false));
+    }
+  };
+  auto unpin = [&]() {
+    for (auto* page : pinned) {
+      buffer_manager.unfix_page(*page, false);
+    }
+    pinned.clear();
+  };
+  Defer unpin_on_exit(unpin);
+
+  // The first half builds inner nodes
+  for (auto i = 0ul; i < n / 2; ++i) {
+    tree.insert(keys[i], 2 * keys[i]);
+  }
+  pin();
+  std::vector<uint64_t> failed;
+  for (auto i = n / 2; i < n; ++i) {
+    auto key = keys[i];
+    try {
+      tree.insert(key, 2 * key);
+    } catch (const buzzdb::buffer_full_error&) {
+      failed.push_back(key);
+    }
+  }
+  EXPECT_FALSE(failed.empty());
+
+  // A failed operation released its latches, so the tree is still usable
+  unpin();
+  for (auto key : failed) {
+    tree.insert(key, 2 * key);
+  }
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key), 2 * key) << "key=" << key;
+  }
+
+  // Same for merges, where an erase that throws may or may not have erased
+  // its key
+  pin();
+  failed.clear();
+  for (auto key : keys) {
+    if (key % 10 != 0) {
+      try {
+        tree.erase(key);
+      } catch (const buzzdb::buffer_full_error&) {
+        failed.push_back(key);
+      }
+    }
+  }
+  EXPECT_FALSE(failed.empty());
+  unpin();
+  for (auto key : failed) {
+    tree.erase(key);
+  }
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key).has_value(), key % 10 == 0) << "key=" << key;
+  }
+  uint64_t expected_key = 0;
+  for (auto cursor = tree.scan(0, n); cursor.is_valid(); cursor.next()) {
+    ASSERT_EQ(cursor.key(), expected_key);
+    expected_key += 10;
+  }
+  EXPECT_EQ(expected_key, n);
+}
+
+TEST_F(BTreeTest, StatsBulkLoad) {
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+  auto empty_stats = tree.get_stats(BTree::FULL);
+  EXPECT_EQ(empty_stats.height, 0u);
+  EXPECT_TRUE(empty_stats.level_node_counts.empty());
+
+  // Half full nodes: 62 leaves of 30 entries under 2 inner nodes of 31
+  // children under the root
+  auto leaf_fill = BTree::LeafNode::kCapacity / 2;
+  auto inner_fill = BTree::InnerNode::kCapacity / 2;
+  auto n = 2 * inner_fill * leaf_fill;
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  for (auto i = 0ul; i < n; ++i) {
+    entries.emplace_back(i, 2 * i);
+  }
+  tree.bulk_load(entries.begin(), entries.end(), 0.5);
+
+  // Every path through the tree looks the same, so the sample is exact
+  for (auto mode : {BTree::FULL, BTree::SAMPLED}) {
+    auto stats = tree.get_stats(mode);
+    EXPECT_EQ(stats.is_sampled, mode == BTree::SAMPLED);
+    EXPECT_EQ(stats.height, 3u);
+    EXPECT_EQ(stats.level_node_counts,
+              (std::vector<uint64_t>{2 * inner_fill, 2, 1}));
+    std::array<uint64_t, BTree::Stats::kFillBucketCount> expected_leaf_fill{};
+    expected_leaf_fill[4] = 2 * inner_fill;
+    EXPECT_EQ(stats.leaf_fill, expected_leaf_fill);
+    std::array<uint64_t, BTree::Stats::kFillBucketCount> expected_inner_fill{};
+    expected_inner_fill[0] = 1;
+    expected_inner_fill[5] = 2;
+    EXPECT_EQ(stats.inner_fill, expected_inner_fill);
+    EXPECT_NEAR(stats.leaf_fill_factor,
+                static_cast<double>(leaf_fill) / BTree::LeafNode::kCapacity,
+                1e-9);
+    EXPECT_NEAR(stats.inner_fill_factor,
+                (2.0 * inner_fill + 2) / 3 / BTree::InnerNode::kCapacity,
+                1e-9);
+    EXPECT_EQ(stats.leaf_splits, 0u);
+    EXPECT_EQ(stats.traversals, 0u);
+  }
+}
+
+TEST_F(BTreeTest, StatsCounters) {
+  BufferManager buffer_manager(1024, 200);
+  BTree tree(0, buffer_manager);
+  auto n = 100 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::mt19937_64 engine{0};
+  std::shuffle(keys.begin(), keys.end(), engine);
+  for (auto key : keys) {
+    tree.insert(key, 2 * key);
+  }
+
+  // Each split adds a node, a root split also a level
+  auto stats = tree.get_stats(BTree::FULL);
+  EXPECT_EQ(stats.height, tree.get_metadata().height);
+  EXPECT_EQ(stats.level_node_counts.back(), 1u);
+  EXPECT_EQ(stats.level_node_counts[0], 1 + stats.leaf_splits);
+  EXPECT_GT(stats.inner_splits, 0u);
+  auto node_count = std::accumulate(stats.level_node_counts.begin(),
+                                    stats.level_node_counts.end(), 0ul);
+  EXPECT_EQ(node_count,
+            1 + stats.leaf_splits + stats.inner_splits + stats.height - 1);
+  EXPECT_EQ(stats.leaf_merges + stats.inner_merges, 0u);
+  EXPECT_GE(stats.traversals, n);
+  EXPECT_EQ(stats.traversal_restarts, 0u);
+  auto entry_count =
+      stats.leaf_fill_factor * BTree::LeafNode::kCapacity * stats.level_node_counts[0];
+  EXPECT_EQ(std::llround(entry_count), static_cast<long long>(n));
+  EXPECT_GT(stats.leaf_fill_factor, 0.5);
+
+  // Each lookup descends once
+  for (auto key = 0ul; key < 100; ++key) {
+    tree.lookup(key);
+  }
+  EXPECT_EQ(tree.get_stats().traversals, stats.traversals + 100);
+
+  // Erasing most keys merges leaves, each removes one
+  for (auto key : keys) {
+    if (key % 10 != 0) {
+      tree.erase(key);
+    }
+  }
+  stats = tree.get_stats(BTree::FULL);
+  EXPECT_GT(stats.leaf_merges, 0u);
+  EXPECT_EQ(stats.level_node_counts[0],
+            1 + stats.leaf_splits - stats.leaf_merges);
+  EXPECT_EQ(stats.height, tree.get_metadata().height);
+}
+
+TEST_F(BTreeTest, StatsSampled) {
+  BufferManager buffer_manager(1024, 200);
+  BTree tree(0, buffer_manager);
+  auto n = 100 * BTree::LeafNode::kCapacity;
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<uint64_t> distr(0, 1ul << 40);
+  for (auto i = 0ul; i < n; ++i) {
+    auto key = distr(engine);
+    tree.insert(key, 2 * key);
+  }
+
+  // The sample estimates the shape of the whole tree
+  auto full_stats = tree.get_stats(BTree::FULL);
+  auto stats = tree.get_stats();
+  EXPECT_TRUE(stats.is_sampled);
+  EXPECT_EQ(stats.height, full_stats.height);
+  EXPECT_EQ(stats.level_node_counts.back(), 1u);
+  EXPECT_NEAR(static_cast<double>(stats.level_node_counts[0]),
+              static_cast<double>(full_stats.level_node_counts[0]),
+              0.25 * full_stats.level_node_counts[0]);
+  EXPECT_NEAR(stats.leaf_fill_factor, full_stats.leaf_fill_factor, 0.1);
+  auto sampled_leaf_count =
+      std::accumulate(stats.leaf_fill.begin(), stats.leaf_fill.end(), 0ul);
+  EXPECT_NEAR(static_cast<double>(sampled_leaf_count),
+              static_cast<double>(stats.level_node_counts[0]),
+              BTree::Stats::kFillBucketCount);
+}
+
+TEST_F(BTreeTest, Reopen) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 100);
+  auto tree = std::make_unique<BTree>(0, *buffer_manager);
+  EXPECT_EQ(tree->get_metadata().height, 0u);
+  auto n = 100 * BTree::LeafNode::kCapacity;
+  for (auto i = 0ul; i < n; ++i) {
+    tree->insert(2 * i, i);
+  }
+  auto root_page_id = *tree->root;
+  auto height = tree->get_metadata().height;
+  EXPECT_EQ(tree->get_metadata().root_page_id, root_page_id);
+  {
+    auto& root_page = buffer_manager->fix_page(root_page_id, false);
+    Defer root_page_unfix(
+        [&]() { buffer_manager->unfix_page(root_page, false); });
+    auto* root_node = reinterpret_cast<BTree::Node*>(root_page.get_data());
+    EXPECT_EQ(root_node->level + 1, height);
+  }
+
+  // Destroy the buffer manager and attach to the tree again.
+  tree.reset();
+  buffer_manager = std::make_unique<BufferManager>(1024, 100);
+  tree = std::make_unique<BTree>(0, *buffer_manager);
+  ASSERT_TRUE(tree->root) << "the tree should be found again";
+  EXPECT_EQ(*tree->root, root_page_id);
+  EXPECT_EQ(tree->get_metadata().height, height);
+  for (auto i = 0ul; i < n; ++i) {
+    ASSERT_EQ(tree->lookup(2 * i), i) << "key=" << 2 * i;
+  }
+
+  // New pages do not overwrite the pages of the tree
+  for (auto i = 0ul; i < n; ++i) {
+    tree->insert(2 * i + 1, i);
+  }
+  for (auto key = 0ul; key < 2 * n; ++key) {
+    ASSERT_EQ(tree->lookup(key), key / 2) << "key=" << key;
+  }
+}
+
+TEST_F(BTreeTest, MappedSegment) {
+  auto n = 100 * BTree::LeafNode::kCapacity;
+  {
+    BufferManager buffer_manager(1024, 100);
+    BTree tree(0, buffer_manager);
+    for (auto i = 0ul; i < n; ++i) {
+      tree.insert(i, 2 * i);
+    }
+  }
+
+  // A pool of a single frame, which the mapped tree does not need.
+  BufferManager buffer_manager(1024, 1);
+  buffer_manager.map_segment(0);
+  BTree tree(0, buffer_manager);
+  for (auto i = 0ul; i < n; ++i) {
+    ASSERT_EQ(tree.lookup(i), 2 * i) << "key=" << i;
+  }
+  EXPECT_FALSE(tree.lookup(n));
+  uint64_t count = 0;
+  for (auto cursor = tree.scan(0, n); cursor.is_valid(); cursor.next()) {
+    ASSERT_EQ(cursor.key(), count++);
+  }
+  EXPECT_EQ(count, n);
+  EXPECT_TRUE(buffer_manager.get_fifo_list().empty());
+}
+
+TEST_F(BTreeTest, ReadAhead) {
+  auto n = 200 * BTree::LeafNode::kCapacity;
+  {
+    BufferManager buffer_manager(1024, 100);
+    BTree tree(0, buffer_manager);
+    for (auto i = 0ul; i < n; ++i) {
+      tree.insert(i, 2 * i);
+    }
+  }
+
+  // The tree is larger than the pool, so scans keep loading leaves
+  BufferManager buffer_manager(1024, 64);
+  BTree tree(0, buffer_manager);
+  std::pair<uint64_t, uint64_t> ranges[] = {{0, n}, {n / 3, n / 3 + 1000}};
+  for (auto [lo, hi] : ranges) {
+    uint64_t expected_key = lo;
+    for (auto cursor = tree.scan(lo, hi); cursor.is_valid(); cursor.next()) {
+      ASSERT_EQ(cursor.key(), expected_key++);
+      ASSERT_EQ(cursor.value(), 2 * cursor.key());
+    }
+    EXPECT_EQ(expected_key, hi);
+  }
+
+  std::vector<uint64_t> keys;
+  std::mt19937_64 engine{0};
+  std::uniform_int_distribution<uint64_t> key_distr(0, 2 * n);
+  for (auto i = 0; i < 1000; ++i) {
+    keys.push_back(key_distr(engine));
+  }
+  std::vector<std::optional<uint64_t>> results(keys.size());
+  tree.lookup_many(keys.data(), keys.size(), results.data());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (keys[i] < n) {
+      ASSERT_EQ(results[i], 2 * keys[i]) << "key=" << keys[i];
+    } else {
+      ASSERT_FALSE(results[i]) << "key=" << keys[i];
+    }
+  }
+}
+
+/// Replaces the file `to` with a copy of the first `size` bytes of `from`.
+void copy_file(const char* from, const char* to, size_t size = SIZE_MAX) {
+  auto from_file = File::open_file(from, File::READ);
+  size = std::min(size, from_file->size());
+  std::remove(to);
+  auto to_file = File::open_file(to, File::WRITE);
+  to_file->resize(size);
+  to_file->write_block(from_file->read_block(0, size).get(), 0, size);
+}
+
+TEST_F(BTreeTest, RecoverFromLog) {
+  auto n = 100 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64{0});
+  {
+    // The pool is smaller than the tree, so pages are written back early
+    LogManager log(File::open_file("log", File::WRITE));
+    BufferManager buffer_manager(1024, 100);
+    buffer_manager.enable_logging(log);
+    BTree tree(0, buffer_manager);
+    for (auto key : keys) {
+      tree.insert(key, 2 * key);
+    }
+    for (auto key : keys) {
+      if (key % 3 != 0) {
+        tree.erase(key);
+      }
+    }
+    buffer_manager.commit();
+
+    // Keep the files as they would be after a crash here.
+    copy_file("0", "0.crash");
+    copy_file("log", "log.crash");
+  }
+  copy_file("0.crash", "0");
+  copy_file("log.crash", "log");
+
+  LogManager log(File::open_file("log", File::WRITE));
+  BufferManager buffer_manager(1024, 100);
+  buffer_manager.enable_logging(log);
+  BTree tree(0, buffer_manager);
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key), key % 3 == 0 ? std::optional(2 * key) : std::nullopt)
+        << "key=" << key;
+  }
+
+  // The allocation maps were recovered as well
+  for (auto key : keys) {
+    tree.insert(key, 3 * key);
+  }
+  for (auto key = 0ul; key < n; ++key) {
+    ASSERT_EQ(tree.lookup(key), 3 * key) << "key=" << key;
+  }
+}
+
+TEST_F(BTreeTest, RecoverLogPrefix) {
+  auto n = 20 * BTree::LeafNode::kCapacity;
+  std::vector<uint64_t> keys(n);
+  std::iota(keys.begin(), keys.end(), 0);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64{1});
+  uint64_t log_size;
+  {
+    // No page is written back before the log is, so after a crash the
+    // segment may be empty while the log is cut off anywhere.
+    LogManager log(File::open_file("log", File::WRITE));
+    BufferManager buffer_manager(1024, 1000);
+    buffer_manager.enable_logging(log);
+    BTree tree(0, buffer_manager);
+    for (auto key : keys) {
+      tree.insert(key, 2 * key);
+    }
+    buffer_manager.commit();
+    log_size = log.get_end_lsn();
+    copy_file("log", "log.full");
+  }
+
+  for (auto cut = 0; cut <= 8; ++cut) {
+    std::remove("0");
+    copy_file("log.full", "log", log_size * cut / 8);
+    LogManager log(File::open_file("log", File::WRITE));
+    BufferManager buffer_manager(1024, 1000);
+    buffer_manager.enable_logging(log);
+    BTree tree(0, buffer_manager);
+
+    // The tree holds the keys that were inserted first, and nothing else
+    size_t found = 0;
+    while (found < n && tree.lookup(keys[found])) {
+      ++found;
+    }
+    for (auto i = found; i < n; ++i) {
+      ASSERT_FALSE(tree.lookup(keys[i])) << "cut=" << cut << " key=" << keys[i];
+    }
+    if (cut == 8) {
+      EXPECT_EQ(found, n);
+    }
+    auto scanned = 0ul;
+    uint64_t last_key = 0;
+    for (auto cursor = tree.scan(0, n); cursor.is_valid(); cursor.next()) {
+      ASSERT_TRUE(scanned == 0 || last_key < cursor.key());
+      ASSERT_EQ(cursor.value(), 2 * cursor.key());
+      last_key = cursor.key();
+      ++scanned;
+    }
+    EXPECT_EQ(scanned, found) << "cut=" << cut;
+  }
+}
+
+TEST_F(BTreeTest, ConcurrentInsertErase) {
+  // The pool is smaller than the tree, so readers also race with eviction.
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+
+  // Keys divisible by 3 stay, the others are erased, and keys from n on
+  // are inserted.
+  constexpr uint64_t n = 8000;
+  for (uint64_t key = 0; key < n; ++key) {
+    tree.insert(key, 2 * key);
+  }
+  std::atomic<bool> writers_done = false;
+  std::atomic<bool> found_wrong_value = false;
+  std::atomic<bool> scanned_wrong_keys = false;
+
+  std::vector<std::thread> threads;
+  for (uint64_t w = 1; w < 3; ++w) {
+    threads.emplace_back([&tree, w] {
+      for (uint64_t key = w; key < n; key += 3) {
+        tree.erase(key);
+      }
+    });
+  }
+  for (uint64_t w = 0; w < 2; ++w) {
+    threads.emplace_back([&tree, w] {
+      for (uint64_t key = n + w; key < 2 * n; key += 2) {
+        tree.insert(key, 2 * key);
+      }
+    });
+  }
+  auto writer_count = threads.size();
+  threads.emplace_back([&] {
+    std::mt19937_64 engine{0};
+    std::uniform_int_distribution<uint64_t> distr(0, n / 3 - 1);
+    while (!writers_done) {
+      uint64_t key = 3 * distr(engine);
+      auto value = tree.lookup(key);
+      if (!value || *value != 2 * key) {
+        found_wrong_value = true;
+      }
+    }
+  });
+  threads.emplace_back([&] {
+    while (!writers_done) {
+      // Scans see every key that stays, in order
+      uint64_t next_stable_key = 0;
+      std::optional<uint64_t> last_key;
+      for (auto cursor = tree.scan(0, n); cursor.is_valid(); cursor.next()) {
+        if ((last_key && *last_key >= cursor.key()) ||
+            cursor.key() > next_stable_key) {
+          scanned_wrong_keys = true;
+        }
+        if (cursor.key() == next_stable_key) {
+          next_stable_key += 3;
+        }
+        last_key = cursor.key();
+      }
+      if (next_stable_key < n) {
+        scanned_wrong_keys = true;
+      }
+    }
+  });
+  for (uint64_t t = 0; t < writer_count; ++t) {
+    threads[t].join();
+  }
+  writers_done = true;
+  for (uint64_t t = writer_count; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+
+  ASSERT_FALSE(found_wrong_value);
+  ASSERT_FALSE(scanned_wrong_keys);
+  for (uint64_t key = 0; key < 2 * n; ++key) {
+    auto value = tree.lookup(key);
+    ASSERT_EQ(value.has_value(), key % 3 == 0 || key >= n) << "key=" << key;
+    if (value) {
+      ASSERT_EQ(*value, 2 * key);
+    }
+  }
+}
+
+TEST_F(BTreeTest, ConcurrentInsertLookup) {
+  // The pool is smaller than the tree, so readers also race with eviction.
+  BufferManager buffer_manager(1024, 100);
+  BTree tree(0, buffer_manager);
+
+  constexpr uint64_t kWriterCount = 4;
+  constexpr uint64_t kKeysPerWriter = 2000;
+  constexpr uint64_t kKeyCount = kWriterCount * kKeysPerWriter;
+  std::atomic<bool> writers_done = false;
+  std::atomic<bool> found_wrong_value = false;
+
+  std::vector<std::thread> threads;
+  for (uint64_t w = 0; w < kWriterCount; ++w) {
+    threads.emplace_back([&tree, w] {
+      // Interleaved keys, so writers share leaves.
+      for (uint64_t i = 0; i < kKeysPerWriter; ++i) {
+        uint64_t key = i * kWriterCount + w;
+        tree.insert(key, 2 * key);
+      }
+    });
+  }
+  for (uint64_t r = 0; r < 2; ++r) {
+    threads.emplace_back([&, r] {
+      std::mt19937_64 engine{r};
+      std::uniform_int_distribution<uint64_t> distr(0, kKeyCount - 1);
+      while (!writers_done) {
+        uint64_t key = distr(engine);
+        auto value = tree.lookup(key);
+        if (value && *value != 2 * key) {
+          found_wrong_value = true;
+        }
+      }
+    });
+  }
+  for (uint64_t w = 0; w < kWriterCount; ++w) {
+    threads[w].join();
+  }
+  writers_done = true;
+  for (uint64_t t = kWriterCount; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+
+  ASSERT_FALSE(found_wrong_value);
+  for (uint64_t key = 0; key < kKeyCount; ++key) {
+    auto value = tree.lookup(key);
+    ASSERT_TRUE(value) << "key=" << key << " is missing";
+    ASSERT_EQ(*value, 2 * key);
+  }
+}
+
 }  // namespace
 
 int main(int argc, char* argv[]) {
@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "index/key_search.h"
+
+using KeySearch = buzzdb::KeySearch<uint64_t, std::less<uint64_t>>;
+
+namespace {
+
+TEST(KeySearchTest, MatchesStdLowerBound) {
+  std::mt19937_64 engine{0};
+  for (uint32_t count = 0; count <= 300; ++count) {
+    // Spread the keys over the whole range, so that the sign bit is set for
+    // some of them.
+    std::vector<uint64_t> keys(count);
+    for (auto& key : keys) {
+      key = engine() & ~1ull;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<uint64_t> probes = {0, UINT64_MAX, 1ull << 63};
+    for (auto key : keys) {
+      probes.push_back(key);
+      probes.push_back(key + 1);
+      probes.push_back(key - 1);
+    }
+    for (auto probe : probes) {
+      auto expected = std::lower_bound(keys.begin(), keys.end(), probe) - keys.begin();
+      ASSERT_EQ(KeySearch::lower_bound(keys.data(), count, probe), expected)
+          << "count=" << count << " key=" << probe;
+    }
+  }
+}
+
+#if defined(__x86_64__)
+TEST(KeySearchTest, KernelsMatchScalar) {
+  // Each kernel that this CPU supports, whichever one `lower_bound()` picks
+  std::mt19937_64 engine{0};
+  std::vector<uint64_t> keys(KeySearch::kWindow + 3);
+  for (auto& key : keys) {
+    key = engine();
+  }
+  std::sort(keys.begin(), keys.end());
+  for (uint32_t n = 0; n <= keys.size(); ++n) {
+    std::vector<uint64_t> probes = {0, 1ull << 63, UINT64_MAX, keys[n / 2],
+                                    keys[n / 2] + 1};
+    for (auto probe : probes) {
+      auto expected = KeySearch::count_less_scalar(keys.data(), 0, n, probe);
+      if (__builtin_cpu_supports("sse4.2")) {
+        ASSERT_EQ(KeySearch::count_less_sse42(keys.data(), n, probe), expected)
+            << "n=" << n << " key=" << probe;
+      }
+      if (__builtin_cpu_supports("avx2")) {
+        ASSERT_EQ(KeySearch::count_less_avx2(keys.data(), n, probe), expected)
+            << "n=" << n << " key=" << probe;
+      }
+    }
+  }
+}
+#endif
+
+TEST(KeySearchTest, Duplicates) {
+  std::vector<uint64_t> keys = {1, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+                                3, 3, 3, 3, 3, 3, 3, 3, 7, 7, 9};
+  auto count = static_cast<uint32_t>(keys.size());
+  EXPECT_EQ(KeySearch::lower_bound(keys.data(), count, 3), 1u);
+  EXPECT_EQ(KeySearch::lower_bound(keys.data(), count, 4), 20u);
+  EXPECT_EQ(KeySearch::lower_bound(keys.data(), count, 7), 20u);
+  EXPECT_EQ(KeySearch::lower_bound(keys.data(), count, 10), count);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
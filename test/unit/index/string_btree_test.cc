@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstddef>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/defer.h"
+#include "index/string_btree.h"
+
+using BufferManager = buzzdb::BufferManager;
+using Defer = buzzdb::Defer;
+using StringBTree = buzzdb::StringBTree<uint64_t, 1024>;  // NOLINT
+
+namespace {
+
+/// Starts every test with a fresh segment file, as the segment keeps its
+/// allocation maps there, and removes the files it wrote at the end.
+class StringBTreeTest : public ::testing::Test {
+ protected:
+  void SetUp() override { remove_files(); }
+  void TearDown() override { remove_files(); }
+
+  static void remove_files() {
+    std::remove("0");
+    std::remove("1");
+  }
+};
+
+/// Returns `n` distinct URL-like keys of varying length, not sorted.
+std::vector<std::string> make_keys(size_t n, uint64_t seed) {
+  std::mt19937_64 engine{seed};
+  std::uniform_int_distribution<int> letter('a', 'z');
+  std::uniform_int_distribution<size_t> length(1, 40);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < n; ++i) {
+    std::string key = "https://example.com/";
+    key += std::to_string(i % 7) + "/";
+    for (size_t j = length(engine); j > 0; --j) {
+      key += static_cast<char>(letter(engine));
+    }
+    key += "/" + std::to_string(i);
+    keys.push_back(std::move(key));
+  }
+  return keys;
+}
+
+TEST_F(StringBTreeTest, LookupEmptyTree) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  ASSERT_FALSE(tree.lookup("key"));
+  ASSERT_FALSE(tree.lookup(""));
+}
+
+TEST_F(StringBTreeTest, InsertLookup) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  auto keys = make_keys(5000, 0);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tree.insert(keys[i], i);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    auto value = tree.lookup(keys[i]);
+    ASSERT_TRUE(value) << "key=" << keys[i] << " is missing";
+    ASSERT_EQ(*value, i);
+  }
+
+  // Prefixes and extensions of keys are different keys.
+  ASSERT_FALSE(tree.lookup("https://example.com/"));
+  ASSERT_FALSE(tree.lookup(keys[0] + "x"));
+  ASSERT_FALSE(tree.lookup(keys[0].substr(0, keys[0].size() - 1)));
+}
+
+TEST_F(StringBTreeTest, InsertOverwrites) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  auto keys = make_keys(2000, 1);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tree.insert(keys[i], i);
+  }
+  for (uint64_t i = 0; i < keys.size(); i += 2) {
+    tree.insert(keys[i], 3 * i);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i % 2 == 0 ? 3 * i : i);
+  }
+}
+
+TEST_F(StringBTreeTest, EmptyAndLongKeys) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  std::vector<std::string> keys{""};
+  for (size_t i = 0; i < 200; ++i) {
+    // Keys of maximal length that differ only in their last bytes.
+    std::string key(StringBTree::kMaxKeyLength, 'k');
+    key[key.size() - 2] = static_cast<char>('a' + i / 26);
+    key[key.size() - 1] = static_cast<char>('a' + i % 26);
+    keys.push_back(std::move(key));
+  }
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64{2});
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tree.insert(keys[i], i);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i);
+  }
+
+  // Longer keys are rejected, also far beyond the 16 bit slot lengths
+  for (uint32_t length : {StringBTree::kMaxKeyLength + 1, 70000u}) {
+    EXPECT_THROW(tree.insert(std::string(length, 'k'), 0),
+                 std::invalid_argument);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i);
+  }
+}
+
+TEST_F(StringBTreeTest, Erase) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  auto keys = make_keys(3000, 3);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tree.insert(keys[i], i);
+  }
+  for (uint64_t i = 0; i < keys.size(); i += 3) {
+    tree.erase(keys[i]);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]).has_value(), i % 3 != 0);
+  }
+
+  // Erased space is reused by later inserts.
+  for (uint64_t i = 0; i < keys.size(); i += 3) {
+    tree.insert(keys[i], i);
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i);
+  }
+}
+
+TEST_F(StringBTreeTest, FullBufferDuringStructureChange) {
+  BufferManager buffer_manager(1024, 12);
+  StringBTree tree(0, buffer_manager);
+  auto keys = make_keys(3000, 4);
+
+  // Pages of another segment take all but a few frames of the pool
+  std::vector<buzzdb::BufferFrame*> pinned;
+  auto pin = [&](size_t free_count) {
+    for (uint64_t i = 0; i + free_count < 12; ++i) {
+      pinned.push_back(&buffer_manager.fix_page(
+          BufferManager::get_overall_page_id(1, i), false));
+    }
+  };
+  auto unpin = [&]() {
+    for (auto* page : pinned) {
+      buffer_manager.unfix_page(*page, false);
+    }
+    pinned.clear();
+  };
+  Defer unpin_on_exit(unpin);
+
+  // Inserts that throw, and then the same inserts without the pins
+  auto insert_with_pins = [&](size_t begin, size_t end, size_t free_count) {
+    pin(free_count);
+    std::vector<uint64_t> failed;
+    for (uint64_t i = begin; i < end; ++i) {
+      try {
+        tree.insert(keys[i], i);
+      } catch (const buzzdb::buffer_full_error&) {
+        failed.push_back(i);
+      }
+    }
+    EXPECT_FALSE(failed.empty());
+    unpin();
+    for (auto i : failed) {
+      tree.insert(keys[i], i);
+    }
+  };
+
+  // Splitting the root takes three frames
+  insert_with_pins(0, keys.size() / 2, 2);
+  // Descending from the root takes two
+  insert_with_pins(keys.size() / 2, keys.size(), 1);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i) << keys[i];
+  }
+}
+
+TEST_F(StringBTreeTest, SeparatorTruncation) {
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 2000; ++i) {
+    // A long shared prefix, a distinguishing byte, and a long shared suffix.
+    std::string key = "https://example.com/users/";
+    key += std::to_string(1000000 + i);
+    key += "/profile/settings/notifications";
+    keys.push_back(std::move(key));
+  }
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    tree.insert(keys[i], i);
+  }
+
+  auto& root_page = buffer_manager.fix_page(*tree.root, false);
+  auto root_node = reinterpret_cast<StringBTree::Node*>(root_page.get_data());
+  Defer root_page_unfix([&]() { buffer_manager.unfix_page(root_page, false); });
+  ASSERT_FALSE(root_node->is_leaf());
+  ASSERT_GT(root_node->count, 0u);
+  for (uint32_t i = 0; i < root_node->count; ++i) {
+    // The separators end after the digits that tell the keys apart.
+    auto separator = root_node->key(i);
+    EXPECT_LT(separator.size(), keys[0].size() - 20) << separator;
+    if (i > 0) {
+      EXPECT_LT(root_node->key(i - 1), separator);
+    }
+  }
+}
+
+TEST_F(StringBTreeTest, Reopen) {
+  auto keys = make_keys(2000, 5);
+  {
+    BufferManager buffer_manager(1024, 100);
+    StringBTree tree(0, buffer_manager);
+    for (uint64_t i = 0; i < keys.size(); ++i) {
+      tree.insert(keys[i], i);
+    }
+  }
+
+  // A new buffer manager reads the tree back from the segment file.
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+  ASSERT_TRUE(tree.root) << "the tree should be found again";
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    ASSERT_EQ(tree.lookup(keys[i]), i);
+  }
+}
+
+TEST_F(StringBTreeTest, ConcurrentInsertLookup) {
+  // The pool is smaller than the tree, so readers also race with eviction.
+  BufferManager buffer_manager(1024, 100);
+  StringBTree tree(0, buffer_manager);
+
+  constexpr uint64_t kWriterCount = 4;
+  constexpr uint64_t kKeysPerWriter = 2000;
+  auto keys = make_keys(kWriterCount * kKeysPerWriter, 4);
+  std::atomic<bool> writers_done = false;
+  std::atomic<bool> found_wrong_value = false;
+
+  std::vector<std::thread> threads;
+  for (uint64_t w = 0; w < kWriterCount; ++w) {
+    threads.emplace_back([&, w] {
+      for (uint64_t i = w; i < keys.size(); i += kWriterCount) {
+        tree.insert(keys[i], i);
+      }
+    });
+  }
+  for (uint64_t r = 0; r < 2; ++r) {
+    threads.emplace_back([&, r] {
+      std::mt19937_64 engine{r};
+      std::uniform_int_distribution<uint64_t> distr(0, keys.size() - 1);
+      while (!writers_done) {
+        uint64_t i = distr(engine);
+        auto value = tree.lookup(keys[i]);
+        if (value && *value != i) {
+          found_wrong_value = true;
+        }
+      }
+    });
+  }
+  for (uint64_t w = 0; w < kWriterCount; ++w) {
+    threads[w].join();
+  }
+  writers_done = true;
+  for (uint64_t t = kWriterCount; t < threads.size(); ++t) {
+    threads[t].join();
+  }
+
+  ASSERT_FALSE(found_wrong_value);
+  for (uint64_t i = 0; i < keys.size(); ++i) {
+    auto value = tree.lookup(keys[i]);
+    ASSERT_TRUE(value) << "key=" << keys[i] << " is missing";
+    ASSERT_EQ(*value, i);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
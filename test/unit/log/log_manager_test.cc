@@ -0,0 +1,285 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+#include "log/log_manager.h"
+#include "storage/file.h"
+#include "storage/test_file.h"
+
+using BufferManager = buzzdb::BufferManager;
+using File = buzzdb::File;
+using LogManager = buzzdb::LogManager;
+using TestFile = buzzdb::TestFile;
+
+namespace {
+
+constexpr uint16_t kSegmentId = 11;
+
+/// Starts every test without log and segment files and removes those it
+/// wrote at the end.
+class LogManagerTest : public ::testing::Test {
+ protected:
+  void SetUp() override { remove_files(); }
+  void TearDown() override { remove_files(); }
+
+  static void remove_files() {
+    for (const char* filename : {"log", "11", "log.crash", "11.crash"}) {
+      std::remove(filename);
+    }
+  }
+
+  /// Returns the records in the log file "log".
+  static std::vector<std::string> read_records() {
+    LogManager log(File::open_file("log", File::WRITE));
+    std::vector<std::string> records;
+    log.replay([&](const char* data, size_t size) {
+      records.emplace_back(data, size);
+    });
+    return records;
+  }
+
+  /// Replaces the file `to` with a copy of `from`.
+  static void copy_file(const char* from, const char* to) {
+    auto from_file = File::open_file(from, File::READ);
+    std::remove(to);
+    auto to_file = File::open_file(to, File::WRITE);
+    to_file->resize(from_file->size());
+    auto content = from_file->read_block(0, from_file->size());
+    to_file->write_block(content.get(), 0, from_file->size());
+  }
+};
+
+/// A file whose writes take a while, like writes to a disk.
+class SlowFile : public TestFile {
+ public:
+  void write_block(const char* block, size_t offset, size_t size) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    TestFile::write_block(block, offset, size);
+  }
+};
+
+/// A file whose writes or syncs fail while requested.
+class FailingFile : public TestFile {
+ public:
+  bool fail_write = false;
+  bool fail_sync = false;
+
+  void write_block(const char* block, size_t offset, size_t size) override {
+    if (fail_write) {
+      throw std::system_error{EIO, std::system_category()};
+    }
+    TestFile::write_block(block, offset, size);
+  }
+
+  void sync() override {
+    if (fail_sync) {
+      throw std::system_error{EIO, std::system_category()};
+    }
+  }
+};
+
+TEST_F(LogManagerTest, AppendReplay) {
+  std::vector<std::string> records;
+  {
+    LogManager log(File::open_file("log", File::WRITE));
+    log.replay([](const char*, size_t) { FAIL() << "the log should be empty"; });
+    uint64_t last_lsn = 0;
+    for (size_t i = 1; i <= 100; ++i) {
+      records.emplace_back(i * 7, static_cast<char>('a' + i % 26));
+      uint64_t lsn = log.append(records.back().data(), records.back().size());
+      EXPECT_GT(lsn, last_lsn);
+      last_lsn = lsn;
+    }
+    EXPECT_EQ(log.get_end_lsn(), last_lsn);
+    log.flush(last_lsn);
+    EXPECT_EQ(log.get_write_count(), 1u);
+  }
+  EXPECT_EQ(read_records(), records);
+}
+
+TEST_F(LogManagerTest, TornRecord) {
+  uint64_t second_lsn;
+  {
+    LogManager log(File::open_file("log", File::WRITE));
+    log.replay([](const char*, size_t) {});
+    log.append("first", 5);
+    second_lsn = log.append("second", 6);
+    log.flush(log.append("third", 5));
+  }
+  // Tear the last record
+  {
+    auto file = File::open_file("log", File::WRITE);
+    file->write_block("xx", second_lsn + 9, 2);
+  }
+  EXPECT_EQ(read_records(), (std::vector<std::string>{"first", "second"}));
+
+  // New records follow the last complete one
+  {
+    LogManager log(File::open_file("log", File::WRITE));
+    log.replay([](const char*, size_t) {});
+    EXPECT_EQ(log.get_end_lsn(), second_lsn);
+    log.flush(log.append("fourth", 6));
+  }
+  EXPECT_EQ(read_records(),
+            (std::vector<std::string>{"first", "second", "fourth"}));
+}
+
+TEST_F(LogManagerTest, GroupCommit) {
+  LogManager log(std::make_unique<SlowFile>());
+  constexpr int kThreadCount = 4;
+  constexpr int kCommitCount = 50;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([&log] {
+      for (int i = 0; i < kCommitCount; ++i) {
+        log.flush(log.append("record", 6));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  // Threads that commit while the log is written share the next write
+  EXPECT_LT(log.get_write_count(), kThreadCount * kCommitCount);
+}
+
+TEST_F(LogManagerTest, FailedWriteKeepsRecords) {
+  std::vector<std::string> records{"first", "second", "third", "fourth"};
+  std::vector<char> content;
+  {
+    auto file = std::make_unique<FailingFile>();
+    auto* failing_file = file.get();
+    LogManager log(std::move(file));
+    log.flush(log.append(records[0].data(), records[0].size()));
+
+    failing_file->fail_write = true;
+    uint64_t lsn = log.append(records[1].data(), records[1].size());
+    EXPECT_THROW(log.flush(lsn), std::system_error);
+    failing_file->fail_write = false;
+    failing_file->fail_sync = true;
+    lsn = log.append(records[2].data(), records[2].size());
+    EXPECT_THROW(log.flush(lsn), std::system_error);
+    failing_file->fail_sync = false;
+
+    // The records of the failed writes come before later ones
+    log.flush(log.append(records[3].data(), records[3].size()));
+    content = failing_file->get_content();
+  }
+
+  LogManager log(std::make_unique<TestFile>(std::move(content), File::WRITE));
+  std::vector<std::string> replayed;
+  log.replay([&](const char* data, size_t size) {
+    replayed.emplace_back(data, size);
+  });
+  EXPECT_EQ(replayed, records);
+}
+
+TEST_F(LogManagerTest, RedoPageChanges) {
+  constexpr uint64_t kPageCount = 50;
+  auto page_id = [](uint64_t i) {
+    return BufferManager::get_overall_page_id(kSegmentId, i);
+  };
+  {
+    LogManager log(File::open_file("log", File::WRITE));
+    // The pool is smaller than the pages, so some are written back early
+    BufferManager buffer_manager(1024, 10);
+    buffer_manager.enable_logging(log);
+    for (uint64_t i = 0; i < kPageCount; ++i) {
+      auto& page = buffer_manager.fix_page(page_id(i), true);
+      std::memset(page.get_data(), static_cast<int>(i), 1024);
+      buffer_manager.unfix_page(page, true);
+    }
+    for (uint64_t i = 0; i < kPageCount; i += 2) {
+      auto& page = buffer_manager.fix_page(page_id(i), true);
+      std::memcpy(page.get_data() + 100, "changed", 7);
+      buffer_manager.unfix_page(page, true);
+    }
+    buffer_manager.commit();
+
+    // Keep the files as they would be after a crash here.
+    copy_file("log", "log.crash");
+    copy_file("11", "11.crash");
+  }
+  copy_file("log.crash", "log");
+  copy_file("11.crash", "11");
+
+  LogManager log(File::open_file("log", File::WRITE));
+  BufferManager buffer_manager(1024, 10);
+  buffer_manager.enable_logging(log);
+  for (uint64_t i = 0; i < kPageCount; ++i) {
+    auto& page = buffer_manager.fix_page(page_id(i), false);
+    std::vector<char> expected(1024, static_cast<char>(i));
+    if (i % 2 == 0) {
+      std::memcpy(expected.data() + 100, "changed", 7);
+    }
+    EXPECT_EQ(std::memcmp(page.get_data(), expected.data(), 1024), 0)
+        << "page " << i;
+    buffer_manager.unfix_page(page, false);
+  }
+}
+
+TEST_F(LogManagerTest, AbortedChangeIsNotLogged) {
+  LogManager log(File::open_file("log", File::WRITE));
+  BufferManager buffer_manager(1024, 10);
+  buffer_manager.enable_logging(log);
+  auto page_id = BufferManager::get_overall_page_id(kSegmentId, 0);
+  auto& page = buffer_manager.fix_page(page_id, true);
+  std::memcpy(page.get_data(), "before", 6);
+  buffer_manager.unfix_page(page, true);
+  auto end_lsn = log.get_end_lsn();
+
+  // A change that throws halfway, e.g. as the pool is full
+  EXPECT_THROW(
+      {
+        BufferManager::AtomicChange change{buffer_manager};
+        for (uint64_t i = 0; i < 2; ++i) {
+          auto& changed_page = buffer_manager.fix_page(
+              BufferManager::get_overall_page_id(kSegmentId, i), true);
+          std::memcpy(changed_page.get_data(), "after", 5);
+          buffer_manager.unfix_page(changed_page, true);
+        }
+        throw std::runtime_error("aborted");
+      },
+      std::runtime_error);
+
+  // Nothing was logged, and the pages are unlatched and rolled back
+  EXPECT_EQ(log.get_end_lsn(), end_lsn);
+  for (uint64_t i = 0; i < 2; ++i) {
+    auto& rolled_back_page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, i), true);
+    EXPECT_EQ(std::string(rolled_back_page.get_data(), 6),
+              i == 0 ? std::string("before") : std::string(6, '\0'));
+    buffer_manager.unfix_page(rolled_back_page, false);
+  }
+}
+
+TEST_F(LogManagerTest, CheckpointEmptiesLog) {
+  LogManager log(File::open_file("log", File::WRITE));
+  BufferManager buffer_manager(1024, 10);
+  buffer_manager.enable_logging(log);
+  auto& page = buffer_manager.fix_page(
+      BufferManager::get_overall_page_id(kSegmentId, 0), true);
+  std::memcpy(page.get_data(), "data", 4);
+  buffer_manager.unfix_page(page, true);
+  EXPECT_GT(log.get_end_lsn(), 0u);
+
+  buffer_manager.checkpoint();
+  EXPECT_EQ(log.get_end_lsn(), 0u);
+  auto file = File::open_file("11", File::READ);
+  EXPECT_EQ(std::string(file->read_block(0, 4).get(), 4), "data");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
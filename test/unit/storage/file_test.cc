@@ -0,0 +1,123 @@
+#include <gtest/gtest.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "storage/file.h"
+#include "storage/mmap_file.h"
+#include "storage/test_file.h"
+
+using File = buzzdb::File;
+using MmapFile = buzzdb::MmapFile;
+using TestFile = buzzdb::TestFile;
+
+namespace {
+
+/// Returns `size` bytes of memory that are aligned for direct I/O.
+std::unique_ptr<char, decltype(&std::free)> make_aligned_block(size_t size) {
+  return {static_cast<char*>(std::aligned_alloc(File::kDirectAlignment, size)),
+          &std::free};
+}
+
+TEST(FileTest, WriteReadEachDurability) {
+  for (auto durability : {File::BUFFERED, File::DSYNC}) {
+    auto file = File::make_temporary_file(durability);
+    file->resize(8192);
+    file->write_block("durable", 4096, 7);
+    file->sync_range(4096, 4096);
+    file->sync();
+    EXPECT_EQ(std::string(file->read_block(4096, 7).get(), 7), "durable");
+    EXPECT_EQ(file->size(), 8192u);
+  }
+}
+
+TEST(FileTest, DirectIO) {
+  std::unique_ptr<File> file;
+  try {
+    file = File::make_temporary_file(File::DIRECT);
+  } catch (const std::system_error& e) {
+    // Some file systems, such as tmpfs, do not support O_DIRECT.
+    GTEST_SKIP() << "O_DIRECT is not supported here: " << e.what();
+  }
+  constexpr size_t kBlockSize = 2 * File::kDirectAlignment;
+  auto block = make_aligned_block(kBlockSize);
+  std::memset(block.get(), 'd', kBlockSize);
+  file->resize(2 * kBlockSize);
+  file->write_block(block.get(), kBlockSize, kBlockSize);
+  file->sync();
+
+  auto read = make_aligned_block(kBlockSize);
+  file->read_block(kBlockSize, kBlockSize, read.get());
+  EXPECT_EQ(std::memcmp(read.get(), block.get(), kBlockSize), 0);
+}
+
+TEST(FileTest, ReopenAfterSync) {
+  std::remove("file_test");
+  {
+    auto file = File::open_file("file_test", File::WRITE, File::BUFFERED);
+    file->resize(1024);
+    file->write_block("content", 0, 7);
+    file->sync();
+  }
+  auto file = File::open_file("file_test", File::READ);
+  EXPECT_EQ(std::string(file->read_block(0, 7).get(), 7), "content");
+  std::remove("file_test");
+}
+
+TEST(FileTest, WriteReadBlocks) {
+  std::unique_ptr<File> files[] = {File::make_temporary_file(),
+                                   std::make_unique<TestFile>()};
+  for (auto& file : files) {
+    file->resize(64);
+    // Two runs of adjacent blocks and a single one
+    std::string data[] = {"aaaa", "bbbbbbbb", "cc", "dddd", "eeee"};
+    File::Block blocks[] = {{0, 4, data[0].data()},
+                            {4, 8, data[1].data()},
+                            {12, 2, data[2].data()},
+                            {32, 4, data[3].data()},
+                            {36, 4, data[4].data()}};
+    file->write_blocks(blocks, 5);
+    EXPECT_EQ(std::string(file->read_block(0, 14).get(), 14),
+              "aaaabbbbbbbbcc");
+    EXPECT_EQ(std::string(file->read_block(32, 8).get(), 8), "ddddeeee");
+
+    std::string read[] = {std::string(6, '\0'), std::string(8, '\0'),
+                          std::string(2, '\0')};
+    File::Block read_blocks[] = {{2, 6, read[0].data()},
+                                 {32, 8, read[1].data()},
+                                 {12, 2, read[2].data()}};
+    file->read_blocks(read_blocks, 3);
+    EXPECT_EQ(read[0], "aabbbb");
+    EXPECT_EQ(read[1], "ddddeeee");
+    EXPECT_EQ(read[2], "cc");
+  }
+}
+
+TEST(FileTest, MmapFile) {
+  std::remove("file_test");
+  {
+    auto file = File::open_file("file_test", File::WRITE);
+    file->resize(3 * 4096);
+    file->write_block("mapped", 4096, 6);
+  }
+  auto file = MmapFile::map_file("file_test", MmapFile::RANDOM);
+  EXPECT_EQ(file->get_mode(), File::READ);
+  EXPECT_EQ(file->size(), 3u * 4096);
+  EXPECT_EQ(std::string(file->get_data() + 4096, 6), "mapped");
+  EXPECT_EQ(std::string(file->read_block(4096, 6).get(), 6), "mapped");
+  file->advise(MmapFile::WILL_NEED, 4000, 200);
+  file->advise(MmapFile::SEQUENTIAL);
+  EXPECT_THROW(file->write_block("x", 0, 1), std::system_error);
+  EXPECT_THROW(file->resize(0), std::system_error);
+  std::remove("file_test");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,130 @@
+#include <gtest/gtest.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "storage/file.h"
+#include "storage/io_queue.h"
+#include "storage/test_file.h"
+
+using File = buzzdb::File;
+using IOQueue = buzzdb::IOQueue;
+using TestFile = buzzdb::TestFile;
+
+namespace {
+
+/// Runs every test with both backends. The io_uring tests are skipped where
+/// the kernel does not support it.
+class IOQueueTest : public ::testing::TestWithParam<IOQueue::Backend> {
+ protected:
+  void SetUp() override {
+    queue = IOQueue::create(kDepth, GetParam());
+    if (!queue) {
+      GTEST_SKIP() << "io_uring is not supported here";
+    }
+    EXPECT_EQ(queue->get_backend(), GetParam());
+  }
+
+  /// Reaps `count` completions and returns them indexed by tag.
+  std::vector<int> reap_all(size_t count) {
+    std::vector<int> errors(count, -1);
+    std::vector<IOQueue::Completion> completions(count);
+    size_t reaped = 0;
+    while (reaped < count) {
+      size_t n = queue->reap(completions.data(), count - reaped, 1);
+      for (size_t i = 0; i < n; ++i) {
+        EXPECT_EQ(errors[completions[i].tag], -1) << "reaped twice";
+        errors[completions[i].tag] = completions[i].error;
+      }
+      reaped += n;
+    }
+    return errors;
+  }
+
+  static constexpr size_t kDepth = 32;
+  std::unique_ptr<IOQueue> queue;
+};
+
+TEST_P(IOQueueTest, WriteRead) {
+  constexpr size_t kBlockSize = 1024;
+  auto file = File::make_temporary_file();
+  file->resize(kDepth * kBlockSize);
+
+  std::vector<std::string> blocks;
+  for (size_t i = 0; i < kDepth; ++i) {
+    blocks.emplace_back(kBlockSize, static_cast<char>('a' + i % 26));
+  }
+  for (size_t i = 0; i < kDepth; ++i) {
+    queue->write(*file, blocks[i].data(), i * kBlockSize, kBlockSize, i);
+  }
+  EXPECT_EQ(queue->get_pending(), kDepth);
+  queue->submit();
+  EXPECT_EQ(reap_all(kDepth), std::vector<int>(kDepth, 0));
+  EXPECT_EQ(queue->get_pending(), 0u);
+
+  std::vector<std::string> read(kDepth, std::string(kBlockSize, '\0'));
+  // Read in reverse order, in two batches
+  for (size_t i = kDepth; i > 0; --i) {
+    queue->read(*file, (i - 1) * kBlockSize, kBlockSize, read[i - 1].data(),
+                i - 1);
+    if (i == kDepth / 2) {
+      queue->submit();
+    }
+  }
+  queue->submit();
+  EXPECT_EQ(reap_all(kDepth), std::vector<int>(kDepth, 0));
+  EXPECT_EQ(read, blocks);
+}
+
+TEST_P(IOQueueTest, FileWithoutDescriptor) {
+  TestFile file;
+  file.resize(16);
+  queue->write(file, "async", 8, 5, 0);
+  queue->submit();
+  EXPECT_EQ(reap_all(1), std::vector<int>{0});
+
+  char block[5];
+  queue->read(file, 8, 5, block, 0);
+  queue->submit();
+  EXPECT_EQ(reap_all(1), std::vector<int>{0});
+  EXPECT_EQ(std::string(block, 5), "async");
+}
+
+TEST_P(IOQueueTest, ReadBeyondEnd) {
+  auto file = File::make_temporary_file();
+  file->resize(4);
+  file->write_block("tail", 0, 4);
+  std::string block(8, 'x');
+  queue->read(*file, 0, 8, block.data(), 0);
+  queue->submit();
+  EXPECT_EQ(reap_all(1), std::vector<int>{0});
+  EXPECT_EQ(block.substr(0, 4), "tail");
+}
+
+TEST_P(IOQueueTest, ReportsErrors) {
+  auto path = std::string{"io_queue_read_only"};
+  File::open_file(path.c_str(), File::WRITE)->resize(16);
+  auto file = File::open_file(path.c_str(), File::READ);
+  queue->write(*file, "denied", 0, 6, 0);
+  queue->submit();
+  EXPECT_EQ(reap_all(1), std::vector<int>{EBADF});
+  std::remove(path.c_str());
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, IOQueueTest,
+                         ::testing::Values(IOQueue::Backend::IO_URING,
+                                           IOQueue::Backend::THREAD_POOL),
+                         [](const auto& info) {
+                           return info.param == IOQueue::Backend::IO_URING
+                                      ? "IoUring"
+                                      : "ThreadPool";
+                         });
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "buffer/buffer_manager.h"
+#include "common/error.h"
+#include "index/btree.h"
+#include "storage/file.h"
+#include "storage/segment.h"
+
+using BTree = buzzdb::BTree<uint64_t, uint64_t, std::less<uint64_t>, 1024>;
+using BufferManager = buzzdb::BufferManager;
+using File = buzzdb::File;
+using Segment = buzzdb::Segment;
+
+namespace {
+
+constexpr uint16_t kSegmentId = 7;
+constexpr uint64_t kPagesPerMap = 1024 * 8;
+
+/// Starts every test with a fresh segment file and removes it at the end.
+class SegmentTest : public ::testing::Test {
+ protected:
+  void SetUp() override { std::remove("7"); }
+  void TearDown() override { std::remove("7"); }
+
+  /// Returns the size of the segment file in pages.
+  static size_t get_file_pages() {
+    return File::open_file("7", File::READ)->size() / 1024;
+  }
+};
+
+TEST_F(SegmentTest, AllocateDistinctPages) {
+  BufferManager buffer_manager(1024, 10);
+  Segment segment(kSegmentId, buffer_manager);
+
+  // Enough pages for three allocation maps, handed out in order
+  std::vector<uint64_t> segment_page_ids;
+  for (auto i = 0ul; i < 2 * kPagesPerMap + 10; ++i) {
+    auto page_id = segment.allocate_page();
+    ASSERT_EQ(BufferManager::get_segment_id(page_id), kSegmentId);
+    segment_page_ids.push_back(BufferManager::get_segment_page_id(page_id));
+  }
+  ASSERT_TRUE(std::is_sorted(segment_page_ids.begin(), segment_page_ids.end()));
+  ASSERT_EQ(std::adjacent_find(segment_page_ids.begin(), segment_page_ids.end()),
+            segment_page_ids.end());
+
+  // The header page and the map pages are never handed out
+  for (uint64_t map = 0; map < 3; ++map) {
+    auto map_page_id = 1 + map * (kPagesPerMap + 1);
+    EXPECT_FALSE(std::binary_search(segment_page_ids.begin(),
+                                    segment_page_ids.end(), map_page_id));
+  }
+  EXPECT_EQ(segment_page_ids.front(), 2u);
+  EXPECT_EQ(segment_page_ids.back(), 2 * kPagesPerMap + 10 + 3);
+}
+
+TEST_F(SegmentTest, ReuseFreedPages) {
+  BufferManager buffer_manager(1024, 10);
+  Segment segment(kSegmentId, buffer_manager);
+  std::vector<uint64_t> page_ids;
+  for (auto i = 0; i < 100; ++i) {
+    page_ids.push_back(segment.allocate_page());
+  }
+
+  // Freed pages are handed out again, lowest first, before new ones
+  std::vector<uint64_t> freed;
+  for (auto i = 5; i < 100; i += 10) {
+    segment.free_page(page_ids[i]);
+    freed.push_back(page_ids[i]);
+  }
+  for (auto page_id : freed) {
+    EXPECT_EQ(segment.allocate_page(), page_id);
+  }
+  EXPECT_EQ(segment.allocate_page(), page_ids.back() + 1);
+}
+
+TEST_F(SegmentTest, GrowInExtents) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 10);
+  auto segment = std::make_unique<Segment>(kSegmentId, *buffer_manager);
+
+  // The first page reserves a whole extent
+  auto first_page_id = segment->allocate_page();
+  EXPECT_EQ(get_file_pages(), Segment::kExtentPages);
+  while (BufferManager::get_segment_page_id(segment->allocate_page()) <
+         Segment::kExtentPages - 1) {
+    EXPECT_EQ(get_file_pages(), Segment::kExtentPages);
+  }
+  segment->allocate_page();
+  EXPECT_EQ(get_file_pages(), 2 * Segment::kExtentPages);
+
+  // Freed pages do not grow the file when they are reused
+  segment->free_page(first_page_id);
+  EXPECT_EQ(segment->allocate_page(), first_page_id);
+  EXPECT_EQ(get_file_pages(), 2 * Segment::kExtentPages);
+}
+
+TEST_F(SegmentTest, ShrinkAfterErase) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 100);
+  auto tree = std::make_unique<BTree>(kSegmentId, *buffer_manager);
+  constexpr uint64_t kKeyCount = 20000;
+  for (auto key = 0ul; key < kKeyCount; ++key) {
+    tree->insert(key, 2 * key);
+  }
+  ASSERT_GT(get_file_pages(), 4 * Segment::kExtentPages);
+
+  // The merged pages are freed, and the root alone remains in the first
+  // extent
+  for (auto key = 0ul; key < kKeyCount; ++key) {
+    tree->erase(key);
+  }
+  EXPECT_EQ(get_file_pages(), Segment::kExtentPages);
+
+  // The freed pages are not written back, and the file grows again
+  tree.reset();
+  buffer_manager = std::make_unique<BufferManager>(1024, 100);
+  EXPECT_EQ(get_file_pages(), Segment::kExtentPages);
+  tree = std::make_unique<BTree>(kSegmentId, *buffer_manager);
+  for (auto key = 0ul; key < kKeyCount; ++key) {
+    tree->insert(key, 3 * key);
+  }
+  EXPECT_GT(get_file_pages(), 4 * Segment::kExtentPages);
+  for (auto key = 0ul; key < kKeyCount; ++key) {
+    ASSERT_EQ(tree->lookup(key), 3 * key) << "key=" << key;
+  }
+}
+
+TEST_F(SegmentTest, PersistentAllocationMap) {
+  auto buffer_manager = std::make_unique<BufferManager>(1024, 10);
+  auto segment = std::make_unique<Segment>(kSegmentId, *buffer_manager);
+  std::vector<uint64_t> page_ids;
+  for (auto i = 0; i < 100; ++i) {
+    page_ids.push_back(segment->allocate_page());
+  }
+  for (auto i = 0; i < 100; i += 2) {
+    segment->free_page(page_ids[i]);
+  }
+
+  // Destroy the buffer manager and create a new one.
+  segment.reset();
+  buffer_manager = std::make_unique<BufferManager>(1024, 10);
+  segment = std::make_unique<Segment>(kSegmentId, *buffer_manager);
+  for (auto i = 0; i < 100; i += 2) {
+    EXPECT_EQ(segment->allocate_page(), page_ids[i]);
+  }
+  EXPECT_EQ(segment->allocate_page(), page_ids.back() + 1);
+}
+
+TEST_F(SegmentTest, RejectUnknownFormat) {
+  {
+    BufferManager buffer_manager(1024, 10);
+    Segment segment(kSegmentId, buffer_manager);
+    segment.allocate_page();
+    auto& page = buffer_manager.fix_page(
+        BufferManager::get_overall_page_id(kSegmentId, 0), true);
+    auto* header = reinterpret_cast<Segment::Header*>(page.get_data());
+    EXPECT_EQ(header->magic, Segment::kMagic);
+    EXPECT_EQ(header->format_version, Segment::kFormatVersion);
+    ++header->format_version;
+    buffer_manager.unfix_page(page, true);
+  }
+  BufferManager buffer_manager(1024, 10);
+  EXPECT_THROW(Segment(kSegmentId, buffer_manager), buzzdb::Exception);
+}
+
+TEST_F(SegmentTest, ConcurrentAllocateFree) {
+  BufferManager buffer_manager(1024, 10);
+  Segment segment(kSegmentId, buffer_manager);
+  constexpr int kThreadCount = 4;
+  std::vector<std::vector<uint64_t>> kept(kThreadCount);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreadCount; ++t) {
+    threads.emplace_back([&segment, &kept, t] {
+      for (int i = 0; i < 2000; ++i) {
+        auto page_id = segment.allocate_page();
+        if (i % 2 == 0) {
+          kept[t].push_back(page_id);
+        } else {
+          segment.free_page(page_id);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  // No page was handed out twice
+  std::set<uint64_t> page_ids;
+  for (auto& thread_page_ids : kept) {
+    for (auto page_id : thread_page_ids) {
+      ASSERT_TRUE(page_ids.insert(page_id).second) << page_id;
+    }
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}